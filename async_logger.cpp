@@ -0,0 +1,95 @@
+#include "async_logger.hpp"
+extern "C" {
+#include <sys/eventfd.h>
+#include <unistd.h>
+}
+#include <utility>
+#include "util.hpp"
+
+using ::std::lock_guard;
+using ::std::mutex;
+using ::std::unique_lock;
+
+bool AsyncLogger::Install(::google::LogSeverity severity) {
+  const int message_fd = eventfd(0, EFD_CLOEXEC);
+  if (message_fd < 0) {
+    PLOG(ERROR) << "Failed to create eventfd";
+    return false;
+  }
+  ::google::base::SetLogger(
+      severity,
+      new AsyncLogger(::google::base::GetLogger(severity), message_fd));
+  return true;
+}
+
+AsyncLogger::AsyncLogger(::google::base::Logger* logger, int message_fd)
+    : logger_(CHECK_NOTNULL(logger)),
+      message_fd_(message_fd),
+      num_pushed_(0),
+      num_written_(0),
+      stop_(false) {
+  // The worker is started last, once all members are initialized.
+  worker_ = ::std::thread(&AsyncLogger::Work, this);
+}
+
+AsyncLogger::~AsyncLogger() {
+  stop_ = true;
+  SignalEventFd(message_fd_);
+  worker_.join();
+  close(message_fd_);
+}
+
+void AsyncLogger::Write(
+    bool force_flush,
+    const ::std::chrono::system_clock::time_point& timestamp,
+    const char* message,
+    size_t message_len) {
+  messages_.Push({timestamp, ::std::string(message, message_len)});
+  ++num_pushed_;
+  SignalEventFd(message_fd_);
+  if (force_flush) {
+    WaitForWrites();
+  }
+}
+
+void AsyncLogger::Flush() {
+  WaitForWrites();
+}
+
+uint32_t AsyncLogger::LogSize() {
+  lock_guard<mutex> lock(mutex_);
+  return logger_->LogSize();
+}
+
+void AsyncLogger::Work() {
+  for (;;) {
+    // 1. Wait for messages.
+    DrainEventFd(message_fd_);
+    const bool stop = stop_;
+    // 2. Write all pending messages, and flush once the queue is empty. On
+    // exit, the queue is drained in full since no more messages are pushed.
+    {
+      lock_guard<mutex> lock(mutex_);
+      Message message;
+      while (messages_.Pop(&message)) {
+        logger_->Write(
+            false, message.timestamp, message.text.data(),
+            message.text.size());
+        ++num_written_;
+      }
+      logger_->Flush();
+    }
+    written_.notify_all();
+    if (stop) {
+      return;
+    }
+  }
+}
+
+void AsyncLogger::WaitForWrites() {
+  const uint64_t num_pushed = num_pushed_;
+  unique_lock<mutex> lock(mutex_);
+  written_.wait(lock, [this, num_pushed] {
+    return num_written_ >= num_pushed;
+  });
+}
@@ -0,0 +1,76 @@
+#ifndef ASYNC_LOGGER_HPP
+#define ASYNC_LOGGER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <glog/logging.h>
+#include "spsc_queue.hpp"
+
+// A glog logger that writes the log file of a severity on a background thread,
+// so that threads that log never wait for disk I/O.
+//
+// glog formats each message on the logging thread, then hands it to the
+// loggers of its severity and all lower severities while holding its log
+// mutex. Messages are therefore pushed by one thread at a time, which is all
+// SpscQueue requires. Messages glog wants flushed right away, i.e. warnings
+// and above by default, are waited for, so they reach the log file in order
+// before e.g. a FATAL error aborts the process.
+class AsyncLogger : public ::google::base::Logger {
+ public:
+  // Replaces the logger of a severity with an AsyncLogger wrapping it. glog
+  // takes ownership, and deletes the AsyncLogger on ShutdownGoogleLogging(),
+  // which writes out any queued messages. Returns false on failure, leaving
+  // the original logger in place.
+  static bool Install(::google::LogSeverity severity);
+
+  ~AsyncLogger() override;
+
+  // ::google::base::Logger implementation, called by glog.
+  void Write(
+      bool force_flush,
+      const ::std::chrono::system_clock::time_point& timestamp,
+      const char* message,
+      size_t message_len) override;
+  void Flush() override;
+  uint32_t LogSize() override;
+
+ private:
+  // A formatted message waiting to be written.
+  struct Message {
+    ::std::chrono::system_clock::time_point timestamp;
+    ::std::string text;
+  };
+
+  // Invoked internally by Install().
+  AsyncLogger(::google::base::Logger* logger, int message_fd);
+  // Entry point of the worker thread.
+  void Work();
+  // Blocks until all messages pushed so far are written.
+  void WaitForWrites();
+
+  // The wrapped logger, only used by the worker thread and under mutex_.
+  ::google::base::Logger* const logger_;
+  // eventfd signalled when messages are pushed.
+  const int message_fd_;
+  // Messages from the logging threads to the worker.
+  SpscQueue<Message> messages_;
+  // Number of messages pushed so far.
+  ::std::atomic<uint64_t> num_pushed_;
+  // Guards logger_ and num_written_.
+  ::std::mutex mutex_;
+  // Signalled when messages are written.
+  ::std::condition_variable written_;
+  // Number of messages written so far.
+  uint64_t num_written_;
+  // Set to make the worker exit.
+  ::std::atomic<bool> stop_;
+  // The worker thread.
+  ::std::thread worker_;
+};
+
+#endif
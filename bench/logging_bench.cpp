@@ -0,0 +1,107 @@
+// Measures what logging costs the thread that logs, on the window manager's
+// hot paths.
+//
+// Times the per-event log line of the main loop as a disabled VLOG, as a
+// LOG(INFO) written synchronously by glog's file logger, and as a LOG(INFO)
+// handed to AsyncLogger, and prints the mean cost per message.
+
+extern "C" {
+#include <dirent.h>
+#include <unistd.h>
+}
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <glog/logging.h>
+#include "async_logger.hpp"
+#include "util.hpp"
+
+using ::std::cerr;
+using ::std::chrono::duration;
+using ::std::chrono::steady_clock;
+using ::std::cout;
+using ::std::function;
+using ::std::string;
+
+namespace {
+
+// Number of messages logged per measurement.
+const int NUM_MESSAGES = 200000;
+
+// Returns the mean time in nanoseconds of calling log, over NUM_MESSAGES
+// calls.
+double TimeNs(const function<void(const XEvent&)>& log) {
+  XEvent e;
+  memset(&e, 0, sizeof(e));
+  e.type = ConfigureNotify;
+  e.xconfigure.window = 0x400001;
+  e.xconfigure.width = 640;
+  e.xconfigure.height = 480;
+  const steady_clock::time_point start = steady_clock::now();
+  for (int i = 0; i < NUM_MESSAGES; ++i) {
+    e.xconfigure.x = i;
+    log(e);
+  }
+  return duration<double, ::std::nano>(steady_clock::now() - start).count() /
+         NUM_MESSAGES;
+}
+
+// Deletes a directory of log files.
+void RemoveLogDir(const string& path) {
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr) {
+    return;
+  }
+  while (dirent* entry = readdir(dir)) {
+    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+      unlink((path + "/" + entry->d_name).c_str());
+    }
+  }
+  closedir(dir);
+  rmdir(path.c_str());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  // 1. Log to files in a temporary directory, as the window manager does.
+  char log_dir[] = "/tmp/basic_wm_logging_bench.XXXXXX";
+  if (mkdtemp(log_dir) == nullptr) {
+    cerr << "Failed to create log directory\n";
+    return EXIT_FAILURE;
+  }
+  FLAGS_log_dir = log_dir;
+  FLAGS_logtostderr = false;
+  FLAGS_v = 0;
+  ::google::InitGoogleLogging(argv[0]);
+
+  // 2. Per-event logging as in the main loop, at a disabled level.
+  const double vlog_ns = TimeNs([] (const XEvent& e) {
+    VLOG(2) << "Received event: " << ToString(e);
+  });
+  // 3. The same message always logged, written by glog's file logger.
+  const double sync_ns = TimeNs([] (const XEvent& e) {
+    LOG(INFO) << "Received event: " << ToString(e);
+  });
+  // 4. The same message handed to AsyncLogger.
+  if (!AsyncLogger::Install(::google::INFO)) {
+    cerr << "Failed to install AsyncLogger\n";
+    RemoveLogDir(log_dir);
+    return EXIT_FAILURE;
+  }
+  const double async_ns = TimeNs([] (const XEvent& e) {
+    LOG(INFO) << "Received event: " << ToString(e);
+  });
+  ::google::ShutdownGoogleLogging();
+  RemoveLogDir(log_dir);
+
+  cout << ::std::fixed << ::std::setprecision(1)
+       << "vlog_disabled " << vlog_ns << " ns/message\n"
+       << "log_sync " << sync_ns << " ns/message\n"
+       << "log_async " << async_ns << " ns/message\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+// Compares the cost of managing windows with and without reparenting.
+//
+// For each of BASIC_WM_REPARENT=1 and 0, maps and then destroys a batch of
+// windows with request accounting enabled, and prints the mean X requests and
+// round trips of framing and unframing a window, the number of windows on the
+// root window while the batch is managed, and the time taken to frame and
+// unframe the batch.
+
+extern "C" {
+#include <X11/Xutil.h>
+}
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <glog/logging.h>
+#include "tests/wm_test_env.hpp"
+
+using ::std::chrono::duration;
+using ::std::chrono::steady_clock;
+using ::std::cout;
+using ::std::string;
+using ::std::unique_ptr;
+using ::std::vector;
+
+namespace {
+
+// Number of client windows managed at once.
+const int NUM_WINDOWS = 200;
+
+// Returns the number of clients listed by the window manager.
+int CountClients(WmTestEnv* env) {
+  return env->CommandLines("list", "client").size();
+}
+
+// Returns the milliseconds elapsed since start.
+double ElapsedMs(steady_clock::time_point start) {
+  return duration<double, ::std::milli>(steady_clock::now() - start).count();
+}
+
+// Frames and unframes a batch of windows, and prints measurements.
+void Run(const string& reparent) {
+  unique_ptr<WmTestEnv> env = WmTestEnv::Create({
+      {"BASIC_WM_REQUEST_STATS", "1"},
+      {"BASIC_WM_REPARENT", reparent},
+  });
+  CHECK(env) << "Failed to start window manager";
+  Display* const display = env->display();
+  const int initial_root_children = env->CountRootChildren();
+
+  // 1. Frame windows.
+  vector<Window> windows;
+  for (int i = 0; i < NUM_WINDOWS; ++i) {
+    windows.push_back(
+        env->CreateWindow(Rect<int>(i % 40 * 20, i % 30 * 20, 200, 100)));
+  }
+  XSync(display, false);
+  const steady_clock::time_point frame_start = steady_clock::now();
+  for (const Window w : windows) {
+    XMapWindow(display, w);
+  }
+  XSync(display, false);
+  CHECK(WmTestEnv::WaitFor([&env] () {
+    return CountClients(env.get()) == NUM_WINDOWS;
+  })) << "Windows were not framed";
+  const double frame_ms = ElapsedMs(frame_start);
+  const int root_windows = env->CountRootChildren() - initial_root_children;
+
+  // 2. Unframe windows.
+  const steady_clock::time_point unframe_start = steady_clock::now();
+  for (const Window w : windows) {
+    XDestroyWindow(display, w);
+  }
+  XSync(display, false);
+  CHECK(WmTestEnv::WaitFor([&env] () {
+    return CountClients(env.get()) == 0;
+  })) << "Windows were not unframed";
+  const double unframe_ms = ElapsedMs(unframe_start);
+
+  // 3. Print the mean requests and round trips per operation. Lines are
+  // "<operation> <invocations> requests <total> <max> bytes <total> <max>
+  // round_trips <total> <max> over_budget <count>".
+  cout << ::std::fixed << ::std::setprecision(2);
+  for (const auto& words : env->CommandLines("stats", "")) {
+    CHECK_EQ(words.size(), 13u) << "Malformed stats line";
+    if (words[0] != "Frame" && words[0] != "Unframe") {
+      continue;
+    }
+    const double invocations = atof(words[1].c_str());
+    cout << "reparent " << reparent << " " << words[0]
+         << " requests_per_op " << atof(words[3].c_str()) / invocations
+         << " round_trips_per_op " << atof(words[9].c_str()) / invocations
+         << "\n";
+  }
+  cout << "reparent " << reparent << " root_windows " << root_windows
+       << " frame_ms " << frame_ms << " unframe_ms " << unframe_ms << "\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = true;
+  for (const string& reparent : {string("1"), string("0")}) {
+    Run(reparent);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,105 @@
+// Measures the cost of compiling and matching window rules as the number of
+// rules grows.
+//
+// For rule sets of increasing size, half exact patterns and half prefix
+// patterns across WM_CLASS and WM_WINDOW_ROLE, prints the time to compile the
+// set and the mean time to match a window, over windows that match an exact
+// rule, a prefix rule, or no rule.
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "window_rules.hpp"
+
+using ::std::cerr;
+using ::std::chrono::duration;
+using ::std::chrono::steady_clock;
+using ::std::cout;
+using ::std::istringstream;
+using ::std::ostringstream;
+using ::std::string;
+using ::std::to_string;
+using ::std::unique_ptr;
+using ::std::vector;
+
+namespace {
+
+// Numbers of rules to measure.
+const int NUM_RULES[] = {10, 100, 1000, 10000};
+// Number of matches per measurement.
+const int NUM_MATCHES = 300000;
+
+// A window to match, by its WM_CLASS and WM_WINDOW_ROLE.
+struct Target {
+  string class_name;
+  string instance_name;
+  string role;
+};
+
+// Returns a rule file with num_rules rules.
+string MakeRules(int num_rules) {
+  ostringstream rules;
+  for (int i = 0; i < num_rules; ++i) {
+    switch (i % 4) {
+      case 0:
+        rules << "class=App" << i << " -> output=0\n";
+        break;
+      case 1:
+        rules << "class=App" << i << " role=dialog" << i
+              << " -> position=10,10\n";
+        break;
+      case 2:
+        rules << "instance=tool" << i << "* -> manage=no\n";
+        break;
+      case 3:
+        rules << "role=popup" << i << "* -> size=300x200\n";
+        break;
+    }
+  }
+  return rules.str();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  cout << ::std::fixed << ::std::setprecision(1);
+  for (const int num_rules : NUM_RULES) {
+    // 1. Compile rules.
+    istringstream in(MakeRules(num_rules));
+    string error;
+    const steady_clock::time_point parse_start = steady_clock::now();
+    unique_ptr<WindowRules> rules = WindowRules::Parse(&in, &error);
+    const double parse_ms = duration<double, ::std::milli>(
+        steady_clock::now() - parse_start).count();
+    if (!rules) {
+      cerr << "Failed to compile rules: " << error << "\n";
+      return EXIT_FAILURE;
+    }
+    // 2. Match windows hitting exact rules, prefix rules and no rules.
+    vector<Target> windows;
+    for (int i = 0; i < 64; ++i) {
+      const int n = (i * 7919) % num_rules;
+      windows.push_back(
+          {"App" + to_string(n), "app", "dialog" + to_string(n)});
+      windows.push_back({"Tool", "tool" + to_string(n) + "-main", ""});
+      windows.push_back({"Menu", "menu", "popup" + to_string(n) + "-1"});
+      windows.push_back({"Other" + to_string(i), "other", "browser"});
+    }
+    int num_managed = 0;
+    const steady_clock::time_point match_start = steady_clock::now();
+    for (int i = 0; i < NUM_MATCHES; ++i) {
+      const Target& w = windows[i % windows.size()];
+      num_managed += rules->Match(w.class_name, w.instance_name, w.role).manage;
+    }
+    const double match_ns = duration<double, ::std::nano>(
+        steady_clock::now() - match_start).count() / NUM_MATCHES;
+    cout << "rules " << num_rules << " parse_ms " << parse_ms
+         << " match_ns " << match_ns << " managed " << num_managed << "\n";
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+#include "client_liveness.hpp"
+extern "C" {
+#include <X11/Xutil.h>
+}
+#include <cstring>
+#include <glog/logging.h>
+
+using ::std::chrono::milliseconds;
+using ::std::chrono::steady_clock;
+
+ClientLiveness::ClientLiveness(
+    Display* display,
+    TimerQueue* timers,
+    milliseconds close_timeout)
+    : display_(CHECK_NOTNULL(display)),
+      root_(DefaultRootWindow(display_)),
+      timers_(CHECK_NOTNULL(timers)),
+      close_timeout_(close_timeout),
+      WM_PROTOCOLS(XInternAtom(display_, "WM_PROTOCOLS", false)),
+      WM_DELETE_WINDOW(XInternAtom(display_, "WM_DELETE_WINDOW", false)),
+      _NET_WM_PING(XInternAtom(display_, "_NET_WM_PING", false)) {
+}
+
+void ClientLiveness::AddClient(Window w) {
+  CHECK(!clients_.count(w));
+  Client& client = clients_[w];
+  client.supports_delete_window = true;
+  client.supports_ping = false;
+  client.kill_timer = 0;
+  client.close_time = steady_clock::time_point::min();
+}
+
+void ClientLiveness::RemoveClient(Window w) {
+  auto i = clients_.find(w);
+  if (i == clients_.end()) {
+    return;
+  }
+  timers_->Cancel(i->second.kill_timer);
+  clients_.erase(i);
+}
+
+bool ClientLiveness::Close(Window w, Time time) {
+  auto i = clients_.find(w);
+  if (i == clients_.end()) {
+    LOG(WARNING) << "Not closing untracked window " << w;
+    return false;
+  }
+  Client& client = i->second;
+
+  // 1. Clients that don't support WM_DELETE_WINDOW can only be killed.
+  if (!client.supports_delete_window) {
+    LOG(INFO) << "Killing window " << w;
+    XKillClient(display_, w);
+    return true;
+  }
+
+  // 2. Closing a client again within the close timeout means the user has
+  // given up on it.
+  const steady_clock::time_point now = steady_clock::now();
+  if (now < client.close_time + close_timeout_) {
+    LOG(INFO) << "Window " << w << " closed again within "
+              << close_timeout_.count() << "ms, killing";
+    XKillClient(display_, w);
+    return true;
+  }
+  client.close_time = now;
+
+  // 3. Politely ask the client to close.
+  LOG(INFO) << "Gracefully deleting window " << w;
+  SendProtocolMessage(w, WM_DELETE_WINDOW, time);
+
+  // 4. Ping the client to find out whether it is still responsive, and
+  // schedule escalation unless one is already pending. Without
+  // _NET_WM_PING, a client that stays around may well be waiting for the
+  // user, so it is left alone unless closed again.
+  if (!client.supports_ping) {
+    return true;
+  }
+  SendProtocolMessage(w, _NET_WM_PING, time);
+  if (!client.kill_timer) {
+    client.kill_timer = timers_->Add(
+        close_timeout_, [this, w] () { OnCloseTimeout(w); });
+  }
+  return true;
+}
+
+void ClientLiveness::CancelClose(Window w) {
+  auto i = clients_.find(w);
+  if (i == clients_.end()) {
+    return;
+  }
+  i->second.close_time = steady_clock::time_point::min();
+  if (!i->second.kill_timer) {
+    return;
+  }
+  VLOG(1) << "Window " << w << " withdrawn, not killing";
+  timers_->Cancel(i->second.kill_timer);
+  i->second.kill_timer = 0;
+}
+
+void ClientLiveness::SetProtocols(
+    Window w, bool supports_delete_window, bool supports_ping) {
+  auto i = clients_.find(w);
+  if (i == clients_.end()) {
+    return;
+  }
+  i->second.supports_delete_window = supports_delete_window;
+  i->second.supports_ping = supports_ping;
+}
+
+void ClientLiveness::OnClientMessage(const XClientMessageEvent& e) {
+  // A _NET_WM_PING reply is the original message sent back to the root
+  // window, with the client window in data.l[2].
+  if (e.window != root_ ||
+      e.message_type != WM_PROTOCOLS ||
+      e.format != 32 ||
+      static_cast<Atom>(e.data.l[0]) != _NET_WM_PING) {
+    return;
+  }
+  const Window w = e.data.l[2];
+  auto i = clients_.find(w);
+  if (i == clients_.end() || !i->second.kill_timer) {
+    return;
+  }
+  // The client is alive, and may e.g. be asking the user to save their work,
+  // so leave it alone.
+  LOG(INFO) << "Window " << w << " answered ping, not killing";
+  timers_->Cancel(i->second.kill_timer);
+  i->second.kill_timer = 0;
+}
+
+void ClientLiveness::SendProtocolMessage(Window w, Atom protocol, Time time) {
+  // 1. Construct message.
+  XEvent msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.xclient.type = ClientMessage;
+  msg.xclient.message_type = WM_PROTOCOLS;
+  msg.xclient.window = w;
+  msg.xclient.format = 32;
+  msg.xclient.data.l[0] = protocol;
+  msg.xclient.data.l[1] = time;
+  msg.xclient.data.l[2] = w;
+  // 2. Send message to client window.
+  CHECK(XSendEvent(display_, w, false, NoEventMask, &msg));
+}
+
+void ClientLiveness::OnCloseTimeout(Window w) {
+  auto i = clients_.find(w);
+  if (i == clients_.end()) {
+    return;
+  }
+  i->second.kill_timer = 0;
+  LOG(INFO) << "Window " << w << " neither closed nor answered ping within "
+            << close_timeout_.count() << "ms, killing";
+  XKillClient(display_, w);
+}
@@ -0,0 +1,90 @@
+#ifndef CLIENT_LIVENESS_HPP
+#define CLIENT_LIVENESS_HPP
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+#include <chrono>
+#include <unordered_map>
+#include "timer_queue.hpp"
+
+// Closes client windows, escalating from WM_DELETE_WINDOW to XKillClient() for
+// clients that are hung.
+//
+// Each client's WM_PROTOCOLS is fetched by PropertyFetcher and handed over
+// with SetProtocols(), so neither tracking nor closing a window needs round
+// trips. Until then, a client is assumed to support WM_DELETE_WINDOW only, so
+// that it is never killed without being asked to close first. When a
+// client supports _NET_WM_PING, closing it also pings it; if the client
+// neither goes away nor answers the ping before the close timeout, it is
+// considered hung and killed. Clients that support WM_DELETE_WINDOW but not
+// _NET_WM_PING aren't killed on their own, as there is no telling a hung
+// client from one asking the user about unsaved changes; instead, closing any
+// client again within the close timeout kills it, so that pressing alt + f4
+// twice gets rid of it. All waiting is done with timers on the main loop.
+class ClientLiveness {
+ public:
+  ClientLiveness(
+      Display* display,
+      TimerQueue* timers,
+      ::std::chrono::milliseconds close_timeout);
+
+  // Starts tracking a client window.
+  void AddClient(Window w);
+  // Stops tracking a client window, cancelling any pending escalation.
+  void RemoveClient(Window w);
+  // Asks a client window to close, or kills its client if already asked within
+  // the close timeout. time is the timestamp of the triggering event, or
+  // CurrentTime. Returns false if the window isn't tracked.
+  bool Close(Window w, Time time);
+  // Cancels any pending escalation for a client window, e.g. because it
+  // withdrew its window in answer to WM_DELETE_WINDOW rather than exiting.
+  void CancelClose(Window w);
+
+  // Updates the protocols a tracked client window supports, from its
+  // WM_PROTOCOLS.
+  void SetProtocols(
+      Window w, bool supports_delete_window, bool supports_ping);
+
+  // Event handlers. Events unrelated to liveness are ignored.
+  void OnClientMessage(const XClientMessageEvent& e);
+
+  // Returns the number of tracked client windows.
+  size_t size() const { return clients_.size(); }
+
+ private:
+  // Liveness state of a tracked client window.
+  struct Client {
+    // Cached WM_PROTOCOLS.
+    bool supports_delete_window;
+    bool supports_ping;
+    // Pending escalation to XKillClient(), or 0 if none.
+    TimerQueue::TimerId kill_timer;
+    // When the client was last asked to close, or time_point::min() if not
+    // since it was added or its close was cancelled.
+    ::std::chrono::steady_clock::time_point close_time;
+  };
+
+  // Sends a WM_PROTOCOLS client message to a client window.
+  void SendProtocolMessage(Window w, Atom protocol, Time time);
+  // Invoked when the close timeout for a client window expires.
+  void OnCloseTimeout(Window w);
+
+  // Handle to the underlying Xlib Display struct.
+  Display* const display_;
+  // Root window, to which clients send _NET_WM_PING replies.
+  const Window root_;
+  // Timers for escalation.
+  TimerQueue* const timers_;
+  // Time to wait for a client to close or answer a ping before killing it.
+  const ::std::chrono::milliseconds close_timeout_;
+  // Tracked client windows.
+  ::std::unordered_map<Window, Client> clients_;
+
+  // Atom constants.
+  const Atom WM_PROTOCOLS;
+  const Atom WM_DELETE_WINDOW;
+  const Atom _NET_WM_PING;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include "config.hpp"
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <glog/logging.h>
+
+using ::std::chrono::milliseconds;
+using ::std::string;
+
+namespace {
+
+// Largest width or height in pixels, as X coordinates are 16-bit signed.
+const long MAX_SIZE = 0x7fff;
+// Largest time in milliseconds, which fits the int timeouts of poll().
+const long MAX_TIME_MS = INT_MAX;
+
+// Returns the value of an environment variable, or a default value if unset.
+string GetEnv(const char* name, const string& default_value) {
+  const char* value = getenv(name);
+  return value == nullptr ? default_value : string(value);
+}
+
+// Returns the value of an environment variable parsed as an integer within
+// [min_value, max_value], or a default value if unset, invalid or out of
+// range.
+long GetEnvInt(
+    const char* name, long default_value, long min_value, long max_value) {
+  const char* value = getenv(name);
+  if (value == nullptr) {
+    return default_value;
+  }
+  char* end;
+  errno = 0;
+  const long result = strtol(value, &end, 10);
+  if (*value == '\0' || *end != '\0') {
+    LOG(ERROR) << "Ignoring invalid value for " << name << ": " << value;
+    return default_value;
+  }
+  if (errno == ERANGE || result < min_value || result > max_value) {
+    LOG(ERROR) << "Ignoring out of range value for " << name << ": " << value
+               << ", expected " << min_value << " to " << max_value;
+    return default_value;
+  }
+  return result;
+}
+
+// Returns the value of an environment variable parsed as 0 or 1, or a default
+// value if unset or invalid.
+bool GetEnvBool(const char* name, bool default_value) {
+  return GetEnvInt(name, default_value, 0, 1) != 0;
+}
+
+// Returns the value of an environment variable parsed as a DragMode, or a
+// default value if unset or invalid.
+DragMode GetEnvDragMode(const char* name, DragMode default_value) {
+  const string value = GetEnv(name, "");
+  if (value.empty()) {
+    return default_value;
+  } else if (value == "live") {
+    return DragMode::LIVE;
+  } else if (value == "outline") {
+    return DragMode::OUTLINE;
+  }
+  LOG(ERROR) << "Ignoring invalid value for " << name << ": " << value;
+  return default_value;
+}
+
+}  // namespace
+
+Config Config::FromEnvironment() {
+  Config config;
+  config.control_socket_path = GetEnv("BASIC_WM_CONTROL_SOCKET", "");
+  config.close_timeout = milliseconds(
+      GetEnvInt("BASIC_WM_CLOSE_TIMEOUT_MS", 5000, 0, MAX_TIME_MS));
+  config.icon_size = GetEnvInt("BASIC_WM_ICON_SIZE", 48, 1, MAX_SIZE);
+  config.icon_cache_kb =
+      GetEnvInt("BASIC_WM_ICON_CACHE_KB", 4096, 0, LONG_MAX / 1024);
+  config.thumbnail_size =
+      GetEnvInt("BASIC_WM_THUMBNAIL_SIZE", 0, 0, MAX_SIZE);
+  config.thumbnail_interval = milliseconds(
+      GetEnvInt("BASIC_WM_THUMBNAIL_INTERVAL_MS", 100, 0, MAX_TIME_MS));
+  config.request_stats = GetEnvBool("BASIC_WM_REQUEST_STATS", false);
+  config.move_mode = GetEnvDragMode("BASIC_WM_MOVE_MODE", DragMode::LIVE);
+  config.resize_mode = GetEnvDragMode("BASIC_WM_RESIZE_MODE", DragMode::LIVE);
+  config.drag_interval = milliseconds(
+      GetEnvInt("BASIC_WM_DRAG_INTERVAL_MS", 16, 0, MAX_TIME_MS));
+  config.client_event_rate =
+      GetEnvInt("BASIC_WM_CLIENT_EVENT_RATE", 1000, 0, INT_MAX);
+  config.rules_path = GetEnv("BASIC_WM_RULES", "");
+  config.withdrawn_timeout = milliseconds(
+      GetEnvInt("BASIC_WM_WITHDRAWN_TIMEOUT_MS", 10000, 0, MAX_TIME_MS));
+  config.focus_follows_mouse =
+      GetEnvBool("BASIC_WM_FOCUS_FOLLOWS_MOUSE", false);
+  config.focus_delay = milliseconds(
+      GetEnvInt("BASIC_WM_FOCUS_DELAY_MS", 100, 0, MAX_TIME_MS));
+  config.reparent = GetEnvBool("BASIC_WM_REPARENT", true);
+  config.frame_delay = milliseconds(
+      GetEnvInt("BASIC_WM_FRAME_DELAY_MS", 0, 0, MAX_TIME_MS));
+  return config;
+}
@@ -0,0 +1,81 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+// How a window being moved or resized with alt + drag is shown.
+enum class DragMode {
+  // The frame and client are reconfigured on every motion step.
+  LIVE,
+  // An outline is drawn while dragging, and the frame and client are
+  // reconfigured once on release.
+  OUTLINE,
+};
+
+// Runtime configuration of the window manager. Like glog's GLOG_* settings,
+// each field is read from a BASIC_WM_* environment variable so that it can be
+// set from an xinitrc.
+struct Config {
+  // Path of the Unix domain socket on which to accept control connections
+  // (BASIC_WM_CONTROL_SOCKET). The control interface is disabled if empty.
+  ::std::string control_socket_path;
+  // How long to wait for a client supporting _NET_WM_PING to close or answer a
+  // ping after alt + f4 before killing it, and within which a second alt + f4
+  // kills any client (BASIC_WM_CLOSE_TIMEOUT_MS).
+  ::std::chrono::milliseconds close_timeout;
+  // Width and height in pixels of cached client icons (BASIC_WM_ICON_SIZE).
+  int icon_size;
+  // Maximum memory used by cached client icons, in KiB
+  // (BASIC_WM_ICON_CACHE_KB).
+  size_t icon_cache_kb;
+  // Width and height in pixels of live frame thumbnails for overviews, or 0 to
+  // disable thumbnails (BASIC_WM_THUMBNAIL_SIZE).
+  int thumbnail_size;
+  // Minimum time between thumbnail updates
+  // (BASIC_WM_THUMBNAIL_INTERVAL_MS).
+  ::std::chrono::milliseconds thumbnail_interval;
+  // Whether to account for the X requests and round trips issued by each
+  // operation, and check them against the operation's budget
+  // (BASIC_WM_REQUEST_STATS).
+  bool request_stats;
+  // How windows are shown while being moved (BASIC_WM_MOVE_MODE) and resized
+  // (BASIC_WM_RESIZE_MODE), either "live" or "outline".
+  DragMode move_mode;
+  DragMode resize_mode;
+  // Minimum time between updates of a window being moved or resized, which
+  // are applied for the latest pointer position only
+  // (BASIC_WM_DRAG_INTERVAL_MS).
+  ::std::chrono::milliseconds drag_interval;
+  // Maximum number of requests per second to handle for each X client, or 0
+  // for no limit (BASIC_WM_CLIENT_EVENT_RATE). Requests beyond the limit are
+  // handled later, so that a flooding client can't delay other clients.
+  int client_event_rate;
+  // Path of a file of window rules to apply when windows are mapped, or empty
+  // for none (BASIC_WM_RULES). See WindowRules for the format.
+  ::std::string rules_path;
+  // How long the frame of a window unmapped by its client is kept for in case
+  // the window is mapped again, before the window is unframed
+  // (BASIC_WM_WITHDRAWN_TIMEOUT_MS).
+  ::std::chrono::milliseconds withdrawn_timeout;
+  // Whether to focus the window under the pointer
+  // (BASIC_WM_FOCUS_FOLLOWS_MOUSE), once the pointer has rested on it for
+  // focus_delay (BASIC_WM_FOCUS_DELAY_MS).
+  bool focus_follows_mouse;
+  ::std::chrono::milliseconds focus_delay;
+  // Whether to reparent clients into frames with title bars
+  // (BASIC_WM_REPARENT). Otherwise, clients are managed directly, and keep
+  // their own borders.
+  bool reparent;
+  // How long newly mapped windows are shown without a frame, so that
+  // short-lived windows are never framed, or 0 to frame windows before
+  // mapping them (BASIC_WM_FRAME_DELAY_MS).
+  ::std::chrono::milliseconds frame_delay;
+
+  // Returns a Config populated from the environment, with defaults for unset
+  // variables.
+  static Config FromEnvironment();
+};
+
+#endif
@@ -0,0 +1,408 @@
+#include "control_server.hpp"
+extern "C" {
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <glog/logging.h>
+
+using ::std::istringstream;
+using ::std::ostringstream;
+using ::std::string;
+using ::std::unique_ptr;
+using ::std::vector;
+
+namespace {
+
+// Maximum length of a single batch. Connections sending longer lines are
+// dropped.
+const size_t MAX_LINE_LENGTH = 1 << 20;
+// Maximum amount of unsent output buffered for a connection. Connections that
+// don't read their replies or events are dropped.
+const size_t MAX_OUTPUT_LENGTH = 4 << 20;
+
+// Makes a file descriptor non-blocking and close-on-exec.
+bool SetNonBlocking(int fd) {
+  const int flags = fcntl(fd, F_GETFL);
+  return flags >= 0 &&
+         fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0 &&
+         fcntl(fd, F_SETFD, FD_CLOEXEC) == 0;
+}
+
+// Parses an event name into a ControlEventType. Returns 0 if unknown.
+int ParseEventType(const string& name) {
+  if (name == "frame") {
+    return CONTROL_EVENT_FRAME;
+  } else if (name == "unframe") {
+    return CONTROL_EVENT_UNFRAME;
+  } else if (name == "focus") {
+    return CONTROL_EVENT_FOCUS;
+  }
+  return 0;
+}
+
+// Returns the name of a ControlEventType.
+const char* EventTypeToString(ControlEventType type) {
+  switch (type) {
+    case CONTROL_EVENT_FRAME:
+      return "frame";
+    case CONTROL_EVENT_UNFRAME:
+      return "unframe";
+    case CONTROL_EVENT_FOCUS:
+      return "focus";
+  }
+  return "unknown";
+}
+
+// Parses a window ID in decimal or 0x-prefixed hexadecimal.
+bool ParseWindow(const string& s, Window* w) {
+  char* end;
+  errno = 0;
+  const unsigned long value = strtoul(s.c_str(), &end, 0);
+  if (s.empty() || *end != '\0' || errno != 0) {
+    return false;
+  }
+  *w = value;
+  return true;
+}
+
+// Parses a signed integer argument.
+bool ParseInt(const string& s, int* value) {
+  char* end;
+  errno = 0;
+  const long result = strtol(s.c_str(), &end, 10);
+  if (s.empty() || *end != '\0' || errno != 0) {
+    return false;
+  }
+  *value = static_cast<int>(result);
+  return true;
+}
+
+// Parses a single command into either a ControlCommand or a change in event
+// subscriptions. Returns an empty string on success, or an error message.
+string ParseCommand(
+    const vector<string>& tokens,
+    vector<ControlCommand>* commands,
+    int* subscribe,
+    int* unsubscribe) {
+  const string& verb = tokens[0];
+
+  // 1. Subscriptions.
+  if (verb == "subscribe" || verb == "unsubscribe") {
+    if (tokens.size() < 2) {
+      return verb + ": expected event names";
+    }
+    for (size_t i = 1; i < tokens.size(); ++i) {
+      const int type = ParseEventType(tokens[i]);
+      if (!type) {
+        return verb + ": unknown event " + tokens[i];
+      }
+      *(verb == "subscribe" ? subscribe : unsubscribe) |= type;
+    }
+    return "";
+  }
+
+  // 2. Commands.
+  ControlCommand command;
+  command.window = None;
+  command.args[0] = command.args[1] = 0;
+  size_t num_args;
+  if (verb == "move") {
+    command.type = ControlCommand::Type::MOVE;
+    num_args = 3;
+  } else if (verb == "resize") {
+    command.type = ControlCommand::Type::RESIZE;
+    num_args = 3;
+  } else if (verb == "raise") {
+    command.type = ControlCommand::Type::RAISE;
+    num_args = 1;
+  } else if (verb == "focus") {
+    command.type = ControlCommand::Type::FOCUS;
+    num_args = 1;
+  } else if (verb == "close") {
+    command.type = ControlCommand::Type::CLOSE;
+    num_args = 1;
+  } else if (verb == "thumbnail") {
+    command.type = ControlCommand::Type::THUMBNAIL;
+    num_args = 1;
+  } else if (verb == "list") {
+    command.type = ControlCommand::Type::LIST;
+    num_args = 0;
+  } else if (verb == "stats") {
+    command.type = ControlCommand::Type::STATS;
+    num_args = 0;
+  } else if (verb == "events") {
+    command.type = ControlCommand::Type::EVENTS;
+    num_args = 0;
+  } else if (verb == "framing") {
+    command.type = ControlCommand::Type::FRAMING;
+    num_args = 0;
+  } else if (verb == "drags") {
+    command.type = ControlCommand::Type::DRAGS;
+    num_args = 0;
+  } else if (verb == "tables") {
+    command.type = ControlCommand::Type::TABLES;
+    num_args = 0;
+  } else if (verb == "reload") {
+    command.type = ControlCommand::Type::RELOAD;
+    num_args = 0;
+  } else if (verb == "verbosity") {
+    command.type = ControlCommand::Type::VERBOSITY;
+    num_args = 2;
+  } else {
+    return "unknown command " + verb;
+  }
+  if (tokens.size() != num_args + 1) {
+    ostringstream out;
+    out << verb << ": expected " << num_args << " arguments";
+    return out.str();
+  }
+  if (command.type == ControlCommand::Type::VERBOSITY) {
+    command.module = tokens[1];
+  } else if (num_args >= 1 && !ParseWindow(tokens[1], &command.window)) {
+    return verb + ": invalid window " + tokens[1];
+  }
+  for (size_t i = 2; i < tokens.size(); ++i) {
+    if (!ParseInt(tokens[i], &command.args[i - 2])) {
+      return verb + ": invalid argument " + tokens[i];
+    }
+  }
+  if (command.type == ControlCommand::Type::RESIZE &&
+      (command.args[0] <= 0 || command.args[1] <= 0)) {
+    return verb + ": size must be positive";
+  }
+  if (command.type == ControlCommand::Type::VERBOSITY && command.args[0] < 0) {
+    return verb + ": level must not be negative";
+  }
+  commands->push_back(command);
+  return "";
+}
+
+}  // namespace
+
+unique_ptr<ControlServer> ControlServer::Create(const string& socket_path) {
+  // 1. Create socket.
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(addr.sun_path)) {
+    LOG(ERROR) << "Control socket path too long: " << socket_path;
+    return nullptr;
+  }
+  strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    PLOG(ERROR) << "Failed to create control socket";
+    return nullptr;
+  }
+  // 2. Bind and listen, replacing any socket left behind by a previous
+  // instance.
+  unlink(socket_path.c_str());
+  if (!SetNonBlocking(fd) ||
+      bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    PLOG(ERROR) << "Failed to listen on control socket " << socket_path;
+    close(fd);
+    return nullptr;
+  }
+  LOG(INFO) << "Listening for control connections on " << socket_path;
+  return unique_ptr<ControlServer>(new ControlServer(fd, socket_path));
+}
+
+ControlServer::ControlServer(int listen_fd, const string& socket_path)
+    : listen_fd_(listen_fd),
+      socket_path_(socket_path) {
+}
+
+ControlServer::~ControlServer() {
+  for (const Connection& connection : connections_) {
+    close(connection.fd);
+  }
+  close(listen_fd_);
+  unlink(socket_path_.c_str());
+}
+
+void ControlServer::AddPollFds(vector<pollfd>* fds) const {
+  fds->push_back({listen_fd_, POLLIN, 0});
+  for (const Connection& connection : connections_) {
+    fds->push_back({
+        connection.fd,
+        static_cast<short>(POLLIN | (connection.out.empty() ? 0 : POLLOUT)),
+        0});
+  }
+}
+
+void ControlServer::HandlePollFds(
+    const pollfd* fds, size_t num_fds, const BatchHandler& handler) {
+  // 1. Service existing connections. Connections accepted below aren't in fds
+  // yet, so they are serviced on the next iteration of the main loop.
+  for (size_t i = 0; i < num_fds; ++i) {
+    if (fds[i].fd == listen_fd_ || !fds[i].revents) {
+      continue;
+    }
+    for (Connection& connection : connections_) {
+      if (connection.fd != fds[i].fd) {
+        continue;
+      }
+      bool keep = !(fds[i].revents & (POLLERR | POLLNVAL));
+      if (keep && (fds[i].revents & (POLLIN | POLLHUP))) {
+        keep = Read(&connection, handler);
+      }
+      if (keep && !connection.out.empty()) {
+        keep = Write(&connection);
+      }
+      if (!keep) {
+        close(connection.fd);
+        connection.fd = -1;
+      }
+      break;
+    }
+  }
+  // 2. Drop closed connections.
+  auto end = connections_.begin();
+  for (auto i = connections_.begin(); i != connections_.end(); ++i) {
+    if (i->fd >= 0) {
+      *end++ = ::std::move(*i);
+    }
+  }
+  connections_.erase(end, connections_.end());
+  // 3. Accept new connections.
+  for (size_t i = 0; i < num_fds; ++i) {
+    if (fds[i].fd == listen_fd_ && (fds[i].revents & POLLIN)) {
+      Accept();
+    }
+  }
+}
+
+void ControlServer::Publish(ControlEventType type, const string& args) {
+  const string line =
+      string("event ") + EventTypeToString(type) + " " + args + "\n";
+  for (Connection& connection : connections_) {
+    if (connection.subscriptions & type) {
+      connection.out += line;
+    }
+  }
+}
+
+void ControlServer::Accept() {
+  for (;;) {
+    const int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        PLOG(WARNING) << "Failed to accept control connection";
+      }
+      return;
+    }
+    if (!SetNonBlocking(fd)) {
+      close(fd);
+      continue;
+    }
+    LOG(INFO) << "Accepted control connection " << fd;
+    connections_.push_back({fd, "", "", 0});
+  }
+}
+
+bool ControlServer::Read(Connection* connection, const BatchHandler& handler) {
+  char buffer[4096];
+  for (;;) {
+    // 1. Read available input.
+    const ssize_t n = read(connection->fd, buffer, sizeof(buffer));
+    if (n == 0) {
+      LOG(INFO) << "Control connection " << connection->fd << " closed";
+      return false;
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return true;
+      }
+      PLOG(WARNING) << "Failed to read from control connection";
+      return false;
+    }
+    connection->in.append(buffer, n);
+    // 2. Execute complete lines as they arrive, so that only the incomplete
+    // last line is buffered, and drop the connection as soon as that is too
+    // long. Only the new input can complete a line.
+    size_t start = 0;
+    for (size_t end = connection->in.find('\n', connection->in.size() - n);
+         end != string::npos;
+         end = connection->in.find('\n', start)) {
+      HandleBatch(
+          connection, connection->in.substr(start, end - start), handler);
+      start = end + 1;
+    }
+    connection->in.erase(0, start);
+    if (connection->in.size() > MAX_LINE_LENGTH) {
+      LOG(WARNING) << "Dropping control connection " << connection->fd
+                   << ": line too long";
+      return false;
+    }
+  }
+}
+
+bool ControlServer::Write(Connection* connection) {
+  while (!connection->out.empty()) {
+    const ssize_t n = write(
+        connection->fd, connection->out.data(), connection->out.size());
+    if (n > 0) {
+      connection->out.erase(0, n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    PLOG(WARNING) << "Failed to write to control connection";
+    return false;
+  }
+  if (connection->out.size() > MAX_OUTPUT_LENGTH) {
+    LOG(WARNING) << "Dropping control connection " << connection->fd
+                 << ": peer not reading";
+    return false;
+  }
+  return true;
+}
+
+void ControlServer::HandleBatch(
+    Connection* connection,
+    const string& line,
+    const BatchHandler& handler) {
+  // 1. Parse all commands in the batch.
+  vector<ControlCommand> commands;
+  int subscribe = 0, unsubscribe = 0;
+  string error;
+  istringstream batch(line);
+  for (string command_str; error.empty() && getline(batch, command_str, ';');) {
+    istringstream command_in(command_str);
+    vector<string> tokens;
+    for (string token; command_in >> token;) {
+      tokens.push_back(token);
+    }
+    if (!tokens.empty()) {
+      error = ParseCommand(tokens, &commands, &subscribe, &unsubscribe);
+    }
+  }
+  if (!error.empty()) {
+    connection->out += "error " + error + "\n";
+    return;
+  }
+
+  // 2. Apply subscription changes and execute commands.
+  connection->subscriptions = (connection->subscriptions | subscribe) &
+                              ~unsubscribe;
+  ostringstream reply;
+  if (!commands.empty()) {
+    error = handler(commands, &reply);
+  }
+  connection->out += reply.str();
+  connection->out += error.empty() ? "ok\n" : "error " + error + "\n";
+}
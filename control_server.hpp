@@ -0,0 +1,144 @@
+#ifndef CONTROL_SERVER_HPP
+#define CONTROL_SERVER_HPP
+
+extern "C" {
+#include <X11/Xlib.h>
+#include <poll.h>
+}
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// A single command received over the control socket.
+struct ControlCommand {
+  enum class Type {
+    // move <window> <x> <y>: Moves a client's frame.
+    MOVE,
+    // resize <window> <width> <height>: Resizes a client and its frame.
+    RESIZE,
+    // raise <window>: Raises a client's frame to the top.
+    RAISE,
+    // focus <window>: Sets input focus to a client.
+    FOCUS,
+    // close <window>: Asks a client to close, as with alt + f4.
+    CLOSE,
+    // thumbnail <window>: Prints the live thumbnail of a client's frame.
+    THUMBNAIL,
+    // list: Lists managed clients and their frame geometry.
+    LIST,
+    // stats: Prints X request statistics per operation.
+    STATS,
+    // events: Prints event handling counters per X client.
+    EVENTS,
+    // reload: Reloads window rules.
+    RELOAD,
+    // framing: Prints deferred framing counters and learned WM_CLASS
+    // lifetimes.
+    FRAMING,
+    // drags: Prints latency measurements of recent window moves and resizes.
+    DRAGS,
+    // tables: Prints the number of entries in each per-window table, to check
+    // that none leak.
+    TABLES,
+    // verbosity <module> <level>: Sets the verbose logging level of source
+    // files matching a glob pattern, e.g. "window_manager" or "*".
+    VERBOSITY,
+  };
+
+  Type type;
+  // Target client window. Unused for LIST, STATS, EVENTS, RELOAD, FRAMING,
+  // DRAGS, TABLES and VERBOSITY.
+  Window window;
+  // Numeric arguments, i.e. position for MOVE, size for RESIZE and level for
+  // VERBOSITY.
+  int args[2];
+  // Module pattern for VERBOSITY.
+  ::std::string module;
+};
+
+// Types of events that a control connection can subscribe to.
+enum ControlEventType {
+  // A client window was framed.
+  CONTROL_EVENT_FRAME = 1 << 0,
+  // A client window was unframed.
+  CONTROL_EVENT_UNFRAME = 1 << 1,
+  // The window manager moved input focus to a client.
+  CONTROL_EVENT_FOCUS = 1 << 2,
+};
+
+// Serves the window manager's control interface over a Unix domain socket.
+//
+// The protocol is line based. Each line sent by a peer is a batch of commands
+// separated by ';', e.g. "move 0x400001 0 0; raise 0x400001". A batch is
+// parsed in full before it is executed, so a malformed batch has no effect.
+// Each batch is answered with any output lines followed by a status line,
+// which is either "ok" or "error <message>". In addition to commands, a batch
+// may contain "subscribe <event>..." and "unsubscribe <event>...", where
+// events are "frame", "unframe" and "focus". Subscribed events are written to
+// the peer as "event <name> <args>..." lines between replies.
+//
+// The server never blocks: all sockets are non-blocking and are serviced from
+// the window manager's main loop via poll().
+class ControlServer {
+ public:
+  // Executes a parsed batch of commands, writing output lines to reply.
+  // Returns an empty string on success, or an error message.
+  typedef ::std::function<::std::string(
+      const ::std::vector<ControlCommand>& batch,
+      ::std::ostream* reply)> BatchHandler;
+
+  // Creates a ControlServer listening on the Unix domain socket at
+  // socket_path, replacing any stale socket file. On failure, returns nullptr.
+  static ::std::unique_ptr<ControlServer> Create(
+      const ::std::string& socket_path);
+
+  ~ControlServer();
+
+  // Appends the file descriptors to wait on to fds.
+  void AddPollFds(::std::vector<pollfd>* fds) const;
+  // Services file descriptors previously added with AddPollFds() that poll()
+  // reported as ready. Complete batches are passed to handler.
+  void HandlePollFds(
+      const pollfd* fds, size_t num_fds, const BatchHandler& handler);
+  // Sends an event line to every connection subscribed to the event type.
+  void Publish(ControlEventType type, const ::std::string& args);
+
+ private:
+  // State of an accepted control connection.
+  struct Connection {
+    int fd;
+    // Bytes received but not yet parsed, i.e. an incomplete line.
+    ::std::string in;
+    // Bytes waiting to be written.
+    ::std::string out;
+    // Bitwise OR of subscribed ControlEventTypes.
+    int subscriptions;
+  };
+
+  // Invoked internally by Create().
+  ControlServer(int listen_fd, const ::std::string& socket_path);
+  // Accepts all pending connections.
+  void Accept();
+  // Reads available input from a connection and executes any complete
+  // batches. Returns false if the connection should be closed.
+  bool Read(Connection* connection, const BatchHandler& handler);
+  // Writes as much pending output as possible to a connection. Returns false
+  // if the connection should be closed.
+  bool Write(Connection* connection);
+  // Parses and executes a single batch from a connection.
+  void HandleBatch(
+      Connection* connection,
+      const ::std::string& line,
+      const BatchHandler& handler);
+
+  // Listening socket.
+  const int listen_fd_;
+  // Path of the listening socket, removed on destruction.
+  const ::std::string socket_path_;
+  // Accepted connections.
+  ::std::vector<Connection> connections_;
+};
+
+#endif
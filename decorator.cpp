@@ -0,0 +1,343 @@
+#include "decorator.hpp"
+extern "C" {
+#include <X11/Xutil.h>
+}
+#include <algorithm>
+#include <glog/logging.h>
+#include "icon_cache.hpp"
+
+using ::std::max;
+using ::std::min;
+using ::std::string;
+using ::std::unique_ptr;
+using ::std::vector;
+
+namespace {
+
+// Visual properties of title bars, indexed by focus state.
+const uint32_t BG_COLORS[2] = {0x555753, 0x3465a4};
+const uint32_t TEXT_COLORS[2] = {0xd3d7cf, 0xffffff};
+// Font for titles, as an Xft font pattern.
+const char* const TITLE_FONT = "sans-serif:size=9";
+// Size of and margin around title bar icons.
+const int ICON_SIZE = Decorator::TITLE_HEIGHT - 4;
+const int ICON_MARGIN = 2;
+// Margin before titles.
+const int TEXT_MARGIN = 6;
+// Number of title bars that can be uploaded through MIT-SHM before waiting
+// for the X server to finish reading the oldest.
+const int NUM_SHM_SLOTS = 4;
+
+// Returns whether 0x00RRGGBB pixel values can be uploaded as they are, which
+// is the case for the 24-bit TrueColor visuals used by practically all X
+// servers.
+bool IsDirectColorVisual(const Visual* visual, int depth) {
+  return (depth == 24 || depth == 32) &&
+         visual->c_class == TrueColor &&
+         visual->red_mask == 0xff0000 &&
+         visual->green_mask == 0x00ff00 &&
+         visual->blue_mask == 0x0000ff;
+}
+
+// Returns a GC for uploading and copying pixmaps. Copies never need to expose
+// anything, so GraphicsExpose and NoExpose events are turned off rather than
+// sent to the main loop for every copy.
+GC CreateCopyGC(Display* display) {
+  XGCValues gc_values;
+  gc_values.graphics_exposures = false;
+  return XCreateGC(
+      display, DefaultRootWindow(display), GCGraphicsExposures, &gc_values);
+}
+
+// Returns the byte order of pixels written as uint32_t on this host.
+int HostByteOrder() {
+  const uint32_t one = 1;
+  return *reinterpret_cast<const unsigned char*>(&one) ? LSBFirst : MSBFirst;
+}
+
+}  // namespace
+
+unique_ptr<Decorator> Decorator::Create(Display* display) {
+  // 1. Load title font.
+  XftFont* font = XftFontOpenName(display, DefaultScreen(display), TITLE_FONT);
+  if (font == nullptr) {
+    LOG(ERROR) << "Failed to load font " << TITLE_FONT;
+    return nullptr;
+  }
+  // 2. Set up MIT-SHM images large enough for title bars as wide as the
+  // screen, if available.
+  const int screen = DefaultScreen(display);
+  Visual* const visual = DefaultVisual(display, screen);
+  const int depth = DefaultDepth(display, screen);
+  const int width = DisplayWidth(display, screen);
+  const size_t slot_size = width * TITLE_HEIGHT * sizeof(uint32_t);
+  unique_ptr<ShmSegment> shm;
+  vector<XImage*> shm_images;
+  if (IsDirectColorVisual(visual, depth)) {
+    shm = ShmSegment::Create(display, NUM_SHM_SLOTS * slot_size);
+  }
+  for (int i = 0; shm && i < NUM_SHM_SLOTS; ++i) {
+    XImage* image = shm->CreateImage(
+        visual, depth, width, TITLE_HEIGHT, i * slot_size);
+    if (image == nullptr) {
+      break;
+    }
+    shm_images.push_back(image);
+  }
+  if (shm_images.empty()) {
+    LOG(INFO) << "MIT-SHM unavailable, uploading title bars with XPutImage";
+    shm.reset();
+  }
+  return unique_ptr<Decorator>(new Decorator(
+      display, font, ::std::move(shm), shm_images));
+}
+
+Decorator::Decorator(
+    Display* display,
+    XftFont* font,
+    unique_ptr<ShmSegment> shm,
+    const vector<XImage*>& shm_images)
+    : display_(CHECK_NOTNULL(display)),
+      screen_(DefaultScreen(display_)),
+      visual_(DefaultVisual(display_, screen_)),
+      colormap_(DefaultColormap(display_, screen_)),
+      depth_(DefaultDepth(display_, screen_)),
+      gc_(CreateCopyGC(display_)),
+      font_(CHECK_NOTNULL(font)),
+      shm_(::std::move(shm)),
+      shm_images_(shm_images),
+      shm_serials_(shm_images.size(), 0),
+      next_shm_slot_(0) {
+  for (int focused = 0; focused < 2; ++focused) {
+    XRenderColor color;
+    color.red = ((TEXT_COLORS[focused] >> 16) & 0xff) * 0x101;
+    color.green = ((TEXT_COLORS[focused] >> 8) & 0xff) * 0x101;
+    color.blue = (TEXT_COLORS[focused] & 0xff) * 0x101;
+    color.alpha = 0xffff;
+    XftColorAllocValue(
+        display_, visual_, colormap_, &color, &text_colors_[focused]);
+  }
+}
+
+Decorator::~Decorator() {
+  for (auto& i : decorations_) {
+    Invalidate(&i.second);
+  }
+  for (XImage* image : shm_images_) {
+    ShmSegment::DestroyImage(image);
+  }
+  for (XftColor& color : text_colors_) {
+    XftColorFree(display_, visual_, colormap_, &color);
+  }
+  XftFontClose(display_, font_);
+  XFreeGC(display_, gc_);
+}
+
+unsigned long Decorator::BorderColor(bool focused) {
+  return BG_COLORS[focused];
+}
+
+void Decorator::AddFrame(Window frame, int width) {
+  CHECK(!decorations_.count(frame));
+  Decoration& decoration = decorations_[frame];
+  decoration.width = width;
+  decoration.focused = false;
+  decoration.pixmaps[0] = decoration.pixmaps[1] = None;
+}
+
+void Decorator::RemoveFrame(Window frame) {
+  auto i = decorations_.find(frame);
+  if (i == decorations_.end()) {
+    return;
+  }
+  Invalidate(&i->second);
+  decorations_.erase(i);
+}
+
+void Decorator::SetTitle(Window frame, const string& title) {
+  auto i = decorations_.find(frame);
+  if (i == decorations_.end() || i->second.title == title) {
+    return;
+  }
+  i->second.title = title;
+  Invalidate(&i->second);
+  Paint(frame, &i->second, 0, i->second.width);
+}
+
+void Decorator::SetIcon(Window frame, const uint32_t* pixels, int icon_size) {
+  auto i = decorations_.find(frame);
+  if (i == decorations_.end()) {
+    return;
+  }
+  vector<uint32_t>& icon = i->second.icon;
+  if (pixels == nullptr) {
+    icon.clear();
+  } else {
+    icon.resize(ICON_SIZE * ICON_SIZE);
+    ScalePixels(
+        pixels, icon_size, icon_size,
+        icon.data(), ICON_SIZE, ICON_SIZE, ICON_SIZE);
+  }
+  Invalidate(&i->second);
+  Paint(frame, &i->second, 0, i->second.width);
+}
+
+void Decorator::SetFocused(Window frame, bool focused) {
+  auto i = decorations_.find(frame);
+  if (i == decorations_.end() || i->second.focused == focused) {
+    return;
+  }
+  i->second.focused = focused;
+  XSetWindowBorder(display_, frame, BG_COLORS[focused]);
+  Paint(frame, &i->second, 0, i->second.width);
+}
+
+void Decorator::SetWidth(Window frame, int width) {
+  auto i = decorations_.find(frame);
+  if (i == decorations_.end() || i->second.width == width) {
+    return;
+  }
+  i->second.width = width;
+  Invalidate(&i->second);
+}
+
+void Decorator::OnExpose(const XExposeEvent& e) {
+  auto i = decorations_.find(e.window);
+  if (i == decorations_.end() || e.y >= TITLE_HEIGHT) {
+    return;
+  }
+  Paint(e.window, &i->second, e.x, e.width);
+}
+
+void Decorator::Invalidate(Decoration* decoration) {
+  for (Pixmap& pixmap : decoration->pixmaps) {
+    if (pixmap != None) {
+      XFreePixmap(display_, pixmap);
+      pixmap = None;
+    }
+  }
+}
+
+Pixmap Decorator::GetPixmap(Decoration* decoration) {
+  Pixmap& pixmap = decoration->pixmaps[decoration->focused];
+  if (pixmap == None) {
+    pixmap = Render(*decoration, decoration->focused);
+  }
+  return pixmap;
+}
+
+Pixmap Decorator::Render(const Decoration& decoration, bool focused) {
+  const int width = max(decoration.width, 1);
+  const Pixmap pixmap = XCreatePixmap(
+      display_, DefaultRootWindow(display_), width, TITLE_HEIGHT, depth_);
+
+  // 1. Render background and icon on the client side, and upload them.
+  if (IsDirectColorVisual(visual_, depth_)) {
+    //   a. Get a buffer to render into, preferring the MIT-SHM segment.
+    XImage* image;
+    vector<uint32_t> heap_pixels;
+    const bool use_shm =
+        !shm_images_.empty() && width <= shm_images_[0]->width;
+    size_t slot = 0;
+    if (use_shm) {
+      slot = GetFreeShmSlot();
+      image = shm_images_[slot];
+    } else {
+      heap_pixels.resize(width * TITLE_HEIGHT);
+      image = XCreateImage(
+          display_, visual_, depth_, ZPixmap, 0,
+          reinterpret_cast<char*>(heap_pixels.data()),
+          width, TITLE_HEIGHT, 32, 0);
+      image->byte_order = HostByteOrder();
+    }
+    const int stride = image->bytes_per_line / sizeof(uint32_t);
+    uint32_t* const pixels = reinterpret_cast<uint32_t*>(image->data);
+    //   b. Fill background.
+    for (int y = 0; y < TITLE_HEIGHT; ++y) {
+      ::std::fill(pixels + y * stride, pixels + y * stride + width,
+                  BG_COLORS[focused]);
+    }
+    //   c. Composite premultiplied icon over background.
+    if (!decoration.icon.empty()) {
+      for (int y = 0; y < ICON_SIZE; ++y) {
+        uint32_t* row = pixels + (y + ICON_MARGIN) * stride + ICON_MARGIN;
+        for (int x = 0; x < min(ICON_SIZE, width - ICON_MARGIN); ++x) {
+          const uint32_t src = decoration.icon[y * ICON_SIZE + x];
+          const uint32_t inverse_alpha = 255 - (src >> 24);
+          uint32_t result = 0;
+          for (int shift = 0; shift < 24; shift += 8) {
+            const uint32_t t = ((row[x] >> shift) & 0xff) * inverse_alpha + 128;
+            result |= (((src >> shift) & 0xff) + ((t + (t >> 8)) >> 8))
+                      << shift;
+          }
+          row[x] = result;
+        }
+      }
+    }
+    //   d. Upload.
+    if (use_shm) {
+      shm_serials_[slot] = NextRequest(display_);
+      XShmPutImage(
+          display_, pixmap, gc_, image, 0, 0, 0, 0, width, TITLE_HEIGHT,
+          false);
+    } else {
+      XPutImage(
+          display_, pixmap, gc_, image, 0, 0, 0, 0, width, TITLE_HEIGHT);
+      image->data = nullptr;
+      XDestroyImage(image);
+    }
+  } else {
+    XSetForeground(display_, gc_, BG_COLORS[focused]);
+    XFillRectangle(display_, pixmap, gc_, 0, 0, width, TITLE_HEIGHT);
+  }
+
+  // 2. Draw title.
+  if (!decoration.title.empty()) {
+    XftDraw* draw = XftDrawCreate(display_, pixmap, visual_, colormap_);
+    const int x = decoration.icon.empty()
+        ? TEXT_MARGIN
+        : ICON_MARGIN + ICON_SIZE + TEXT_MARGIN;
+    const int baseline = (TITLE_HEIGHT + font_->ascent - font_->descent) / 2;
+    XftDrawStringUtf8(
+        draw, &text_colors_[focused], font_, x, baseline,
+        reinterpret_cast<const FcChar8*>(decoration.title.data()),
+        decoration.title.size());
+    XftDrawDestroy(draw);
+  }
+  return pixmap;
+}
+
+size_t Decorator::GetFreeShmSlot() {
+  // 1. The server reads the segment asynchronously. A slot is free once the
+  // server has processed its last upload, which is known without a round trip
+  // from the serials of replies and events received since.
+  const unsigned long processed = LastKnownRequestProcessed(display_);
+  for (size_t i = 0; i < shm_serials_.size(); ++i) {
+    const size_t slot = (next_shm_slot_ + i) % shm_serials_.size();
+    if (shm_serials_[slot] == 0 || shm_serials_[slot] <= processed) {
+      shm_serials_[slot] = 0;
+      next_shm_slot_ = (slot + 1) % shm_serials_.size();
+      return slot;
+    }
+  }
+  // 2. All slots are in use, so wait for the server to catch up, which frees
+  // them all.
+  XSync(display_, false);
+  for (unsigned long& serial : shm_serials_) {
+    serial = 0;
+  }
+  const size_t slot = next_shm_slot_;
+  next_shm_slot_ = (slot + 1) % shm_serials_.size();
+  return slot;
+}
+
+void Decorator::Paint(
+    Window frame, Decoration* decoration, int x, int width) {
+  XCopyArea(
+      display_, GetPixmap(decoration), frame, gc_,
+      x, 0, width, TITLE_HEIGHT, x, 0);
+}
+
+Size<int> ClampFrameSize(const Size<int>& size, int title_height) {
+  return Size<int>(max(size.width, 1), max(size.height, title_height + 1));
+}
@@ -0,0 +1,125 @@
+#ifndef DECORATOR_HPP
+#define DECORATOR_HPP
+
+extern "C" {
+#include <X11/Xlib.h>
+#include <X11/Xft/Xft.h>
+}
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "shm_segment.hpp"
+#include "util.hpp"
+
+// Draws title bars on frame windows.
+//
+// Each title bar is rendered at most once per (width, focus state, title,
+// icon) into a server-side pixmap: the background and icon are composited on
+// the client side and uploaded through MIT-SHM where available, and the title
+// is drawn with Xft. Expose events are then answered with a single XCopyArea
+// from the cached pixmap. The pixmaps for both focus states are kept, so
+// switching focus doesn't re-render either.
+//
+// The MIT-SHM segment is split into several slots, so that title bars
+// rendered back to back, e.g. for a batch of property updates, don't each wait
+// for the X server to finish reading the previous one.
+class Decorator {
+ public:
+  // Height in pixels of title bars.
+  static const int TITLE_HEIGHT = 20;
+
+  // Creates a Decorator for the default screen of a display. On failure,
+  // returns nullptr.
+  static ::std::unique_ptr<Decorator> Create(Display* display);
+
+  ~Decorator();
+
+  // Returns the border color of frames in the given focus state.
+  static unsigned long BorderColor(bool focused);
+
+  // Starts decorating a frame window of the given width.
+  void AddFrame(Window frame, int width);
+  // Stops decorating a frame window, freeing its pixmaps.
+  void RemoveFrame(Window frame);
+  // Updates the title of a frame.
+  void SetTitle(Window frame, const ::std::string& title);
+  // Updates the icon of a frame from premultiplied 0xAARRGGBB pixels of size
+  // icon_size x icon_size, or removes it if pixels is nullptr.
+  void SetIcon(Window frame, const uint32_t* pixels, int icon_size);
+  // Updates the focus state of a frame.
+  void SetFocused(Window frame, bool focused);
+  // Updates the width of a frame. The title bar is repainted on the Expose
+  // event that follows the resize.
+  void SetWidth(Window frame, int width);
+  // Repaints the exposed part of a frame's title bar.
+  void OnExpose(const XExposeEvent& e);
+
+  // Returns the number of decorated frames.
+  size_t size() const { return decorations_.size(); }
+
+ private:
+  // Decoration state of a frame window.
+  struct Decoration {
+    int width;
+    ::std::string title;
+    // Premultiplied 0xAARRGGBB pixels of size ICON_SIZE x ICON_SIZE, or
+    // empty if the client has no icon.
+    ::std::vector<uint32_t> icon;
+    bool focused;
+    // Rendered title bar for each focus state, or None if not yet rendered.
+    Pixmap pixmaps[2];
+  };
+
+  // Invoked internally by Create().
+  Decorator(
+      Display* display,
+      XftFont* font,
+      ::std::unique_ptr<ShmSegment> shm,
+      const ::std::vector<XImage*>& shm_images);
+  // Frees the rendered pixmaps of a decoration.
+  void Invalidate(Decoration* decoration);
+  // Returns the pixmap for a decoration's current state, rendering it if
+  // necessary.
+  Pixmap GetPixmap(Decoration* decoration);
+  // Renders a title bar into a new pixmap.
+  Pixmap Render(const Decoration& decoration, bool focused);
+  // Returns the index of a MIT-SHM slot the X server is done reading from,
+  // waiting for it only if all slots are in use.
+  size_t GetFreeShmSlot();
+  // Copies part of a decoration's pixmap onto its frame window.
+  void Paint(Window frame, Decoration* decoration, int x, int width);
+
+  // Handle to the underlying Xlib Display struct.
+  Display* const display_;
+  // Screen properties.
+  const int screen_;
+  Visual* const visual_;
+  const Colormap colormap_;
+  const int depth_;
+  // GC used for uploading and copying pixmaps.
+  const GC gc_;
+  // Font for titles, or nullptr if no font could be loaded.
+  XftFont* const font_;
+  // Text colors for unfocused and focused title bars.
+  XftColor text_colors_[2];
+  // MIT-SHM segment, or nullptr if MIT-SHM is unavailable, and the image
+  // backed by each of its slots.
+  ::std::unique_ptr<ShmSegment> shm_;
+  const ::std::vector<XImage*> shm_images_;
+  // Serial of the last upload from each slot, which the X server may still be
+  // reading from until it has processed that request, or 0 if none.
+  ::std::vector<unsigned long> shm_serials_;
+  // Slot to try first for the next upload.
+  size_t next_shm_slot_;
+  // Decorated frames.
+  ::std::unordered_map<Window, Decoration> decorations_;
+};
+
+// Returns a frame size clamped so that dimensions are positive, and the frame
+// has room for a title bar of the given height and at least one row of the
+// client.
+extern Size<int> ClampFrameSize(const Size<int>& size, int title_height);
+
+#endif
@@ -0,0 +1,791 @@
+#include "drag_handler.hpp"
+extern "C" {
+#include <X11/Xatom.h>
+#include <X11/extensions/XInput2.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+}
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <glog/logging.h>
+#include "decorator.hpp"
+#include "output_layout.hpp"
+
+using ::std::chrono::duration;
+using ::std::chrono::duration_cast;
+using ::std::chrono::milliseconds;
+using ::std::chrono::steady_clock;
+using ::std::max;
+using ::std::min;
+using ::std::string;
+using ::std::unique_ptr;
+using ::std::vector;
+
+namespace {
+
+// Longest time a finished drag waits for the ConfigureNotify events of its
+// updates before being reported.
+const milliseconds FINISH_TIMEOUT(250);
+
+// XIfEvent() predicate matching PropertyNotify events on the window pointed
+// to by arg.
+Bool IsPropertyNotify(Display* display, XEvent* e, XPointer arg) {
+  return e->type == PropertyNotify &&
+         e->xproperty.window == *reinterpret_cast<Window*>(arg);
+}
+
+}  // namespace
+
+unique_ptr<DragHandler> DragHandler::Create(
+    const string& display_str,
+    const Config& config,
+    int border_width,
+    int title_height) {
+  // 1. Open a dedicated X connection for the worker thread.
+  Display* display = XOpenDisplay(display_str.c_str());
+  if (display == nullptr) {
+    LOG(ERROR) << "Failed to open X display " << display_str
+               << " for drag handler";
+    return nullptr;
+  }
+  // 2. Use XInput2 for pointer events where available, and fall back to core
+  // events otherwise.
+  int xi_opcode;
+  int xi_event_base;
+  int xi_error_base;
+  int xi_major = 2;
+  int xi_minor = 0;
+  int xi_pointer = 0;
+  if (XQueryExtension(
+          display, "XInputExtension", &xi_opcode, &xi_event_base,
+          &xi_error_base) &&
+      XIQueryVersion(display, &xi_major, &xi_minor) == Success &&
+      XIGetClientPointer(display, None, &xi_pointer)) {
+    LOG(INFO) << "Using XInput " << xi_major << "." << xi_minor
+              << " for drags";
+  } else {
+    LOG(INFO) << "XInput2 not available, using core events for drags";
+    xi_opcode = -1;
+  }
+  // 3. Create eventfds for signalling between threads. The main loop polls
+  // the result eventfd, so it must not block. The worker polls the request
+  // eventfd along with its X connection, and only drains it once readable.
+  const int request_fd = eventfd(0, EFD_CLOEXEC);
+  const int result_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (request_fd < 0 || result_fd < 0) {
+    PLOG(ERROR) << "Failed to create eventfd";
+    if (request_fd >= 0) {
+      close(request_fd);
+    }
+    if (result_fd >= 0) {
+      close(result_fd);
+    }
+    XCloseDisplay(display);
+    return nullptr;
+  }
+  return unique_ptr<DragHandler>(new DragHandler(
+      display,
+      config,
+      border_width,
+      title_height,
+      xi_opcode,
+      xi_pointer,
+      request_fd,
+      result_fd));
+}
+
+DragHandler::DragHandler(
+    Display* display,
+    const Config& config,
+    int border_width,
+    int title_height,
+    int xi_opcode,
+    int xi_pointer,
+    int request_fd,
+    int result_fd)
+    : display_(CHECK_NOTNULL(display)),
+      root_(DefaultRootWindow(display_)),
+      move_mode_(config.move_mode),
+      resize_mode_(config.resize_mode),
+      border_width_(border_width),
+      title_height_(title_height),
+      xi_opcode_(xi_opcode),
+      xi_pointer_(xi_pointer),
+      update_interval_(config.drag_interval),
+      request_fd_(request_fd),
+      result_fd_(result_fd),
+      stop_(false),
+      drag_window_(None),
+      drag_move_(false),
+      drag_outline_(false),
+      outline_drawn_(false),
+      motion_pending_(false),
+      drag_stats_(),
+      finished_window_(None),
+      clock_window_(None),
+      clock_server_time_(CurrentTime),
+      sample_frame_(None),
+      _BASIC_WM_DRAG_CLOCK(
+          XInternAtom(display_, "_BASIC_WM_DRAG_CLOCK", false)) {
+  // The server stamps property changes of this window with its time.
+  XSetWindowAttributes attributes;
+  attributes.event_mask = PropertyChangeMask;
+  clock_window_ = XCreateWindow(
+      display_,
+      root_,
+      -1,
+      -1,
+      1,
+      1,
+      0,
+      CopyFromParent,
+      InputOnly,
+      CopyFromParent,
+      CWEventMask,
+      &attributes);
+  if (move_mode_ == DragMode::OUTLINE || resize_mode_ == DragMode::OUTLINE) {
+    // Outlines are windows painted by the X server itself, so that they need
+    // neither a server grab nor redrawing when other clients draw below them.
+    // Each line is white with a black border, to show on any background.
+    XSetWindowAttributes outline_attrs;
+    outline_attrs.override_redirect = true;
+    outline_attrs.background_pixel =
+        WhitePixel(display_, DefaultScreen(display_));
+    outline_attrs.border_pixel = BlackPixel(display_, DefaultScreen(display_));
+    for (int i = 0; i < (title_height_ > 0 ? 5 : 4); ++i) {
+      outline_windows_.push_back(XCreateWindow(
+          display_,
+          root_,
+          0,
+          0,
+          1,
+          1,
+          1,
+          CopyFromParent,
+          InputOutput,
+          CopyFromParent,
+          CWOverrideRedirect | CWBackPixel | CWBorderPixel,
+          &outline_attrs));
+    }
+  }
+  // The worker is started last, once all members are initialized.
+  worker_ = ::std::thread(&DragHandler::Work, this);
+}
+
+DragHandler::~DragHandler() {
+  stop_ = true;
+  SignalEventFd(request_fd_);
+  worker_.join();
+  for (const Window w : outline_windows_) {
+    XDestroyWindow(display_, w);
+  }
+  XDestroyWindow(display_, clock_window_);
+  close(request_fd_);
+  close(result_fd_);
+  XCloseDisplay(display_);
+}
+
+void DragHandler::AddClient(
+    Window w, Window frame, const Rect<int>& frame_geometry) {
+  Request request;
+  request.type = Request::Type::ADD_CLIENT;
+  request.window = w;
+  request.frame = frame;
+  request.geometry = frame_geometry;
+  requests_.Push(::std::move(request));
+  SignalEventFd(request_fd_);
+}
+
+void DragHandler::RemoveClient(Window w, bool ungrab) {
+  Request request;
+  request.type = Request::Type::REMOVE_CLIENT;
+  request.window = w;
+  request.ungrab = ungrab;
+  requests_.Push(::std::move(request));
+  SignalEventFd(request_fd_);
+}
+
+void DragHandler::SetGeometry(Window frame, const Rect<int>& frame_geometry) {
+  Request request;
+  request.type = Request::Type::SET_GEOMETRY;
+  request.frame = frame;
+  request.geometry = frame_geometry;
+  requests_.Push(::std::move(request));
+  SignalEventFd(request_fd_);
+}
+
+void DragHandler::SetOutputs(const vector<Rect<int>>& outputs) {
+  Request request;
+  request.type = Request::Type::SET_OUTPUTS;
+  request.outputs = outputs;
+  requests_.Push(::std::move(request));
+  SignalEventFd(request_fd_);
+}
+
+bool DragHandler::PopResult(DragResult* result) {
+  if (!results_.Pop(result)) {
+    // Reset the eventfd before checking again, so that results pushed in
+    // between aren't missed.
+    DrainEventFd(result_fd_);
+    return results_.Pop(result);
+  }
+  return true;
+}
+
+void DragHandler::Work() {
+  for (;;) {
+    // 1. Apply all pending updates from the main thread, so that drags start
+    // from up-to-date geometry.
+    Request request;
+    while (requests_.Pop(&request)) {
+      ApplyRequest(::std::move(request));
+    }
+    // 2. Handle all queued events. Motion is only recorded, so that only the
+    // latest position is applied.
+    while (XPending(display_)) {
+      XEvent e;
+      XNextEvent(display_, &e);
+      switch (e.type) {
+        case ButtonPress:
+          OnButtonPress(
+              e.xbutton.window,
+              e.xbutton.button,
+              Position<int>(e.xbutton.x_root, e.xbutton.y_root));
+          break;
+        case ButtonRelease:
+          OnButtonRelease(e.xbutton.window);
+          break;
+        case MotionNotify:
+          OnMotion(
+              e.xmotion.window,
+              Position<int>(e.xmotion.x_root, e.xmotion.y_root),
+              e.xmotion.time);
+          break;
+        case ConfigureNotify:
+          OnConfigureNotify(e.xconfigure);
+          break;
+        case GenericEvent:
+          if (e.xcookie.extension == xi_opcode_ &&
+              XGetEventData(display_, &e.xcookie)) {
+            OnXIEvent(&e.xcookie);
+            XFreeEventData(display_, &e.xcookie);
+          }
+          break;
+      }
+    }
+    // 3. Apply the latest position, unless the last update was applied less
+    // than an update interval ago.
+    int timeout = -1;
+    const steady_clock::time_point now = steady_clock::now();
+    if (motion_pending_) {
+      if (now >= next_update_) {
+        UpdateDrag();
+        next_update_ = now + update_interval_;
+      } else {
+        timeout = duration_cast<milliseconds>(next_update_ - now).count() + 1;
+      }
+    }
+    // 4. Report a finished drag whose updates weren't all measured in time.
+    if (finished_window_ != None) {
+      if (now >= finish_deadline_) {
+        PublishFinished();
+      } else {
+        const int finish_timeout =
+            duration_cast<milliseconds>(finish_deadline_ - now).count() + 1;
+        timeout = timeout < 0 ? finish_timeout : min(timeout, finish_timeout);
+      }
+    }
+    XFlush(display_);
+    // 5. Wait for more events or requests, or until the next update or report
+    // is due.
+    pollfd fds[2] = {
+        {ConnectionNumber(display_), POLLIN, 0},
+        {request_fd_, POLLIN, 0},
+    };
+    if (poll(fds, 2, timeout) < 0) {
+      PCHECK(errno == EINTR) << "poll() failed";
+      continue;
+    }
+    if (fds[1].revents & POLLIN) {
+      DrainEventFd(request_fd_);
+    }
+    if (stop_) {
+      return;
+    }
+  }
+}
+
+void DragHandler::ApplyRequest(Request&& request) {
+  switch (request.type) {
+    case Request::Type::ADD_CLIENT:
+      clients_[request.window] = request.frame;
+      frame_geometries_[request.frame] = request.geometry;
+      GrabButtons(request.window);
+      break;
+    case Request::Type::REMOVE_CLIENT: {
+      auto i = clients_.find(request.window);
+      if (i == clients_.end()) {
+        break;
+      }
+      if (request.ungrab) {
+        UngrabButtons(request.window);
+      }
+      // Stop measuring updates of the frame, and report a finished drag of it
+      // right away. A separate frame is destroyed along with the client's
+      // state.
+      if (sample_frame_ == i->second) {
+        StopSampling(request.ungrab && i->second == request.window);
+      }
+      if (finished_window_ == request.window) {
+        PublishFinished();
+      }
+      // Abandon any drag of the window, as its frame is being destroyed.
+      if (drag_window_ == request.window) {
+        if (drag_outline_) {
+          if (outline_drawn_) {
+            HideOutline();
+            outline_drawn_ = false;
+          }
+          drag_outline_ = false;
+        }
+        drag_window_ = None;
+        motion_pending_ = false;
+      }
+      frame_geometries_.erase(i->second);
+      last_updates_.erase(i->second);
+      clients_.erase(i);
+      break;
+    }
+    case Request::Type::SET_GEOMETRY: {
+      // 1. The frame being dragged is ours to move until the drag finishes.
+      auto i = frame_geometries_.find(request.frame);
+      if (i == frame_geometries_.end() ||
+          (drag_window_ != None && clients_[drag_window_] == request.frame)) {
+        break;
+      }
+      // 2. Snapshots taken by a lagging main loop before it saw the last
+      // update of a drag are stale, and would make the next drag start from
+      // an old geometry. The snapshot reporting the update is recognized by
+      // the position or size the update set, as without reparenting a
+      // client's own ConfigureRequest may change the rest meanwhile.
+      auto j = last_updates_.find(request.frame);
+      if (j != last_updates_.end()) {
+        const Rect<int>& update = j->second.geometry;
+        const Rect<int>& snapshot = request.geometry;
+        const bool reported = j->second.move
+            ? snapshot.x == update.x && snapshot.y == update.y
+            : snapshot.width == update.width &&
+              snapshot.height == update.height;
+        if (!reported) {
+          break;
+        }
+        last_updates_.erase(j);
+      }
+      i->second = request.geometry;
+      break;
+    }
+    case Request::Type::SET_OUTPUTS:
+      outputs_ = ::std::move(request.outputs);
+      break;
+  }
+}
+
+void DragHandler::GrabButtons(Window w) {
+  // Move windows with alt + left button, and resize them with alt + right
+  // button.
+  if (xi_opcode_ < 0) {
+    for (const unsigned int button : {Button1, Button3}) {
+      XGrabButton(
+          display_,
+          button,
+          Mod1Mask,
+          w,
+          false,
+          ButtonPressMask | ButtonReleaseMask | ButtonMotionMask,
+          GrabModeAsync,
+          GrabModeAsync,
+          None,
+          None);
+    }
+    return;
+  }
+  unsigned char mask_bits[XIMaskLen(XI_LASTEVENT)] = {};
+  XISetMask(mask_bits, XI_ButtonPress);
+  XISetMask(mask_bits, XI_ButtonRelease);
+  XISetMask(mask_bits, XI_Motion);
+  XIEventMask mask = {xi_pointer_, sizeof(mask_bits), mask_bits};
+  for (const int button : {Button1, Button3}) {
+    XIGrabModifiers modifiers = {Mod1Mask, 0};
+    XIGrabButton(
+        display_,
+        xi_pointer_,
+        button,
+        w,
+        None,
+        XIGrabModeAsync,
+        XIGrabModeAsync,
+        false,
+        &mask,
+        1,
+        &modifiers);
+  }
+}
+
+void DragHandler::UngrabButtons(Window w) {
+  if (xi_opcode_ < 0) {
+    XUngrabButton(display_, Button1, Mod1Mask, w);
+    XUngrabButton(display_, Button3, Mod1Mask, w);
+    return;
+  }
+  for (const int button : {Button1, Button3}) {
+    XIGrabModifiers modifiers = {Mod1Mask, 0};
+    XIUngrabButton(display_, xi_pointer_, button, w, 1, &modifiers);
+  }
+}
+
+void DragHandler::OnXIEvent(XGenericEventCookie* cookie) {
+  const XIDeviceEvent& e = *static_cast<XIDeviceEvent*>(cookie->data);
+  const Position<int> pos(
+      static_cast<int>(e.root_x), static_cast<int>(e.root_y));
+  switch (cookie->evtype) {
+    case XI_ButtonPress:
+      OnButtonPress(e.event, e.detail, pos);
+      break;
+    case XI_ButtonRelease:
+      OnButtonRelease(e.event);
+      break;
+    case XI_Motion:
+      OnMotion(e.event, pos, e.time);
+      break;
+  }
+}
+
+void DragHandler::OnButtonPress(
+    Window w, unsigned int button, const Position<int>& pos) {
+  if (!clients_.count(w) || drag_window_ != None) {
+    return;
+  }
+  // 1. Report the last drag before measuring this one.
+  PublishFinished();
+  drag_window_ = w;
+  drag_move_ = button == Button1;
+  drag_stats_ = DragStats();
+  drag_stats_.move = drag_move_;
+  motion_pending_ = false;
+
+  // 2. Save initial cursor position and frame geometry, and watch the frame
+  // for the ConfigureNotify events of updates.
+  const Window frame = clients_[w];
+  drag_start_pos_ = pos;
+  drag_start_frame_geometry_ = frame_geometries_[frame];
+  sample_frame_ = frame;
+  XSelectInput(display_, frame, StructureNotifyMask);
+  SyncClock();
+
+  // 3. Have the main thread raise the window.
+  Publish(DragResult::Type::STARTED, w, drag_start_frame_geometry_);
+
+  // 4. In outline mode, the frame stays in place until the release.
+  drag_outline_ = (drag_move_ ? move_mode_ : resize_mode_) == DragMode::OUTLINE;
+  outline_drawn_ = false;
+}
+
+void DragHandler::OnButtonRelease(Window w) {
+  if (drag_window_ != w) {
+    return;
+  }
+  // 1. Apply the final position, however recent the last update.
+  if (motion_pending_) {
+    UpdateDrag();
+  }
+  drag_window_ = None;
+  const Window frame = clients_[w];
+  if (drag_outline_) {
+    drag_outline_ = false;
+    // 2. Hide outline.
+    const bool dragged = outline_drawn_;
+    if (outline_drawn_) {
+      HideOutline();
+      outline_drawn_ = false;
+    }
+    // 3. Apply the final geometry at once.
+    if (dragged) {
+      MoveResizeFrame(w, frame, outline_);
+      AddSample(frame);
+    }
+  }
+  // 4. Report the drag once the latencies of its updates are measured, or
+  // once they are overdue.
+  finished_window_ = w;
+  finished_geometry_ = frame_geometries_[frame];
+  finish_deadline_ = steady_clock::now() + FINISH_TIMEOUT;
+  if (pending_samples_.empty()) {
+    PublishFinished();
+  }
+}
+
+void DragHandler::OnMotion(Window w, const Position<int>& pos, Time time) {
+  if (drag_window_ != w) {
+    return;
+  }
+  ++drag_stats_.num_events;
+  motion_pending_ = true;
+  motion_pos_ = pos;
+  // The conversion is only accurate to about half a round trip, and can't
+  // place the event after its receipt.
+  motion_time_ = min(ToLocalTime(time), steady_clock::now());
+}
+
+void DragHandler::OnConfigureNotify(const XConfigureEvent& e) {
+  if (e.window != sample_frame_) {
+    return;
+  }
+  // 1. Find the update that applied the reported geometry. Other
+  // ConfigureNotify events, e.g. for restacking by the main loop, match no
+  // update, and updates superseded by a later one before being applied, as
+  // the main loop coalesces ConfigureRequests without reparenting, are
+  // unmatched.
+  auto i = ::std::find_if(
+      pending_samples_.begin(), pending_samples_.end(),
+      [&e] (const Sample& sample) {
+        return sample.geometry.x == e.x && sample.geometry.y == e.y &&
+               sample.geometry.width == e.width &&
+               sample.geometry.height == e.height;
+      });
+  if (i == pending_samples_.end()) {
+    return;
+  }
+  // 2. Record its latency.
+  const double latency =
+      duration<double, ::std::milli>(steady_clock::now() - i->motion_time)
+          .count();
+  drag_stats_.num_unmatched += i - pending_samples_.begin();
+  pending_samples_.erase(pending_samples_.begin(), i + 1);
+  ++drag_stats_.num_samples;
+  drag_stats_.total_latency += latency;
+  drag_stats_.max_latency = max(drag_stats_.max_latency, latency);
+  // 3. Report a finished drag once all its updates are measured.
+  if (pending_samples_.empty()) {
+    PublishFinished();
+  }
+}
+
+void DragHandler::UpdateDrag() {
+  motion_pending_ = false;
+  const Window frame = clients_[drag_window_];
+  const Vector2D<int> delta = motion_pos_ - drag_start_pos_;
+  const Position<int> start_pos = drag_start_frame_geometry_.position();
+  const Size<int> start_size = drag_start_frame_geometry_.size();
+
+  // 1. Move or resize the frame, or in outline mode, compute the outline.
+  Rect<int> dest_frame_geometry = drag_start_frame_geometry_;
+  if (drag_move_) {
+    // alt + left button: Move window, keeping it within the output under the
+    // cursor.
+    Rect<int> dest_frame_rect(
+        start_pos + delta,
+        start_size + Vector2D<int>(2 * border_width_, 2 * border_width_));
+    const int output_index = FindOutput(outputs_, motion_pos_);
+    if (output_index >= 0) {
+      dest_frame_rect = ClampRect(dest_frame_rect, outputs_[output_index]);
+    }
+    dest_frame_geometry.x = dest_frame_rect.x;
+    dest_frame_geometry.y = dest_frame_rect.y;
+    Rect<int>& geometry = frame_geometries_[frame];
+    if (!drag_outline_ &&
+        (geometry.x != dest_frame_rect.x || geometry.y != dest_frame_rect.y)) {
+      XMoveWindow(display_, frame, dest_frame_rect.x, dest_frame_rect.y);
+      geometry.x = dest_frame_rect.x;
+      geometry.y = dest_frame_rect.y;
+      AddSample(frame);
+    }
+  } else {
+    // alt + right button: Resize window, without growing it past the edges of
+    // the output it is on.
+    // Window dimensions cannot be negative.
+    Vector2D<int> size_delta(
+        max(delta.x, -start_size.width),
+        max(delta.y, -start_size.height));
+    const int output_index = FindOutput(outputs_, drag_start_frame_geometry_);
+    if (output_index >= 0) {
+      const Rect<int>& output = outputs_[output_index];
+      const Size<int> max_size(
+          output.x + output.width - start_pos.x - 2 * border_width_,
+          output.y + output.height - start_pos.y - 2 * border_width_);
+      // Windows already extending past the output may keep their size.
+      size_delta.x = min(
+          size_delta.x, max(max_size.width - start_size.width, 0));
+      size_delta.y = min(
+          size_delta.y, max(max_size.height - start_size.height, 0));
+    }
+    const Size<int> dest_frame_size = start_size + size_delta;
+    if (!drag_outline_) {
+      if (ResizeFrame(drag_window_, frame, dest_frame_size)) {
+        AddSample(frame);
+      }
+    } else {
+      const Size<int> size = ClampFrameSize(dest_frame_size, title_height_);
+      dest_frame_geometry.width = size.width;
+      dest_frame_geometry.height = size.height;
+    }
+  }
+
+  // 2. Outline mode: Move the outline.
+  if (drag_outline_) {
+    outline_ = dest_frame_geometry;
+    outline_drawn_ = true;
+    ShowOutline(outline_);
+  }
+
+  ++drag_stats_.num_updates;
+}
+
+bool DragHandler::ResizeFrame(
+    Window w, Window frame, const Size<int>& frame_size) {
+  const Size<int> size = ClampFrameSize(frame_size, title_height_);
+  Rect<int>& geometry = frame_geometries_[frame];
+  if (size.width == geometry.width && size.height == geometry.height) {
+    return false;
+  }
+  // 1. Resize frame.
+  XResizeWindow(display_, frame, size.width, size.height);
+  // 2. Update cached geometry.
+  geometry.width = size.width;
+  geometry.height = size.height;
+  // 3. Have the main thread resize the client window, unless it is its own
+  // frame. A client resize from this connection would be redirected to the
+  // main loop anyway.
+  if (frame != w) {
+    Publish(DragResult::Type::RESIZED, w, geometry);
+  }
+  return true;
+}
+
+void DragHandler::MoveResizeFrame(
+    Window w, Window frame, const Rect<int>& geometry) {
+  const Size<int> size = ClampFrameSize(geometry.size(), title_height_);
+  Rect<int>& cached_geometry = frame_geometries_[frame];
+  const bool resized = size.width != cached_geometry.width ||
+                       size.height != cached_geometry.height;
+  // 1. Move and resize frame with a single request.
+  XMoveResizeWindow(
+      display_, frame, geometry.x, geometry.y, size.width, size.height);
+  // 2. Update cached geometry.
+  cached_geometry = Rect<int>(geometry.position(), size);
+  // 3. Have the main thread resize the client window if needed, unless it is
+  // its own frame.
+  if (frame != w && resized) {
+    Publish(DragResult::Type::RESIZED, w, cached_geometry);
+  }
+}
+
+void DragHandler::ShowOutline(const Rect<int>& geometry) {
+  // 1. Trace the middle of the frame's border, and the bottom of its title bar
+  // if any, with one-pixel lines inside the outline windows' borders.
+  const int inset = border_width_ / 2;
+  const int x0 = geometry.x + inset;
+  const int y0 = geometry.y + inset;
+  const int x1 = geometry.x + geometry.width + 2 * border_width_ - 1 - inset;
+  const int y1 = geometry.y + geometry.height + 2 * border_width_ - 1 - inset;
+  const int title_y = geometry.y + border_width_ + title_height_;
+  const Rect<int> lines[] = {
+      Rect<int>(x0, y0, x1 - x0 + 1, 1),
+      Rect<int>(x1, y0, 1, y1 - y0 + 1),
+      Rect<int>(x0, y1, x1 - x0 + 1, 1),
+      Rect<int>(x0, y0, 1, y1 - y0 + 1),
+      Rect<int>(x0, title_y, x1 - x0 + 1, 1),
+  };
+  for (size_t i = 0; i < outline_windows_.size(); ++i) {
+    XMoveResizeWindow(
+        display_,
+        outline_windows_[i],
+        lines[i].x - 1,
+        lines[i].y - 1,
+        lines[i].width,
+        lines[i].height);
+  }
+  // 2. Show it above all windows, including frames the main thread raised
+  // since the last update.
+  for (const Window w : outline_windows_) {
+    XMapRaised(display_, w);
+  }
+}
+
+void DragHandler::HideOutline() {
+  for (const Window w : outline_windows_) {
+    XUnmapWindow(display_, w);
+  }
+}
+
+void DragHandler::PublishFinished() {
+  if (finished_window_ == None) {
+    return;
+  }
+  // Updates still being measured are counted as unmatched.
+  StopSampling(true);
+  Publish(
+      DragResult::Type::FINISHED,
+      finished_window_,
+      finished_geometry_,
+      drag_stats_);
+  finished_window_ = None;
+}
+
+void DragHandler::SyncClock() {
+  // 1. Append nothing to a property, which the server stamps with its time
+  // when processing the request.
+  const steady_clock::time_point start = steady_clock::now();
+  XChangeProperty(
+      display_,
+      clock_window_,
+      _BASIC_WM_DRAG_CLOCK,
+      XA_CARDINAL,
+      32,
+      PropModeAppend,
+      nullptr,
+      0);
+  XEvent e;
+  XIfEvent(
+      display_,
+      &e,
+      &IsPropertyNotify,
+      reinterpret_cast<XPointer>(&clock_window_));
+  const steady_clock::time_point end = steady_clock::now();
+  // 2. Assume the request was processed halfway through the round trip.
+  clock_server_time_ = e.xproperty.time;
+  clock_local_time_ = start + (end - start) / 2;
+}
+
+steady_clock::time_point DragHandler::ToLocalTime(Time time) const {
+  // Server timestamps are 32-bit milliseconds, and wrap around every 49.7
+  // days.
+  const int32_t delta =
+      static_cast<int32_t>(static_cast<uint32_t>(time - clock_server_time_));
+  return clock_local_time_ + milliseconds(delta);
+}
+
+void DragHandler::AddSample(Window frame) {
+  const Rect<int>& geometry = frame_geometries_[frame];
+  pending_samples_.push_back({geometry, motion_time_});
+  last_updates_[frame] = {geometry, drag_move_};
+}
+
+void DragHandler::StopSampling(bool deselect) {
+  if (sample_frame_ != None && deselect) {
+    XSelectInput(display_, sample_frame_, NoEventMask);
+  }
+  drag_stats_.num_unmatched += pending_samples_.size();
+  sample_frame_ = None;
+  pending_samples_.clear();
+}
+
+void DragHandler::Publish(
+    DragResult::Type type,
+    Window w,
+    const Rect<int>& geometry,
+    const DragStats& stats) {
+  results_.Push({type, w, geometry, stats});
+  SignalEventFd(result_fd_);
+}
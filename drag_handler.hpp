@@ -0,0 +1,290 @@
+#ifndef DRAG_HANDLER_HPP
+#define DRAG_HANDLER_HPP
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "config.hpp"
+#include "spsc_queue.hpp"
+#include "util.hpp"
+
+// Measurements of a single drag.
+struct DragStats {
+  // Whether the drag moved the window, or else resized it.
+  bool move;
+  // Number of pointer motion events received, and of updates of the window or
+  // outline applied for them, at most one per Config::drag_interval.
+  int num_events;
+  int num_updates;
+  // Number of updates whose latency was measured, and their total and maximum
+  // latency in milliseconds, from the X server generating the pointer motion
+  // event applied to the receipt of the ConfigureNotify event for the frame's
+  // new geometry.
+  int num_samples;
+  double total_latency;
+  double max_latency;
+  // Number of updates whose ConfigureNotify event never came, e.g. as the
+  // frame was destroyed, or didn't come within FINISH_TIMEOUT of the release.
+  int num_unmatched;
+};
+
+// The outcome of a drag, reported to the main thread.
+struct DragResult {
+  enum class Type {
+    // A move or resize of a client started.
+    STARTED,
+    // A resize of a client's frame to the given geometry was applied, and the
+    // client window should be resized to fit.
+    RESIZED,
+    // A move or resize of a client finished, leaving its frame with the given
+    // geometry.
+    FINISHED,
+  };
+
+  Type type;
+  Window window;
+  Rect<int> geometry;
+  // Measurements of the drag, for FINISHED.
+  DragStats stats;
+};
+
+// Moves and resizes windows with alt + drag on a worker thread with its own X
+// connection, so that the window being dragged follows the pointer smoothly
+// however busy the main event loop is.
+//
+// The worker's connection owns the passive button grabs on client windows, so
+// pointer events for drags never go through the main loop. Frames are
+// override-redirect, so the worker's moves and resizes of frames are applied
+// by the X server right away rather than redirected to the main loop as
+// ConfigureRequests; client windows, which are not, are resized to fit by the
+// main loop. Without reparenting, the client window is its own frame, and
+// each update of it is a ConfigureRequest applied by the main loop. The main
+// loop keeps the worker's snapshots of client frames, frame geometry and
+// outputs up to date, and collects the results of drags, through lock-free
+// queues.
+//
+// Pointer input comes from XInput2 where available, and from core events
+// otherwise. Motion is coalesced to the latest position, which is applied at
+// most once per Config::drag_interval. The latency of each update that moves
+// or resizes the frame is measured on the worker, from the server timestamp of
+// the motion event applied to the receipt of the ConfigureNotify event
+// reporting the frame's new geometry, for which the worker's connection
+// selects StructureNotifyMask on the frame being dragged. This covers the
+// whole path from input delivery to the X server applying the update,
+// including the main loop without reparenting. Server timestamps are
+// converted to the worker's clock by timing a property change at the start
+// of each drag. A drag is reported once all its updates are measured, or
+// FINISH_TIMEOUT after the release, counting the rest as unmatched.
+class DragHandler {
+ public:
+  // Creates a DragHandler with its own connection to the named display, for
+  // frames with borders and title bars of the given size. On failure, returns
+  // nullptr.
+  static ::std::unique_ptr<DragHandler> Create(
+      const ::std::string& display_str,
+      const Config& config,
+      int border_width,
+      int title_height);
+
+  ~DragHandler();
+
+  // Starts handling drags on a newly framed client window.
+  void AddClient(Window w, Window frame, const Rect<int>& frame_geometry);
+  // Stops handling drags on a client window. If ungrab is false, the client
+  // window no longer exists or is no longer ours.
+  void RemoveClient(Window w, bool ungrab);
+  // Updates the snapshot of a frame window's geometry.
+  void SetGeometry(Window frame, const Rect<int>& frame_geometry);
+  // Updates the snapshot of the screen's outputs.
+  void SetOutputs(const ::std::vector<Rect<int>>& outputs);
+
+  // File descriptor that becomes readable when results are available.
+  int result_fd() const { return result_fd_; }
+  // Removes the next available result into result. Returns false if there are
+  // no more results.
+  bool PopResult(DragResult* result);
+
+ private:
+  // An update from the main thread.
+  struct Request {
+    enum class Type {
+      ADD_CLIENT,
+      REMOVE_CLIENT,
+      SET_GEOMETRY,
+      SET_OUTPUTS,
+    };
+
+    Type type;
+    Window window;
+    Window frame;
+    Rect<int> geometry;
+    bool ungrab;
+    ::std::vector<Rect<int>> outputs;
+  };
+
+  // Invoked internally by Create().
+  DragHandler(
+      Display* display,
+      const Config& config,
+      int border_width,
+      int title_height,
+      int xi_opcode,
+      int xi_pointer,
+      int request_fd,
+      int result_fd);
+  // Entry point of the worker thread.
+  void Work();
+  // Applies an update from the main thread.
+  void ApplyRequest(Request&& request);
+  // Grabs or ungrabs alt + left and right buttons on a client window.
+  void GrabButtons(Window w);
+  void UngrabButtons(Window w);
+  // Handles an XInput2 event, translating it for the handlers below.
+  void OnXIEvent(XGenericEventCookie* cookie);
+  // Pointer event handlers, run on the worker thread.
+  void OnButtonPress(Window w, unsigned int button, const Position<int>& pos);
+  void OnButtonRelease(Window w);
+  void OnMotion(Window w, const Position<int>& pos, Time time);
+  void OnConfigureNotify(const XConfigureEvent& e);
+  // Applies the latest pointer position to the window being dragged, or to
+  // its outline.
+  void UpdateDrag();
+  // Reports the last finished drag, once the latencies of its updates are
+  // measured, FINISH_TIMEOUT after its release, or when another drag starts.
+  void PublishFinished();
+  // Measures which time of the worker's clock corresponds to a time of the X
+  // server's, with a round trip.
+  void SyncClock();
+  // Converts an X server timestamp to the worker's clock.
+  ::std::chrono::steady_clock::time_point ToLocalTime(Time time) const;
+  // Starts measuring the latency of the latest update of a frame, and has
+  // snapshots of the frame's geometry ignored until one reports it.
+  void AddSample(Window frame);
+  // Stops measuring latencies, counting updates still being measured as
+  // unmatched. If deselect is false, the frame no longer exists.
+  void StopSampling(bool deselect);
+  // Resizes a frame window, and has the main thread resize its client window
+  // to fit. Returns false if the frame already has that size.
+  bool ResizeFrame(Window w, Window frame, const Size<int>& frame_size);
+  // Moves and resizes a frame window, and has the main thread resize its
+  // client window to fit.
+  void MoveResizeFrame(Window w, Window frame, const Rect<int>& geometry);
+  // Shows the outline of a frame geometry above all windows, or hides it.
+  void ShowOutline(const Rect<int>& geometry);
+  void HideOutline();
+  // Hands a result to the main thread.
+  void Publish(
+      DragResult::Type type,
+      Window w,
+      const Rect<int>& geometry,
+      const DragStats& stats = DragStats());
+
+  // The worker thread's own connection to the X server.
+  Display* const display_;
+  // Root window.
+  const Window root_;
+  // How windows are shown while being moved and resized.
+  const DragMode move_mode_;
+  const DragMode resize_mode_;
+  // Width of frame borders, and height of title bars.
+  const int border_width_;
+  const int title_height_;
+  // Major opcode of the XInputExtension, or -1 if XInput2 is unavailable and
+  // core pointer events are used. Device ID of the master pointer grabbed
+  // through XInput2.
+  const int xi_opcode_;
+  const int xi_pointer_;
+  // Minimum time between updates of the window being dragged.
+  const ::std::chrono::milliseconds update_interval_;
+  // eventfd signalled when requests are pushed.
+  const int request_fd_;
+  // eventfd signalled when results are pushed.
+  const int result_fd_;
+  // Updates from the main thread to the worker.
+  SpscQueue<Request> requests_;
+  // Results from the worker to the main thread.
+  SpscQueue<DragResult> results_;
+  // Set to make the worker exit.
+  ::std::atomic<bool> stop_;
+
+  // State below is only accessed by the worker thread.
+  // Maps client windows to their frame windows.
+  ::std::unordered_map<Window, Window> clients_;
+  // Last known geometry of each frame window, keyed by frame.
+  ::std::unordered_map<Window, Rect<int>> frame_geometries_;
+  // The last update applied by a drag to a frame whose geometry the main
+  // thread hasn't reported since, keyed by frame. Snapshots up to the one
+  // reporting it predate the update, and are ignored.
+  struct LastUpdate {
+    Rect<int> geometry;
+    // Whether the update moved the frame, or else resized it.
+    bool move;
+  };
+  ::std::unordered_map<Window, LastUpdate> last_updates_;
+  // Outputs of the screen.
+  ::std::vector<Rect<int>> outputs_;
+  // The client window being dragged, or None.
+  Window drag_window_;
+  // The cursor position at the start of a window move/resize.
+  Position<int> drag_start_pos_;
+  // The geometry of the affected frame at the start of a window move/resize.
+  Rect<int> drag_start_frame_geometry_;
+  // Whether the current drag is a move, or else a resize.
+  bool drag_move_;
+  // Whether the current window move/resize is shown as an outline.
+  bool drag_outline_;
+  // The geometry of the outline currently shown, if any.
+  bool outline_drawn_;
+  Rect<int> outline_;
+  // Override-redirect windows forming the sides of the outline and the bottom
+  // of its title bar, if any. Only created if outlines are used.
+  ::std::vector<Window> outline_windows_;
+  // The latest pointer position not yet applied, if any, and when the X server
+  // generated its motion event, on the worker's clock.
+  bool motion_pending_;
+  Position<int> motion_pos_;
+  ::std::chrono::steady_clock::time_point motion_time_;
+  // Earliest time at which the next update may be applied.
+  ::std::chrono::steady_clock::time_point next_update_;
+  // Measurements of the current drag, or of the last finished drag until it
+  // is published.
+  DragStats drag_stats_;
+  // The client window of a finished drag not yet published, or None, its
+  // frame's final geometry, and when it is published at the latest.
+  Window finished_window_;
+  Rect<int> finished_geometry_;
+  ::std::chrono::steady_clock::time_point finish_deadline_;
+  // Window whose property changes are timed to relate the X server's clock to
+  // the worker's, and a server time and the matching time on the worker.
+  Window clock_window_;
+  Time clock_server_time_;
+  ::std::chrono::steady_clock::time_point clock_local_time_;
+  // An update whose ConfigureNotify event is still due.
+  struct Sample {
+    // The frame geometry the update applied.
+    Rect<int> geometry;
+    // When the motion event applied was generated, on the worker's clock.
+    ::std::chrono::steady_clock::time_point motion_time;
+  };
+  // The frame on which StructureNotifyMask is selected to measure latencies,
+  // or None.
+  Window sample_frame_;
+  // Updates of sample_frame_ being measured, oldest first.
+  ::std::deque<Sample> pending_samples_;
+
+  // The worker thread. Started last, once all members are initialized.
+  ::std::thread worker_;
+
+  // Atom constants.
+  const Atom _BASIC_WM_DRAG_CLOCK;
+};
+
+#endif
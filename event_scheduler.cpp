@@ -0,0 +1,321 @@
+#include "event_scheduler.hpp"
+#include <algorithm>
+#include <sstream>
+#include <vector>
+#include <glog/logging.h>
+// Xlibint.h exposes the resource ID allocation of the connection. It defines
+// min and max macros that break the C++ standard library, so it must come
+// last.
+extern "C" {
+#include <X11/Xlibint.h>
+}
+#undef min
+#undef max
+
+using ::std::chrono::duration;
+using ::std::chrono::duration_cast;
+using ::std::hex;
+using ::std::max;
+using ::std::min;
+using ::std::ostringstream;
+using ::std::string;
+using ::std::vector;
+
+namespace {
+
+// Cost of a round robin turn. Each client's turn covers events costing up to
+// this much, on top of any cost left over from its previous turn.
+const int QUANTUM = 4;
+
+// Returns the share of a client's turn that handling an event takes, based on
+// the requests and round trips it takes. No event costs more than QUANTUM.
+int GetEventCost(int type) {
+  switch (type) {
+    case MapRequest:
+      // Framing a window.
+      return 4;
+    case ConfigureRequest:
+      return 2;
+    default:
+      return 1;
+  }
+}
+
+// Returns the window an event is about. Substructure events are reported on
+// the parent window, but are about their child window.
+Window GetWindow(const XEvent& e) {
+  switch (e.type) {
+    case CreateNotify:
+      return e.xcreatewindow.window;
+    case DestroyNotify:
+      return e.xdestroywindow.window;
+    case ReparentNotify:
+      return e.xreparent.window;
+    case MapNotify:
+      return e.xmap.window;
+    case UnmapNotify:
+      return e.xunmap.window;
+    case ConfigureNotify:
+      return e.xconfigure.window;
+    case MapRequest:
+      return e.xmaprequest.window;
+    case ConfigureRequest:
+      return e.xconfigurerequest.window;
+    default:
+      return e.xany.window;
+  }
+}
+
+// Returns whether an event is direct user input.
+bool IsInputEvent(int type) {
+  switch (type) {
+    case KeyPress:
+    case KeyRelease:
+    case ButtonPress:
+    case ButtonRelease:
+    case MotionNotify:
+    case EnterNotify:
+    case LeaveNotify:
+      return true;
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+EventScheduler::EventScheduler(
+    Display* display, TimerQueue* timers, int max_rate)
+    : display_(CHECK_NOTNULL(display)),
+      timers_(CHECK_NOTNULL(timers)),
+      resource_mask_(display_->resource_mask),
+      own_client_(display_->resource_base & ~resource_mask_),
+      max_rate_(max_rate),
+      // Allow bursts of a quarter of a second's worth of events, e.g. from an
+      // application mapping all of its windows at startup.
+      burst_(max(max_rate / 4, 1)),
+      next_seq_(0),
+      turn_started_(false),
+      wake_up_timer_(0),
+      WM_STATE(XInternAtom(display_, "WM_STATE", false)) {
+}
+
+void EventScheduler::Push(const XEvent& e) {
+  // 1. Input events jump the queue.
+  const QueuedEvent queued = {next_seq_++, e};
+  if (IsInputEvent(e.type)) {
+    input_events_.push_back(queued);
+    return;
+  }
+  // 2. Queue other events per client.
+  const XID id = GetClient(e);
+  auto i = clients_.find(id);
+  if (i == clients_.end()) {
+    Client client;
+    client.deficit = 0;
+    client.tokens = burst_;
+    client.refill_time = Clock::now();
+    client.throttled = false;
+    client.num_handled = 0;
+    client.num_throttled = 0;
+    client.max_queued = 0;
+    i = clients_.emplace(id, ::std::move(client)).first;
+  }
+  Client& client = i->second;
+  if (client.events.empty()) {
+    active_.push_back(id);
+  }
+  client.events.push_back(queued);
+  client.max_queued = max(client.max_queued, client.events.size());
+}
+
+bool EventScheduler::Pop(XEvent* e) {
+  // 1. Input events, after any events about the same window received before
+  // them.
+  if (!input_events_.empty()) {
+    if (PopEarlier(input_events_.front(), e)) {
+      return true;
+    }
+    *e = input_events_.front().event;
+    input_events_.pop_front();
+    return true;
+  }
+  // 2. Give clients with queued events their turns, skipping rate limited
+  // ones. A fresh turn always covers at least one event, so this only gives up
+  // once every client was found rate limited.
+  const Clock::time_point now = Clock::now();
+  size_t num_throttled = 0;
+  while (num_throttled < active_.size()) {
+    const XID id = active_.front();
+    Client& client = clients_[id];
+    const bool takes_token = TakesToken(client.events.front().event);
+    if (takes_token && !Refill(id, &client, now)) {
+      ScheduleWakeUp(client, now);
+      EndTurn();
+      ++num_throttled;
+      continue;
+    }
+    if (!turn_started_) {
+      client.deficit += QUANTUM;
+      turn_started_ = true;
+    }
+    const int cost = GetEventCost(client.events.front().event.type);
+    if (cost > client.deficit) {
+      EndTurn();
+      continue;
+    }
+    *e = client.events.front().event;
+    client.events.pop_front();
+    client.deficit -= cost;
+    if (takes_token) {
+      client.tokens -= 1;
+    }
+    ++client.num_handled;
+    // A client leaves the round robin once it has nothing queued, and doesn't
+    // keep any unused cost for later.
+    if (client.events.empty()) {
+      client.deficit = 0;
+      active_.pop_front();
+      turn_started_ = false;
+    }
+    return true;
+  }
+  Prune(now);
+  return false;
+}
+
+string EventScheduler::ToString() const {
+  vector<XID> ids;
+  for (const auto& i : clients_) {
+    ids.push_back(i.first);
+  }
+  ::std::sort(ids.begin(), ids.end());
+  ostringstream out;
+  for (const XID id : ids) {
+    const Client& client = clients_.at(id);
+    out << "client 0x" << hex << id << ::std::dec
+        << " handled " << client.num_handled
+        << " throttled " << client.num_throttled
+        << " queued " << client.events.size()
+        << " max_queued " << client.max_queued << "\n";
+  }
+  return out.str();
+}
+
+XID EventScheduler::GetClient(const XEvent& e) const {
+  return GetWindow(e) & ~resource_mask_;
+}
+
+bool EventScheduler::TakesToken(const XEvent& e) const {
+  switch (e.type) {
+    case MapRequest:
+    case ConfigureRequest:
+    case ClientMessage:
+      return true;
+    case PropertyNotify:
+      // WM_STATE is set by us when framing, iconifying and withdrawing.
+      return e.xproperty.atom != WM_STATE;
+    default:
+      return false;
+  }
+}
+
+bool EventScheduler::PopEarlier(const QueuedEvent& input, XEvent* e) {
+  // 1. Find the earliest event about the window in its client's queue, which
+  // is in the order events were received.
+  const Window w = GetWindow(input.event);
+  const XID id = w & ~resource_mask_;
+  auto c = clients_.find(id);
+  if (c == clients_.end()) {
+    return false;
+  }
+  Client& client = c->second;
+  auto i = client.events.begin();
+  while (i != client.events.end() && i->seq < input.seq &&
+         GetWindow(i->event) != w) {
+    ++i;
+  }
+  if (i == client.events.end() || i->seq > input.seq) {
+    return false;
+  }
+  // 2. Handle it out of turn, however many tokens the client has left.
+  *e = i->event;
+  client.events.erase(i);
+  if (TakesToken(*e)) {
+    client.tokens -= 1;
+  }
+  ++client.num_handled;
+  // 3. A client leaves the round robin once it has nothing queued.
+  if (client.events.empty()) {
+    auto a = ::std::find(active_.begin(), active_.end(), id);
+    if (a == active_.begin()) {
+      turn_started_ = false;
+    }
+    active_.erase(a);
+    client.deficit = 0;
+  }
+  return true;
+}
+
+bool EventScheduler::Refill(XID id, Client* client, Clock::time_point now) {
+  // Our own windows and the root window, which belongs to the server, are
+  // never rate limited.
+  if (max_rate_ == 0 || id == own_client_ || id == 0) {
+    client->tokens = burst_;
+    return true;
+  }
+  const double elapsed =
+      duration_cast<duration<double>>(now - client->refill_time).count();
+  client->tokens = min(client->tokens + elapsed * max_rate_, burst_);
+  client->refill_time = now;
+  if (client->tokens >= 1) {
+    client->throttled = false;
+    return true;
+  }
+  if (!client->throttled) {
+    client->throttled = true;
+    ++client->num_throttled;
+    LOG(WARNING) << "X client 0x" << hex << id << ::std::dec
+                 << " exceeded " << max_rate_ << " events per second, "
+                 << "deferring " << client->events.size() << " events";
+  }
+  return false;
+}
+
+void EventScheduler::EndTurn() {
+  active_.push_back(active_.front());
+  active_.pop_front();
+  turn_started_ = false;
+}
+
+void EventScheduler::ScheduleWakeUp(
+    const Client& client, Clock::time_point now) {
+  const Clock::time_point wake_up_time = now + duration_cast<Clock::duration>(
+      duration<double>((1 - client.tokens) / max_rate_));
+  if (wake_up_timer_ != 0) {
+    if (wake_up_time_ <= wake_up_time) {
+      return;
+    }
+    timers_->Cancel(wake_up_timer_);
+  }
+  // The timer only needs to end the main loop's poll(), after which queued
+  // events are popped again.
+  wake_up_timer_ = timers_->Add(wake_up_time - now, [this] {
+    wake_up_timer_ = 0;
+  });
+  wake_up_time_ = wake_up_time;
+}
+
+void EventScheduler::Prune(Clock::time_point now) {
+  for (auto i = clients_.begin(); i != clients_.end();) {
+    const Client& client = i->second;
+    const double elapsed =
+        duration_cast<duration<double>>(now - client.refill_time).count();
+    if (client.events.empty() && client.num_throttled == 0 &&
+        (max_rate_ == 0 || client.tokens + elapsed * max_rate_ >= burst_)) {
+      i = clients_.erase(i);
+    } else {
+      ++i;
+    }
+  }
+}
@@ -0,0 +1,127 @@
+#ifndef EVENT_SCHEDULER_HPP
+#define EVENT_SCHEDULER_HPP
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+#include <chrono>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include "timer_queue.hpp"
+
+// Orders X events so that no single X client can hold up the handling of
+// events from other clients or from the user.
+//
+// Events are queued per X client, identified by the resource ID base of the
+// window an event is about, which keeps events about any one window in order.
+// Input events (keys, buttons, pointer motion and crossings) are handled first,
+// in order, except that events about the same window received before an input
+// event are handled before it, so that e.g. an EnterNotify on a frame is never
+// handled before the frame's MapNotify, or a KeyPress on a window before its
+// UnmapNotify.
+// Client queues are serviced by deficit round robin, where events that are
+// expensive to handle, such as MapRequest, cost more of a client's turn.
+// Each client is also rate limited with a token bucket: requests from a
+// client that runs out of tokens stay queued until its bucket refills, and the
+// client is logged as flooding. Only events that a client causes directly,
+// i.e. MapRequest, ConfigureRequest, ClientMessage and changes to its own
+// properties, take tokens. Notify events that follow from our own handling of
+// a request, such as the ReparentNotify and MapNotify of framing, are never
+// held back, so a client's burst covers as many requests as it says. The
+// window manager's own windows and the root window are never rate limited.
+class EventScheduler {
+ public:
+  // Creates an EventScheduler that lets each client have max_rate events per
+  // second handled, or unlimited events if max_rate is 0. timers is used to
+  // wake up the main loop when rate limited events may be handled again.
+  EventScheduler(Display* display, TimerQueue* timers, int max_rate);
+
+  // Queues an event.
+  void Push(const XEvent& e);
+  // Removes the next event to handle into e. Returns false if no queued event
+  // may be handled now.
+  bool Pop(XEvent* e);
+
+  // Returns per-client counters, one line per client.
+  ::std::string ToString() const;
+
+ private:
+  typedef ::std::chrono::steady_clock Clock;
+
+  // A queued event, numbered in the order events were received.
+  struct QueuedEvent {
+    uint64_t seq;
+    XEvent event;
+  };
+
+  // Queue and counters of an X client.
+  struct Client {
+    // Events waiting to be handled, in order.
+    ::std::deque<QueuedEvent> events;
+    // Unused cost of the client's current turn.
+    int deficit;
+    // Rate limiting token bucket, and when it was last refilled.
+    double tokens;
+    Clock::time_point refill_time;
+    // Whether the client is currently rate limited.
+    bool throttled;
+    // Number of events handled, and of times the client was rate limited.
+    uint64_t num_handled;
+    uint64_t num_throttled;
+    // Longest the client's queue has been.
+    size_t max_queued;
+  };
+
+  // Returns the X client an event is from.
+  XID GetClient(const XEvent& e) const;
+  // Returns whether an event was caused directly by its client, and so takes
+  // a token from its bucket.
+  bool TakesToken(const XEvent& e) const;
+  // Removes into e the earliest queued event about the window of an input
+  // event that was received before it. Returns false if there is none.
+  bool PopEarlier(const QueuedEvent& input, XEvent* e);
+  // Refills a client's token bucket. Returns whether the client may have an
+  // event handled now.
+  bool Refill(XID id, Client* client, Clock::time_point now);
+  // Ends the turn of the client at the front of the round robin.
+  void EndTurn();
+  // Schedules a timer to wake up the main loop when a rate limited client
+  // can have an event handled again.
+  void ScheduleWakeUp(const Client& client, Clock::time_point now);
+  // Drops clients with nothing queued, a full token bucket and no history of
+  // being rate limited.
+  void Prune(Clock::time_point now);
+
+  // Handle to the underlying Xlib Display struct.
+  Display* const display_;
+  // Timers for waking up the main loop.
+  TimerQueue* const timers_;
+  // Resource ID mask of the X server, which is the same for all clients.
+  const XID resource_mask_;
+  // Resource ID base of our own connection.
+  const XID own_client_;
+  // Events handled per second, and size of token buckets, or 0 if unlimited.
+  const double max_rate_;
+  const double burst_;
+  // Number of the next event received.
+  uint64_t next_seq_;
+  // Input events, handled before anything else.
+  ::std::deque<QueuedEvent> input_events_;
+  // X clients, keyed by resource ID base.
+  ::std::unordered_map<XID, Client> clients_;
+  // Clients with queued events, in round robin order. The front client is
+  // having its turn.
+  ::std::deque<XID> active_;
+  // Whether the front client's turn has started, i.e. it was given its
+  // quantum.
+  bool turn_started_;
+  // Pending wake-up timer, or 0 if none.
+  TimerQueue::TimerId wake_up_timer_;
+  Clock::time_point wake_up_time_;
+
+  // Atom constants.
+  const Atom WM_STATE;
+};
+
+#endif
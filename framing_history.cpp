@@ -0,0 +1,76 @@
+#include "framing_history.hpp"
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+using ::std::ostringstream;
+using ::std::string;
+using ::std::vector;
+
+namespace {
+
+// Weight of the latest lifetime in a class's running average, so that a class
+// whose windows change behavior is relearned after a few windows.
+const double LIFETIME_WEIGHT = 0.25;
+
+}  // namespace
+
+FramingHistory::FramingHistory()
+    : num_deferred_(0),
+      num_framed_{0, 0, 0},
+      num_avoided_(0),
+      num_mispredicted_(0) {
+}
+
+void FramingHistory::AddDeferred() {
+  ++num_deferred_;
+}
+
+void FramingHistory::AddFramed(Reason reason) {
+  ++num_framed_[static_cast<int>(reason)];
+}
+
+void FramingHistory::AddLifetime(
+    const string& class_name, bool short_lived, bool framed) {
+  // 1. Count framing avoided, or wasted on a window that didn't last.
+  if (short_lived) {
+    ++(framed ? num_mispredicted_ : num_avoided_);
+  }
+  // 2. Update the class's running average.
+  if (class_name.empty()) {
+    return;
+  }
+  const double sample = short_lived ? 1 : 0;
+  auto i = short_lived_rates_.find(class_name);
+  if (i == short_lived_rates_.end()) {
+    short_lived_rates_.emplace(class_name, sample);
+  } else {
+    i->second += LIFETIME_WEIGHT * (sample - i->second);
+  }
+}
+
+bool FramingHistory::IsLongLived(const string& class_name) const {
+  auto i = short_lived_rates_.find(class_name);
+  return i != short_lived_rates_.end() && i->second < 0.5;
+}
+
+string FramingHistory::ToString() const {
+  ostringstream out;
+  out << "deferred " << num_deferred_
+      << " framed_after_delay "
+      << num_framed_[static_cast<int>(Reason::DELAY)]
+      << " framed_on_input " << num_framed_[static_cast<int>(Reason::INPUT)]
+      << " framed_by_class " << num_framed_[static_cast<int>(Reason::CLASS)]
+      << " avoided " << num_avoided_
+      << " mispredicted " << num_mispredicted_ << "\n";
+  vector<string> classes;
+  for (const auto& i : short_lived_rates_) {
+    classes.push_back(i.first);
+  }
+  ::std::sort(classes.begin(), classes.end());
+  for (const string& class_name : classes) {
+    out << "class " << class_name << " short_lived "
+        << short_lived_rates_.at(class_name) << "\n";
+  }
+  return out.str();
+}
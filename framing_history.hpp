@@ -0,0 +1,59 @@
+#ifndef FRAMING_HISTORY_HPP
+#define FRAMING_HISTORY_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// Outcomes of deferred framing, where newly mapped windows are shown without a
+// frame for a grace period so that short-lived windows such as splash screens
+// are never framed.
+//
+// Learns per WM_CLASS class whether windows tend to outlive the grace period,
+// as a running average of the lifetimes observed, so that windows of
+// long-lived classes can be framed as soon as their class is known. Also
+// counts the framing work avoided.
+class FramingHistory {
+ public:
+  // Why a deferred window was framed.
+  enum class Reason {
+    // It was still mapped at the end of the grace period.
+    DELAY,
+    // It received pointer motion or a key press.
+    INPUT,
+    // Its class is long-lived.
+    CLASS,
+  };
+
+  FramingHistory();
+
+  // Records that a newly mapped window was shown without a frame.
+  void AddDeferred();
+  // Records that a deferred window was framed.
+  void AddFramed(Reason reason);
+  // Records whether a window was unmapped within the grace period, and
+  // whether it had been framed by then. class_name is its WM_CLASS class, or
+  // empty if not known yet.
+  void AddLifetime(
+      const ::std::string& class_name, bool short_lived, bool framed);
+
+  // Returns whether windows of a WM_CLASS class have mostly outlived the grace
+  // period.
+  bool IsLongLived(const ::std::string& class_name) const;
+
+  // Returns the counters on one line, followed by one line per known class.
+  ::std::string ToString() const;
+
+ private:
+  // Running average of whether windows of each class were short-lived.
+  ::std::unordered_map<::std::string, double> short_lived_rates_;
+  // Number of windows deferred, and framed for each Reason.
+  uint64_t num_deferred_;
+  uint64_t num_framed_[3];
+  // Number of short-lived windows that were never framed, and that were
+  // framed early anyway.
+  uint64_t num_avoided_;
+  uint64_t num_mispredicted_;
+};
+
+#endif
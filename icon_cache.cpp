@@ -0,0 +1,222 @@
+#include "icon_cache.hpp"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <algorithm>
+#include <glog/logging.h>
+
+using ::std::fill;
+using ::std::max;
+using ::std::vector;
+
+namespace {
+
+// Chooses the icon to scale to a given size: the smallest icon at least as
+// large as the target, or failing that the largest icon. Returns nullptr if
+// there are no icons.
+const Icon* ChooseIcon(const vector<Icon>& icons, int size) {
+  const Icon* best = nullptr;
+  for (const Icon& icon : icons) {
+    const bool large_enough = icon.width >= size && icon.height >= size;
+    if (best == nullptr) {
+      best = &icon;
+      continue;
+    }
+    const bool best_large_enough = best->width >= size && best->height >= size;
+    const int area = icon.width * icon.height;
+    const int best_area = best->width * best->height;
+    if (large_enough ? (!best_large_enough || area < best_area)
+                     : (!best_large_enough && area > best_area)) {
+      best = &icon;
+    }
+  }
+  return best;
+}
+
+}  // namespace
+
+void PremultiplyPixels(const uint32_t* src, uint32_t* dest, size_t num_pixels) {
+  size_t i = 0;
+#ifdef __SSE2__
+  // Process 4 pixels at a time as 16-bit channels. The alpha channel is
+  // multiplied by 255 so that it is preserved by the division below.
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alpha_mask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+  const __m128i alpha_255 = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+  const __m128i round = _mm_set1_epi16(128);
+  for (; i + 4 <= num_pixels; i += 4) {
+    const __m128i pixels =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i halves[2] = {
+        _mm_unpacklo_epi8(pixels, zero),
+        _mm_unpackhi_epi8(pixels, zero),
+    };
+    for (__m128i& channels : halves) {
+      __m128i alpha = _mm_shufflehi_epi16(
+          _mm_shufflelo_epi16(channels, _MM_SHUFFLE(3, 3, 3, 3)),
+          _MM_SHUFFLE(3, 3, 3, 3));
+      alpha = _mm_or_si128(_mm_andnot_si128(alpha_mask, alpha), alpha_255);
+      // x * a / 255, rounded: t = x * a + 128; (t + (t >> 8)) >> 8.
+      const __m128i t = _mm_add_epi16(_mm_mullo_epi16(channels, alpha), round);
+      channels = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    }
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(dest + i),
+        _mm_packus_epi16(halves[0], halves[1]));
+  }
+#endif
+  for (; i < num_pixels; ++i) {
+    const uint32_t pixel = src[i];
+    const uint32_t alpha = pixel >> 24;
+    uint32_t result = alpha << 24;
+    for (int shift = 0; shift < 24; shift += 8) {
+      const uint32_t t = ((pixel >> shift) & 0xff) * alpha + 128;
+      result |= ((t + (t >> 8)) >> 8) << shift;
+    }
+    dest[i] = result;
+  }
+}
+
+void ScalePixels(
+    const uint32_t* src, int src_width, int src_height,
+    uint32_t* dest, int dest_width, int dest_height, int dest_stride) {
+  CHECK_GT(src_width, 0);
+  CHECK_GT(src_height, 0);
+  // 1. Compute the range of source columns covered by each destination
+  // column. Each range covers at least one source column.
+  vector<int> x_begin(dest_width), x_end(dest_width);
+  for (int x = 0; x < dest_width; ++x) {
+    x_begin[x] = static_cast<long>(x) * src_width / dest_width;
+    x_end[x] = max(
+        x_begin[x] + 1,
+        static_cast<int>(static_cast<long>(x + 1) * src_width / dest_width));
+  }
+
+  // 2. Average the source pixels covered by each destination pixel.
+  for (int y = 0; y < dest_height; ++y) {
+    const int y_begin = static_cast<long>(y) * src_height / dest_height;
+    const int y_end = max(
+        y_begin + 1,
+        static_cast<int>(static_cast<long>(y + 1) * src_height / dest_height));
+    for (int x = 0; x < dest_width; ++x) {
+      const int count = (y_end - y_begin) * (x_end[x] - x_begin[x]);
+#ifdef __SSE2__
+      // Accumulate all four channels of a pixel in parallel as 32-bit lanes,
+      // loading two pixels at a time where possible.
+      const __m128i zero = _mm_setzero_si128();
+      __m128i sum = zero;
+      for (int sy = y_begin; sy < y_end; ++sy) {
+        const uint32_t* row = src + static_cast<long>(sy) * src_width;
+        int sx = x_begin[x];
+        for (; sx + 2 <= x_end[x]; sx += 2) {
+          const __m128i channels = _mm_unpacklo_epi8(
+              _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + sx)),
+              zero);
+          sum = _mm_add_epi32(sum, _mm_unpacklo_epi16(channels, zero));
+          sum = _mm_add_epi32(sum, _mm_unpackhi_epi16(channels, zero));
+        }
+        if (sx < x_end[x]) {
+          const __m128i channels = _mm_unpacklo_epi8(
+              _mm_cvtsi32_si128(row[sx]), zero);
+          sum = _mm_add_epi32(sum, _mm_unpacklo_epi16(channels, zero));
+        }
+      }
+      const __m128 average = _mm_add_ps(
+          _mm_mul_ps(_mm_cvtepi32_ps(sum), _mm_set1_ps(1.0f / count)),
+          _mm_set1_ps(0.5f));
+      const __m128i result = _mm_cvttps_epi32(average);
+      dest[static_cast<long>(y) * dest_stride + x] = _mm_cvtsi128_si32(
+          _mm_packus_epi16(_mm_packs_epi32(result, zero), zero));
+#else
+      uint32_t sums[4] = {0, 0, 0, 0};
+      for (int sy = y_begin; sy < y_end; ++sy) {
+        const uint32_t* row = src + static_cast<long>(sy) * src_width;
+        for (int sx = x_begin[x]; sx < x_end[x]; ++sx) {
+          for (int c = 0; c < 4; ++c) {
+            sums[c] += (row[sx] >> (c * 8)) & 0xff;
+          }
+        }
+      }
+      uint32_t result = 0;
+      for (int c = 0; c < 4; ++c) {
+        result |= ((sums[c] + count / 2) / count) << (c * 8);
+      }
+      dest[static_cast<long>(y) * dest_stride + x] = result;
+#endif
+    }
+  }
+}
+
+IconCache::IconCache(int icon_size, size_t capacity_bytes)
+    : icon_size_(icon_size),
+      slot_pixels_(static_cast<size_t>(icon_size) * icon_size) {
+  CHECK_GT(icon_size, 0);
+  const size_t num_slots =
+      max<size_t>(1, capacity_bytes / (slot_pixels_ * sizeof(uint32_t)));
+  arena_.resize(num_slots * slot_pixels_);
+  free_slots_.reserve(num_slots);
+  for (size_t slot = num_slots; slot > 0; --slot) {
+    free_slots_.push_back(slot - 1);
+  }
+  LOG(INFO) << "Icon cache holds " << num_slots << " icons of size "
+            << icon_size << "x" << icon_size;
+}
+
+const uint32_t* IconCache::Get(Window w, const ClientProperties& properties) {
+  // 1. Return cached icon if available.
+  auto i = entries_.find(w);
+  if (i != entries_.end()) {
+    lru_.splice(lru_.begin(), lru_, i->second.lru_position);
+    return arena_.data() + i->second.slot * slot_pixels_;
+  }
+
+  // 2. Choose an icon to scale.
+  const Icon* icon = ChooseIcon(properties.icons, icon_size_);
+  if (icon == nullptr) {
+    return nullptr;
+  }
+
+  // 3. Premultiply and scale into a slot, preserving the aspect ratio and
+  // centering the icon.
+  const size_t slot = AllocateSlot();
+  uint32_t* const pixels = arena_.data() + slot * slot_pixels_;
+  fill(pixels, pixels + slot_pixels_, 0);
+  vector<uint32_t> premultiplied(icon->pixels.size());
+  PremultiplyPixels(
+      icon->pixels.data(), premultiplied.data(), premultiplied.size());
+  int width = icon_size_, height = icon_size_;
+  if (icon->width > icon->height) {
+    height = max(1, icon->height * icon_size_ / icon->width);
+  } else if (icon->height > icon->width) {
+    width = max(1, icon->width * icon_size_ / icon->height);
+  }
+  ScalePixels(
+      premultiplied.data(), icon->width, icon->height,
+      pixels + (icon_size_ - height) / 2 * icon_size_ + (icon_size_ - width) / 2,
+      width, height, icon_size_);
+
+  // 4. Record entry.
+  lru_.push_front(w);
+  entries_[w] = {slot, lru_.begin()};
+  return pixels;
+}
+
+void IconCache::Invalidate(Window w) {
+  auto i = entries_.find(w);
+  if (i == entries_.end()) {
+    return;
+  }
+  free_slots_.push_back(i->second.slot);
+  lru_.erase(i->second.lru_position);
+  entries_.erase(i);
+}
+
+size_t IconCache::AllocateSlot() {
+  if (free_slots_.empty()) {
+    CHECK(!lru_.empty());
+    Invalidate(lru_.back());
+  }
+  const size_t slot = free_slots_.back();
+  free_slots_.pop_back();
+  return slot;
+}
@@ -0,0 +1,77 @@
+#ifndef ICON_CACHE_HPP
+#define ICON_CACHE_HPP
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include "property_fetcher.hpp"
+
+// Caches client icons decoded from _NET_WM_ICON, premultiplied and scaled to a
+// fixed size, for UIs such as window switchers that show many icons at once.
+//
+// Icons are stored in fixed-size slots of a single contiguous arena whose size
+// is set at construction, so the cache never uses more than its capacity. When
+// the arena is full, the least recently used icon is evicted. Entries must be
+// invalidated when a client's _NET_WM_ICON changes.
+class IconCache {
+ public:
+  // Creates a cache of icons scaled to icon_size x icon_size, using at most
+  // capacity_bytes of pixel storage (but room for at least one icon).
+  IconCache(int icon_size, size_t capacity_bytes);
+
+  // Returns the premultiplied 0xAARRGGBB pixels of a client's icon, in
+  // row-major order with icon_size() pixels per row, scaling it from the
+  // client's properties if it isn't cached. Returns nullptr if the client has
+  // no icon. The returned pointer is valid until the next call to a non-const
+  // method.
+  const uint32_t* Get(Window w, const ClientProperties& properties);
+  // Drops a client's cached icon.
+  void Invalidate(Window w);
+
+  // Width and height of cached icons.
+  int icon_size() const { return icon_size_; }
+
+ private:
+  // A cached icon.
+  struct Entry {
+    // Index of the arena slot holding the icon.
+    size_t slot;
+    // Position in lru_.
+    ::std::list<Window>::iterator lru_position;
+  };
+
+  // Returns a free arena slot, evicting the least recently used icon if
+  // necessary.
+  size_t AllocateSlot();
+
+  // Width and height of cached icons.
+  const int icon_size_;
+  // Number of pixels in each slot.
+  const size_t slot_pixels_;
+  // Pixel storage for all slots.
+  ::std::vector<uint32_t> arena_;
+  // Indices of unused slots.
+  ::std::vector<size_t> free_slots_;
+  // Cached icons, keyed by client window.
+  ::std::unordered_map<Window, Entry> entries_;
+  // Cached client windows, from most to least recently used.
+  ::std::list<Window> lru_;
+};
+
+// Converts non-premultiplied 0xAARRGGBB pixels to premultiplied alpha.
+extern void PremultiplyPixels(
+    const uint32_t* src, uint32_t* dest, size_t num_pixels);
+
+// Scales premultiplied 0xAARRGGBB pixels with a box filter, so that each
+// destination pixel is the average of the source pixels it covers. Degrades
+// to nearest neighbor when enlarging.
+extern void ScalePixels(
+    const uint32_t* src, int src_width, int src_height,
+    uint32_t* dest, int dest_width, int dest_height, int dest_stride);
+
+#endif
@@ -1,19 +1,33 @@
 #include <cstdlib>
 #include <glog/logging.h>
+#include "async_logger.hpp"
+#include "config.hpp"
 #include "window_manager.hpp"
 
 using ::std::unique_ptr;
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
+  // Write the INFO log, which also receives all higher severities, on a
+  // background thread.
+  LOG_IF(WARNING, !AsyncLogger::Install(::google::INFO))
+      << "Writing logs synchronously";
+  // Client properties are fetched on a separate thread with its own X
+  // connection.
+  XInitThreads();
 
-  unique_ptr<WindowManager> window_manager = WindowManager::Create();
+  unique_ptr<WindowManager> window_manager = WindowManager::Create(
+      Config::FromEnvironment());
   if (!window_manager) {
     LOG(ERROR) << "Failed to initialize window manager.";
+    ::google::ShutdownGoogleLogging();
     return EXIT_FAILURE;
   }
 
   window_manager->Run();
 
+  // Write out queued log messages.
+  window_manager.reset();
+  ::google::ShutdownGoogleLogging();
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,170 @@
+#include "output_layout.hpp"
+extern "C" {
+#include <X11/extensions/Xrandr.h>
+}
+#include <algorithm>
+#include <glog/logging.h>
+
+using ::std::max;
+using ::std::min;
+using ::std::vector;
+
+namespace {
+
+// Returns whether two rectangles are identical.
+bool SameRect(const Rect<int>& a, const Rect<int>& b) {
+  return a.x == b.x && a.y == b.y && a.width == b.width &&
+         a.height == b.height;
+}
+
+}  // namespace
+
+long IntersectionArea(const Rect<int>& a, const Rect<int>& b) {
+  const long width = min(a.x + a.width, b.x + b.width) - max(a.x, b.x);
+  const long height = min(a.y + a.height, b.y + b.height) - max(a.y, b.y);
+  return (width > 0 && height > 0) ? width * height : 0;
+}
+
+Rect<int> ClampRect(const Rect<int>& rect, const Rect<int>& bounds) {
+  Rect<int> result = rect;
+  result.width = min(rect.width, bounds.width);
+  result.height = min(rect.height, bounds.height);
+  result.x = max(bounds.x, min(rect.x, bounds.x + bounds.width - result.width));
+  result.y = max(
+      bounds.y, min(rect.y, bounds.y + bounds.height - result.height));
+  return result;
+}
+
+int FindOutput(const vector<Rect<int>>& outputs, const Rect<int>& rect) {
+  int best = -1;
+  long best_area = 0;
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    const long area = IntersectionArea(rect, outputs[i]);
+    if (area > best_area) {
+      best = i;
+      best_area = area;
+    }
+  }
+  return best;
+}
+
+int FindOutput(const vector<Rect<int>>& outputs, const Position<int>& pos) {
+  int best = -1;
+  long best_distance = -1;
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    const Rect<int>& output = outputs[i];
+    // Distance along each axis from the point to the output, 0 if inside.
+    const long dx = max(
+        0, max(output.x - pos.x, pos.x - (output.x + output.width - 1)));
+    const long dy = max(
+        0, max(output.y - pos.y, pos.y - (output.y + output.height - 1)));
+    const long distance = dx * dx + dy * dy;
+    if (best_distance < 0 || distance < best_distance) {
+      best = i;
+      best_distance = distance;
+    }
+  }
+  return best;
+}
+
+OutputLayout::OutputLayout(Display* display)
+    : display_(CHECK_NOTNULL(display)),
+      root_(DefaultRootWindow(display_)),
+      randr_event_base_(-1),
+      changed_(false) {
+  int event_base, error_base, major = 0, minor = 0;
+  if (XRRQueryExtension(display_, &event_base, &error_base) &&
+      XRRQueryVersion(display_, &major, &minor) &&
+      (major > 1 || (major == 1 && minor >= 2))) {
+    randr_event_base_ = event_base;
+    XRRSelectInput(display_, root_, RRScreenChangeNotifyMask);
+  } else {
+    LOG(WARNING) << "XRandR 1.2 not available, assuming a single output";
+  }
+  Refresh();
+}
+
+bool OutputLayout::HandleEvent(XEvent* e) {
+  if (randr_event_base_ < 0 ||
+      e->type != randr_event_base_ + RRScreenChangeNotify) {
+    return false;
+  }
+  // A single hotplug usually produces several notifications. Let Xlib update
+  // its cached screen size from each, but query outputs only once, when the
+  // whole batch of events is handled. The main loop reads all pending events
+  // into its scheduler, so later notifications are never found still queued
+  // in Xlib.
+  XRRUpdateConfiguration(e);
+  changed_ = true;
+  return true;
+}
+
+bool OutputLayout::Update(vector<Rect<int>>* changed_outputs) {
+  if (!changed_) {
+    return false;
+  }
+  changed_ = false;
+  // Re-query outputs, and find the ones that changed or vanished.
+  const vector<Rect<int>> old_outputs = ::std::move(outputs_);
+  Refresh();
+  changed_outputs->clear();
+  for (const Rect<int>& old_output : old_outputs) {
+    if (!::std::any_of(outputs_.begin(), outputs_.end(),
+                       [&old_output] (const Rect<int>& output) {
+                         return SameRect(output, old_output);
+                       })) {
+      changed_outputs->push_back(old_output);
+    }
+  }
+  return true;
+}
+
+int OutputLayout::FindOutput(const Rect<int>& rect) const {
+  return ::FindOutput(outputs_, rect);
+}
+
+int OutputLayout::FindOutput(const Position<int>& pos) const {
+  return ::FindOutput(outputs_, pos);
+}
+
+void OutputLayout::Refresh() {
+  outputs_.clear();
+  if (randr_event_base_ >= 0) {
+    XRRScreenResources* resources =
+        XRRGetScreenResourcesCurrent(display_, root_);
+    if (resources != nullptr) {
+      const RROutput primary = XRRGetOutputPrimary(display_, root_);
+      for (int i = 0; i < resources->ncrtc; ++i) {
+        XRRCrtcInfo* crtc =
+            XRRGetCrtcInfo(display_, resources, resources->crtcs[i]);
+        if (crtc == nullptr) {
+          continue;
+        }
+        // Disabled CRTCs have no mode. CRTCs driving several outputs in
+        // clone mode are listed once.
+        if (crtc->mode != None && crtc->width > 0 && crtc->height > 0) {
+          const Rect<int> rect(crtc->x, crtc->y, crtc->width, crtc->height);
+          if (!::std::any_of(outputs_.begin(), outputs_.end(),
+                             [&rect] (const Rect<int>& output) {
+                               return SameRect(output, rect);
+                             })) {
+            const bool is_primary = ::std::find(
+                crtc->outputs, crtc->outputs + crtc->noutput, primary) !=
+                crtc->outputs + crtc->noutput;
+            outputs_.insert(
+                is_primary ? outputs_.begin() : outputs_.end(), rect);
+          }
+        }
+        XRRFreeCrtcInfo(crtc);
+      }
+      XRRFreeScreenResources(resources);
+    }
+  }
+  // Fall back to the whole screen.
+  if (outputs_.empty()) {
+    const int screen = DefaultScreen(display_);
+    outputs_.emplace_back(
+        0, 0, DisplayWidth(display_, screen), DisplayHeight(display_, screen));
+  }
+  LOG(INFO) << "Outputs: " << Join(outputs_, ", ");
+}
@@ -0,0 +1,70 @@
+#ifndef OUTPUT_LAYOUT_HPP
+#define OUTPUT_LAYOUT_HPP
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+#include <vector>
+#include "util.hpp"
+
+// Caches the rectangles of the screen's active outputs (monitors) using
+// XRandR, so that placement decisions need no round trips. The cache is only
+// refreshed after RRScreenChangeNotify, once per batch of events however many
+// notifications the batch has. Without XRandR 1.2, the whole screen is
+// treated as a single output.
+class OutputLayout {
+ public:
+  // Queries the current output layout and selects RandR events on the root
+  // window.
+  explicit OutputLayout(Display* display);
+
+  // Notes that the layout must be refreshed on RRScreenChangeNotify. Returns
+  // false if the event is not a RandR event.
+  bool HandleEvent(XEvent* e);
+  // Refreshes the layout if a RandR event was handled since the last call,
+  // and stores the previous outputs that no longer exist unchanged in
+  // changed_outputs. Returns false if the layout wasn't refreshed.
+  bool Update(::std::vector<Rect<int>>* changed_outputs);
+
+  // Active outputs, with the primary output first. Never empty.
+  const ::std::vector<Rect<int>>& outputs() const { return outputs_; }
+  // Returns the index of the output that overlaps a rectangle the most, or -1
+  // if it overlaps none.
+  int FindOutput(const Rect<int>& rect) const;
+  // Returns the index of the output containing a point, or failing that the
+  // nearest output.
+  int FindOutput(const Position<int>& pos) const;
+
+ private:
+  // Re-queries the output layout from the X server.
+  void Refresh();
+
+  // Handle to the underlying Xlib Display struct.
+  Display* const display_;
+  // Root window.
+  const Window root_;
+  // Event base of XRandR, or -1 if XRandR 1.2 is unavailable.
+  int randr_event_base_;
+  // Whether RRScreenChangeNotify was received since the last refresh.
+  bool changed_;
+  // Active outputs, with the primary output first.
+  ::std::vector<Rect<int>> outputs_;
+};
+
+// Returns the index of the output in a list that overlaps a rectangle the
+// most, or -1 if it overlaps none.
+extern int FindOutput(
+    const ::std::vector<Rect<int>>& outputs, const Rect<int>& rect);
+
+// Returns the index of the output in a list containing a point, or failing
+// that the nearest output, or -1 if the list is empty.
+extern int FindOutput(
+    const ::std::vector<Rect<int>>& outputs, const Position<int>& pos);
+
+// Returns the area of the intersection of two rectangles.
+extern long IntersectionArea(const Rect<int>& a, const Rect<int>& b);
+
+// Returns a rectangle moved, and if necessary shrunk, to fit within bounds.
+extern Rect<int> ClampRect(const Rect<int>& rect, const Rect<int>& bounds);
+
+#endif
@@ -0,0 +1,410 @@
+#include "property_fetcher.hpp"
+extern "C" {
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+}
+#include <algorithm>
+#include <set>
+#include <utility>
+#include <glog/logging.h>
+#include "util.hpp"
+
+using ::std::pair;
+using ::std::set;
+using ::std::string;
+using ::std::unique_ptr;
+using ::std::vector;
+
+namespace {
+
+// Maximum size of a _NET_WM_NAME or WM_WINDOW_ROLE to fetch, in 32-bit units.
+const long MAX_NAME_LENGTH = 1 << 12;
+// Maximum size of a _NET_WM_ICON to fetch, in 32-bit units.
+const long MAX_ICON_LENGTH = 1 << 22;
+// Maximum number of atoms in a _NET_WM_WINDOW_TYPE or _NET_WM_STATE to fetch.
+const long MAX_ATOM_LIST_LENGTH = 64;
+
+// Decodes the concatenated width, height and pixel arrays of a _NET_WM_ICON.
+// Format 32 properties are returned by Xlib as arrays of long.
+vector<Icon> DecodeIcons(const unsigned long* data, unsigned long num_items) {
+  vector<Icon> icons;
+  unsigned long i = 0;
+  while (num_items - i >= 2) {
+    const unsigned long width = data[i], height = data[i + 1];
+    i += 2;
+    if (width == 0 || height == 0 || width > 0xffff || height > 0xffff ||
+        width * height > num_items - i) {
+      LOG(WARNING) << "Ignoring malformed _NET_WM_ICON";
+      break;
+    }
+    Icon icon;
+    icon.width = width;
+    icon.height = height;
+    icon.pixels.assign(data + i, data + i + width * height);
+    icons.push_back(::std::move(icon));
+    i += width * height;
+  }
+  return icons;
+}
+
+}  // namespace
+
+ClientProperties::ClientProperties()
+    : accepts_input(true),
+      initial_state(NormalState),
+      urgent(false),
+      transient_for(None),
+      dock(false),
+      above(false),
+      supports_delete_window(false),
+      supports_ping(false) {
+}
+
+const string& ClientProperties::title() const {
+  return net_wm_name.empty() ? wm_name : net_wm_name;
+}
+
+void ClientProperties::Apply(PropertyUpdate&& update) {
+  switch (update.property) {
+    case ClientProperty::CLASS:
+      instance_name = ::std::move(update.instance_name);
+      class_name = ::std::move(update.class_name);
+      break;
+    case ClientProperty::NAME:
+      wm_name = ::std::move(update.name);
+      break;
+    case ClientProperty::NET_WM_NAME:
+      net_wm_name = ::std::move(update.name);
+      break;
+    case ClientProperty::HINTS:
+      accepts_input = update.accepts_input;
+      initial_state = update.initial_state;
+      urgent = update.urgent;
+      break;
+    case ClientProperty::NET_WM_ICON:
+      icons = ::std::move(update.icons);
+      break;
+    case ClientProperty::TRANSIENT_FOR:
+      transient_for = update.transient_for;
+      break;
+    case ClientProperty::NET_WM_WINDOW_TYPE:
+      dock = update.dock;
+      break;
+    case ClientProperty::NET_WM_STATE:
+      above = update.above;
+      break;
+    case ClientProperty::ROLE:
+      role = ::std::move(update.role);
+      break;
+    case ClientProperty::PROTOCOLS:
+      supports_delete_window = update.supports_delete_window;
+      supports_ping = update.supports_ping;
+      break;
+  }
+}
+
+unique_ptr<PropertyFetcher> PropertyFetcher::Create(const string& display_str) {
+  // 1. Open a dedicated X connection for the worker thread.
+  Display* display = XOpenDisplay(display_str.c_str());
+  if (display == nullptr) {
+    LOG(ERROR) << "Failed to open X display " << display_str
+               << " for property fetcher";
+    return nullptr;
+  }
+  // 2. Create eventfds for signalling between threads. The main loop polls
+  // the result eventfd, so it must not block.
+  const int request_fd = eventfd(0, EFD_CLOEXEC);
+  const int result_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (request_fd < 0 || result_fd < 0) {
+    PLOG(ERROR) << "Failed to create eventfd";
+    if (request_fd >= 0) {
+      close(request_fd);
+    }
+    if (result_fd >= 0) {
+      close(result_fd);
+    }
+    XCloseDisplay(display);
+    return nullptr;
+  }
+  return unique_ptr<PropertyFetcher>(
+      new PropertyFetcher(display, request_fd, result_fd));
+}
+
+PropertyFetcher::PropertyFetcher(
+    Display* display, int request_fd, int result_fd)
+    : display_(CHECK_NOTNULL(display)),
+      request_fd_(request_fd),
+      result_fd_(result_fd),
+      stop_(false),
+      UTF8_STRING(XInternAtom(display_, "UTF8_STRING", false)),
+      _NET_WM_NAME(XInternAtom(display_, "_NET_WM_NAME", false)),
+      _NET_WM_ICON(XInternAtom(display_, "_NET_WM_ICON", false)),
+      _NET_WM_WINDOW_TYPE(XInternAtom(display_, "_NET_WM_WINDOW_TYPE", false)),
+      _NET_WM_WINDOW_TYPE_DOCK(
+          XInternAtom(display_, "_NET_WM_WINDOW_TYPE_DOCK", false)),
+      _NET_WM_STATE(XInternAtom(display_, "_NET_WM_STATE", false)),
+      _NET_WM_STATE_ABOVE(
+          XInternAtom(display_, "_NET_WM_STATE_ABOVE", false)),
+      WM_WINDOW_ROLE(XInternAtom(display_, "WM_WINDOW_ROLE", false)),
+      WM_PROTOCOLS(XInternAtom(display_, "WM_PROTOCOLS", false)),
+      WM_DELETE_WINDOW(XInternAtom(display_, "WM_DELETE_WINDOW", false)),
+      _NET_WM_PING(XInternAtom(display_, "_NET_WM_PING", false)) {
+  // The worker is started last, once all members are initialized.
+  worker_ = ::std::thread(&PropertyFetcher::Work, this);
+}
+
+PropertyFetcher::~PropertyFetcher() {
+  stop_ = true;
+  SignalEventFd(request_fd_);
+  worker_.join();
+  close(request_fd_);
+  close(result_fd_);
+  XCloseDisplay(display_);
+}
+
+void PropertyFetcher::Fetch(Window w, ClientProperty property) {
+  requests_.Push({w, property});
+  SignalEventFd(request_fd_);
+}
+
+void PropertyFetcher::FetchAll(Window w) {
+  for (ClientProperty property : {
+           ClientProperty::CLASS,
+           ClientProperty::NAME,
+           ClientProperty::NET_WM_NAME,
+           ClientProperty::HINTS,
+           ClientProperty::NET_WM_ICON,
+           ClientProperty::TRANSIENT_FOR,
+           ClientProperty::NET_WM_WINDOW_TYPE,
+           ClientProperty::NET_WM_STATE,
+           ClientProperty::ROLE,
+           ClientProperty::PROTOCOLS}) {
+    requests_.Push({w, property});
+  }
+  SignalEventFd(request_fd_);
+}
+
+void PropertyFetcher::OnPropertyNotify(const XPropertyEvent& e) {
+  // Atoms are global to the X server, so atoms interned on our connection can
+  // be compared against events from the main connection.
+  if (e.atom == XA_WM_CLASS) {
+    Fetch(e.window, ClientProperty::CLASS);
+  } else if (e.atom == XA_WM_NAME) {
+    Fetch(e.window, ClientProperty::NAME);
+  } else if (e.atom == _NET_WM_NAME) {
+    Fetch(e.window, ClientProperty::NET_WM_NAME);
+  } else if (e.atom == XA_WM_HINTS) {
+    Fetch(e.window, ClientProperty::HINTS);
+  } else if (e.atom == _NET_WM_ICON) {
+    Fetch(e.window, ClientProperty::NET_WM_ICON);
+  } else if (e.atom == XA_WM_TRANSIENT_FOR) {
+    Fetch(e.window, ClientProperty::TRANSIENT_FOR);
+  } else if (e.atom == _NET_WM_WINDOW_TYPE) {
+    Fetch(e.window, ClientProperty::NET_WM_WINDOW_TYPE);
+  } else if (e.atom == _NET_WM_STATE) {
+    Fetch(e.window, ClientProperty::NET_WM_STATE);
+  } else if (e.atom == WM_WINDOW_ROLE) {
+    Fetch(e.window, ClientProperty::ROLE);
+  } else if (e.atom == WM_PROTOCOLS) {
+    Fetch(e.window, ClientProperty::PROTOCOLS);
+  }
+}
+
+bool PropertyFetcher::PopUpdate(PropertyUpdate* update) {
+  if (!results_.Pop(update)) {
+    // Reset the eventfd before checking again, so that results pushed in
+    // between aren't missed.
+    DrainEventFd(result_fd_);
+    return results_.Pop(update);
+  }
+  return true;
+}
+
+void PropertyFetcher::Work() {
+  for (;;) {
+    // 1. Wait for requests.
+    DrainEventFd(request_fd_);
+    if (stop_) {
+      return;
+    }
+    // 2. Collect all pending requests, dropping duplicates.
+    vector<Request> requests;
+    set<pair<Window, ClientProperty>> seen;
+    Request request;
+    while (requests_.Pop(&request)) {
+      if (seen.emplace(request.window, request.property).second) {
+        requests.push_back(request);
+      }
+    }
+    // 3. Fetch properties and hand results to the main thread.
+    for (const Request& r : requests) {
+      results_.Push(FetchProperty(r));
+    }
+    if (!requests.empty()) {
+      SignalEventFd(result_fd_);
+    }
+  }
+}
+
+PropertyUpdate PropertyFetcher::FetchProperty(const Request& request) {
+  PropertyUpdate update;
+  update.window = request.window;
+  update.property = request.property;
+  update.accepts_input = true;
+  update.initial_state = NormalState;
+  update.urgent = false;
+  update.transient_for = None;
+  update.dock = false;
+  update.above = false;
+  update.supports_delete_window = false;
+  update.supports_ping = false;
+
+  switch (request.property) {
+    case ClientProperty::CLASS: {
+      XClassHint class_hint;
+      if (XGetClassHint(display_, request.window, &class_hint)) {
+        update.instance_name = class_hint.res_name ? class_hint.res_name : "";
+        update.class_name = class_hint.res_class ? class_hint.res_class : "";
+        XFree(class_hint.res_name);
+        XFree(class_hint.res_class);
+      }
+      break;
+    }
+    case ClientProperty::NAME: {
+      XTextProperty text_property;
+      if (!XGetWMName(display_, request.window, &text_property)) {
+        break;
+      }
+      char** list;
+      int count;
+      if (Xutf8TextPropertyToTextList(
+              display_, &text_property, &list, &count) >= Success) {
+        for (int i = 0; i < count; ++i) {
+          update.name += list[i];
+        }
+        XFreeStringList(list);
+      }
+      XFree(text_property.value);
+      break;
+    }
+    case ClientProperty::NET_WM_NAME:
+    case ClientProperty::NET_WM_ICON: {
+      const bool is_name = request.property == ClientProperty::NET_WM_NAME;
+      Atom type;
+      int format;
+      unsigned long num_items, bytes_after;
+      unsigned char* data = nullptr;
+      if (XGetWindowProperty(
+              display_,
+              request.window,
+              is_name ? _NET_WM_NAME : _NET_WM_ICON,
+              0, is_name ? MAX_NAME_LENGTH : MAX_ICON_LENGTH,
+              false,
+              is_name ? UTF8_STRING : XA_CARDINAL,
+              &type, &format, &num_items, &bytes_after,
+              &data) != Success) {
+        break;
+      }
+      if (is_name && type == UTF8_STRING && format == 8) {
+        update.name.assign(reinterpret_cast<char*>(data), num_items);
+      } else if (!is_name && type == XA_CARDINAL && format == 32) {
+        update.icons = DecodeIcons(
+            reinterpret_cast<unsigned long*>(data), num_items);
+      }
+      XFree(data);
+      break;
+    }
+    case ClientProperty::HINTS: {
+      XWMHints* hints = XGetWMHints(display_, request.window);
+      if (hints == nullptr) {
+        break;
+      }
+      if (hints->flags & InputHint) {
+        update.accepts_input = hints->input;
+      }
+      if (hints->flags & StateHint) {
+        update.initial_state = hints->initial_state;
+      }
+      update.urgent = hints->flags & XUrgencyHint;
+      XFree(hints);
+      break;
+    }
+    case ClientProperty::TRANSIENT_FOR: {
+      Window transient_for;
+      if (XGetTransientForHint(display_, request.window, &transient_for)) {
+        update.transient_for = transient_for;
+      }
+      break;
+    }
+    case ClientProperty::NET_WM_WINDOW_TYPE:
+    case ClientProperty::NET_WM_STATE: {
+      const bool is_type =
+          request.property == ClientProperty::NET_WM_WINDOW_TYPE;
+      Atom type;
+      int format;
+      unsigned long num_items, bytes_after;
+      unsigned char* data = nullptr;
+      if (XGetWindowProperty(
+              display_,
+              request.window,
+              is_type ? _NET_WM_WINDOW_TYPE : _NET_WM_STATE,
+              0, MAX_ATOM_LIST_LENGTH,
+              false,
+              XA_ATOM,
+              &type, &format, &num_items, &bytes_after,
+              &data) != Success) {
+        break;
+      }
+      if (type == XA_ATOM && format == 32) {
+        const Atom* const atoms = reinterpret_cast<Atom*>(data);
+        const bool found =
+            ::std::find(atoms, atoms + num_items,
+                        is_type ? _NET_WM_WINDOW_TYPE_DOCK
+                                : _NET_WM_STATE_ABOVE) !=
+            atoms + num_items;
+        (is_type ? update.dock : update.above) = found;
+      }
+      XFree(data);
+      break;
+    }
+    case ClientProperty::ROLE: {
+      Atom type;
+      int format;
+      unsigned long num_items, bytes_after;
+      unsigned char* data = nullptr;
+      if (XGetWindowProperty(
+              display_,
+              request.window,
+              WM_WINDOW_ROLE,
+              0, MAX_NAME_LENGTH,
+              false,
+              XA_STRING,
+              &type, &format, &num_items, &bytes_after,
+              &data) != Success) {
+        break;
+      }
+      if (type == XA_STRING && format == 8) {
+        update.role.assign(reinterpret_cast<char*>(data), num_items);
+      }
+      XFree(data);
+      break;
+    }
+    case ClientProperty::PROTOCOLS: {
+      Atom* protocols;
+      int num_protocols;
+      if (!XGetWMProtocols(
+              display_, request.window, &protocols, &num_protocols)) {
+        break;
+      }
+      Atom* const end = protocols + num_protocols;
+      update.supports_delete_window =
+          ::std::find(protocols, end, WM_DELETE_WINDOW) != end;
+      update.supports_ping = ::std::find(protocols, end, _NET_WM_PING) != end;
+      XFree(protocols);
+      break;
+    }
+  }
+  return update;
+}
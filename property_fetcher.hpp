@@ -0,0 +1,175 @@
+#ifndef PROPERTY_FETCHER_HPP
+#define PROPERTY_FETCHER_HPP
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "spsc_queue.hpp"
+
+// Client window properties fetched by PropertyFetcher.
+enum class ClientProperty {
+  // WM_CLASS.
+  CLASS,
+  // WM_NAME.
+  NAME,
+  // _NET_WM_NAME.
+  NET_WM_NAME,
+  // WM_HINTS.
+  HINTS,
+  // _NET_WM_ICON.
+  NET_WM_ICON,
+  // WM_TRANSIENT_FOR.
+  TRANSIENT_FOR,
+  // _NET_WM_WINDOW_TYPE.
+  NET_WM_WINDOW_TYPE,
+  // _NET_WM_STATE.
+  NET_WM_STATE,
+  // WM_WINDOW_ROLE.
+  ROLE,
+  // WM_PROTOCOLS.
+  PROTOCOLS,
+};
+
+// An image from a client's _NET_WM_ICON.
+struct Icon {
+  int width, height;
+  // Pixels in row-major order, as non-premultiplied 0xAARRGGBB.
+  ::std::vector<uint32_t> pixels;
+};
+
+// The result of fetching a single client window property.
+struct PropertyUpdate {
+  Window window;
+  ClientProperty property;
+  // Decoded value. Only the fields corresponding to property are set; if the
+  // property doesn't exist, they are left empty.
+  ::std::string instance_name;
+  ::std::string class_name;
+  ::std::string name;
+  bool accepts_input;
+  int initial_state;
+  bool urgent;
+  ::std::vector<Icon> icons;
+  Window transient_for;
+  bool dock;
+  bool above;
+  ::std::string role;
+  bool supports_delete_window;
+  bool supports_ping;
+};
+
+// Decoded properties of a client window, assembled from PropertyUpdates.
+struct ClientProperties {
+  // WM_CLASS.
+  ::std::string instance_name;
+  ::std::string class_name;
+  // WM_NAME and _NET_WM_NAME.
+  ::std::string wm_name;
+  ::std::string net_wm_name;
+  // WM_HINTS.
+  bool accepts_input;
+  int initial_state;
+  bool urgent;
+  // _NET_WM_ICON, in the order provided by the client.
+  ::std::vector<Icon> icons;
+  // WM_TRANSIENT_FOR, or None.
+  Window transient_for;
+  // Whether _NET_WM_WINDOW_TYPE includes _NET_WM_WINDOW_TYPE_DOCK.
+  bool dock;
+  // Whether _NET_WM_STATE includes _NET_WM_STATE_ABOVE.
+  bool above;
+  // WM_WINDOW_ROLE.
+  ::std::string role;
+  // Whether WM_PROTOCOLS includes WM_DELETE_WINDOW and _NET_WM_PING.
+  bool supports_delete_window;
+  bool supports_ping;
+
+  ClientProperties();
+
+  // Returns the window title, preferring _NET_WM_NAME over WM_NAME.
+  const ::std::string& title() const;
+  // Applies an update for the same window.
+  void Apply(PropertyUpdate&& update);
+};
+
+// Fetches and decodes client window properties on a worker thread with its own
+// X connection, so that large properties such as _NET_WM_ICON never stall the
+// main event loop.
+//
+// The main loop requests fetches with Fetch() and FetchAll(), polls
+// result_fd(), and collects decoded results with PopUpdate(). Requests and
+// results are passed through lock-free queues; duplicate requests that pile up
+// while the worker is busy are fetched only once.
+class PropertyFetcher {
+ public:
+  // Creates a PropertyFetcher with its own connection to the named display.
+  // On failure, returns nullptr.
+  static ::std::unique_ptr<PropertyFetcher> Create(
+      const ::std::string& display_str);
+
+  ~PropertyFetcher();
+
+  // Requests that a property of a window be fetched.
+  void Fetch(Window w, ClientProperty property);
+  // Requests that all properties of a window be fetched.
+  void FetchAll(Window w);
+  // Requests a re-fetch of the property changed by a PropertyNotify event,
+  // if it is one we fetch.
+  void OnPropertyNotify(const XPropertyEvent& e);
+
+  // File descriptor that becomes readable when updates are available.
+  int result_fd() const { return result_fd_; }
+  // Removes the next available update into update. Returns false if there are
+  // no more updates.
+  bool PopUpdate(PropertyUpdate* update);
+
+ private:
+  // A fetch request from the main thread.
+  struct Request {
+    Window window;
+    ClientProperty property;
+  };
+
+  // Invoked internally by Create().
+  PropertyFetcher(Display* display, int request_fd, int result_fd);
+  // Entry point of the worker thread.
+  void Work();
+  // Fetches and decodes a property on the worker thread.
+  PropertyUpdate FetchProperty(const Request& request);
+
+  // The worker thread's own connection to the X server.
+  Display* const display_;
+  // eventfd signalled when requests are pushed.
+  const int request_fd_;
+  // eventfd signalled when results are pushed.
+  const int result_fd_;
+  // Requests from the main thread to the worker.
+  SpscQueue<Request> requests_;
+  // Results from the worker to the main thread.
+  SpscQueue<PropertyUpdate> results_;
+  // Set to make the worker exit.
+  ::std::atomic<bool> stop_;
+  // The worker thread.
+  ::std::thread worker_;
+
+  // Atom constants.
+  const Atom UTF8_STRING;
+  const Atom _NET_WM_NAME;
+  const Atom _NET_WM_ICON;
+  const Atom _NET_WM_WINDOW_TYPE;
+  const Atom _NET_WM_WINDOW_TYPE_DOCK;
+  const Atom _NET_WM_STATE;
+  const Atom _NET_WM_STATE_ABOVE;
+  const Atom WM_WINDOW_ROLE;
+  const Atom WM_PROTOCOLS;
+  const Atom WM_DELETE_WINDOW;
+  const Atom _NET_WM_PING;
+};
+
+#endif
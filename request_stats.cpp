@@ -0,0 +1,121 @@
+#include "request_stats.hpp"
+#include <algorithm>
+#include <sstream>
+#include <glog/logging.h>
+// Xlibint.h exposes Xlib's output buffer. It defines min and max macros that
+// break the C++ standard library, so it must come last.
+extern "C" {
+#include <X11/Xlibint.h>
+}
+#undef min
+#undef max
+
+using ::std::max;
+using ::std::ostringstream;
+using ::std::string;
+
+RequestStats* RequestStats::instance_ = nullptr;
+
+RequestStats::Scope::Scope(
+    RequestStats* stats, const char* name, const Budget* budget)
+    : stats_(stats),
+      name_(name),
+      budget_(budget) {
+  if (stats_ != nullptr) {
+    start_ = stats_->GetCounts();
+  }
+}
+
+RequestStats::Scope::~Scope() {
+  if (stats_ == nullptr) {
+    return;
+  }
+  const Counts end = stats_->GetCounts();
+  stats_->Record(name_, budget_, Counts{
+      end.requests - start_.requests,
+      end.bytes - start_.bytes,
+      end.round_trips - start_.round_trips});
+}
+
+RequestStats::RequestStats(Display* display)
+    : display_(CHECK_NOTNULL(display)),
+      previous_after_function_(
+          XSetAfterFunction(display_, &RequestStats::OnAfterRequest)),
+      first_request_(NextRequest(display_)),
+      bytes_(0),
+      round_trips_(0),
+      last_request_(first_request_ - 1),
+      buffer_used_(display_->bufptr - display_->buffer) {
+  CHECK(instance_ == nullptr);
+  instance_ = this;
+}
+
+RequestStats::~RequestStats() {
+  XSetAfterFunction(display_, previous_after_function_);
+  instance_ = nullptr;
+}
+
+string RequestStats::ToString() const {
+  ostringstream out;
+  for (const auto& i : totals_) {
+    const Totals& totals = i.second;
+    out << i.first << " " << totals.invocations
+        << " requests " << totals.total.requests << " " << totals.max.requests
+        << " bytes " << totals.total.bytes << " " << totals.max.bytes
+        << " round_trips " << totals.total.round_trips << " "
+        << totals.max.round_trips
+        << " over_budget " << totals.over_budget << "\n";
+  }
+  return out.str();
+}
+
+RequestStats::Counts RequestStats::GetCounts() {
+  return Counts{NextRequest(display_) - first_request_, bytes_, round_trips_};
+}
+
+void RequestStats::Record(
+    const char* name, const Budget* budget, const Counts& counts) {
+  // 1. Update totals.
+  Totals& totals = totals_[name];
+  ++totals.invocations;
+  totals.total.requests += counts.requests;
+  totals.total.bytes += counts.bytes;
+  totals.total.round_trips += counts.round_trips;
+  totals.max.requests = max(totals.max.requests, counts.requests);
+  totals.max.bytes = max(totals.max.bytes, counts.bytes);
+  totals.max.round_trips = max(totals.max.round_trips, counts.round_trips);
+  // 2. Check budget.
+  if (budget != nullptr &&
+      (counts.requests > budget->requests ||
+       counts.round_trips > budget->round_trips)) {
+    ++totals.over_budget;
+    LOG(ERROR) << name << " exceeded its budget: " << counts.requests
+               << " requests (budget " << budget->requests << "), "
+               << counts.round_trips << " round trips (budget "
+               << budget->round_trips << ")";
+  }
+}
+
+int RequestStats::OnAfterRequest(Display* display) {
+  RequestStats* const stats = instance_;
+  CHECK_NOTNULL(stats);
+  // 1. Count the bytes added to the output buffer. If the buffer was flushed
+  // since the last request, everything in it is new.
+  const long buffer_used = display->bufptr - display->buffer;
+  stats->bytes_ += buffer_used >= stats->buffer_used_
+      ? buffer_used - stats->buffer_used_
+      : buffer_used;
+  stats->buffer_used_ = buffer_used;
+  // 2. If a new request was issued and the server has already processed it,
+  // Xlib waited for its reply.
+  const unsigned long request = NextRequest(display) - 1;
+  if (request != stats->last_request_ &&
+      LastKnownRequestProcessed(display) >= request) {
+    ++stats->round_trips_;
+  }
+  stats->last_request_ = request;
+  // 3. Chain to any previously installed after function.
+  return stats->previous_after_function_ != nullptr
+      ? stats->previous_after_function_(display)
+      : 0;
+}
@@ -0,0 +1,99 @@
+#ifndef REQUEST_STATS_HPP
+#define REQUEST_STATS_HPP
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+#include <map>
+#include <string>
+
+// Accounts for the X requests issued on a display, attributing them to named
+// operations such as event handlers.
+//
+// Requests are counted from sequence numbers. Round trips are detected with an
+// Xlib after function, which runs at the end of every Xlib request: if the
+// request just issued has already been processed by the server, Xlib must have
+// blocked waiting for its reply. Bytes are counted from the growth of Xlib's
+// output buffer, so bulk data that Xlib sends without buffering, such as image
+// payloads, is not included.
+//
+// Operations may declare a budget of requests and round trips. Exceeding it is
+// logged as an error and counted, so that accidental round trips show up as
+// soon as they are introduced.
+class RequestStats {
+ public:
+  // Resource usage of one or more operations.
+  struct Counts {
+    unsigned long requests;
+    unsigned long bytes;
+    unsigned long round_trips;
+  };
+  // Maximum resource usage of a single operation.
+  struct Budget {
+    unsigned long requests;
+    unsigned long round_trips;
+  };
+
+  // Measures a single operation for as long as it is in scope. Scopes may be
+  // nested, in which case the outer operation includes the inner one.
+  class Scope {
+   public:
+    // Starts measuring an operation. stats may be nullptr, in which case
+    // nothing is measured. budget may be nullptr if the operation has none.
+    Scope(RequestStats* stats, const char* name, const Budget* budget = nullptr);
+    ~Scope();
+
+   private:
+    RequestStats* const stats_;
+    const char* const name_;
+    const Budget* const budget_;
+    // Counts at the start of the operation.
+    Counts start_;
+  };
+
+  // Starts accounting for requests on a display. Only one instance may exist
+  // at a time, as Xlib after functions don't take a context.
+  explicit RequestStats(Display* display);
+  ~RequestStats();
+
+  // Returns a line per operation with its number of invocations, total and
+  // maximum counts, and number of budget violations.
+  ::std::string ToString() const;
+
+ private:
+  // Totals of an operation.
+  struct Totals {
+    unsigned long invocations;
+    Counts total;
+    Counts max;
+    unsigned long over_budget;
+  };
+
+  // Returns the counts accumulated so far.
+  Counts GetCounts();
+  // Records a completed operation.
+  void Record(const char* name, const Budget* budget, const Counts& counts);
+  // Xlib after function. It must be static as its address is passed to Xlib.
+  static int OnAfterRequest(Display* display);
+
+  // The active instance, for OnAfterRequest.
+  static RequestStats* instance_;
+
+  // Handle to the underlying Xlib Display struct.
+  Display* const display_;
+  // After function previously installed on the display.
+  int (*const previous_after_function_)(Display*);
+  // Sequence number of the first request accounted for.
+  const unsigned long first_request_;
+  // Bytes and round trips accumulated so far.
+  unsigned long bytes_;
+  unsigned long round_trips_;
+  // Sequence number of the last request seen by OnAfterRequest.
+  unsigned long last_request_;
+  // Fill level of Xlib's output buffer after the last request.
+  long buffer_used_;
+  // Totals per operation name.
+  ::std::map<::std::string, Totals> totals_;
+};
+
+#endif
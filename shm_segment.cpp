@@ -0,0 +1,120 @@
+#include "shm_segment.hpp"
+extern "C" {
+#include <X11/Xlibint.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/shmproto.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+}
+// Xlibint.h defines these as macros.
+#undef min
+#undef max
+#include <glog/logging.h>
+
+using ::std::unique_ptr;
+
+namespace {
+
+// Set by OnAttachError() if attaching a segment failed. Only accessed by the
+// thread attaching a segment, which is the one handling its display's errors.
+bool attach_failed;
+
+// Extension error handler of the display attaching a segment, which sees its
+// errors before the process-wide XErrorHandler. Records and swallows a failure
+// of XShmAttach(), and leaves other errors to the XErrorHandler.
+int OnAttachError(
+    Display* display, xError* error, XExtCodes* codes, int* ret_code) {
+  if (error->majorCode != codes->major_opcode ||
+      error->minorCode != X_ShmAttach) {
+    return 0;
+  }
+  attach_failed = true;
+  *ret_code = 0;
+  return 1;
+}
+
+}  // namespace
+
+unique_ptr<ShmSegment> ShmSegment::Create(Display* display, size_t size) {
+  if (!XShmQueryExtension(display)) {
+    return nullptr;
+  }
+  // 1. Create shared memory segment.
+  XShmSegmentInfo info;
+  info.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+  if (info.shmid < 0) {
+    PLOG(WARNING) << "Failed to create shared memory segment";
+    return nullptr;
+  }
+  info.shmaddr = static_cast<char*>(shmat(info.shmid, nullptr, 0));
+  info.readOnly = false;
+  // 2. Mark segment for removal once both sides have detached, so that it
+  // doesn't outlive us.
+  shmctl(info.shmid, IPC_RMID, nullptr);
+  if (info.shmaddr == reinterpret_cast<char*>(-1)) {
+    PLOG(WARNING) << "Failed to attach shared memory segment";
+    return nullptr;
+  }
+  // 3. Attach segment to X server. This fails with an X error rather than a
+  // return value if the server can't access our memory. The error is caught
+  // on this display alone, as swapping the process-wide XErrorHandler would
+  // also catch errors of other threads' connections.
+  XExtCodes* const codes = XInitExtension(display, SHMNAME);
+  if (codes == nullptr) {
+    shmdt(info.shmaddr);
+    return nullptr;
+  }
+  attach_failed = false;
+  XESetError(display, codes->extension, &OnAttachError);
+  XShmAttach(display, &info);
+  XSync(display, false);
+  XESetError(display, codes->extension, nullptr);
+  if (attach_failed) {
+    shmdt(info.shmaddr);
+    return nullptr;
+  }
+  return unique_ptr<ShmSegment>(new ShmSegment(display, info, size));
+}
+
+ShmSegment::ShmSegment(
+    Display* display, const XShmSegmentInfo& info, size_t size)
+    : display_(CHECK_NOTNULL(display)),
+      info_(info),
+      size_(size) {
+}
+
+ShmSegment::~ShmSegment() {
+  XShmDetach(display_, &info_);
+  XSync(display_, false);
+  shmdt(info_.shmaddr);
+}
+
+XImage* ShmSegment::CreateImage(
+    Visual* visual, int depth, int width, int height, size_t offset) {
+  if (offset >= size_) {
+    return nullptr;
+  }
+  XImage* image = XShmCreateImage(
+      display_,
+      visual,
+      depth,
+      ZPixmap,
+      info_.shmaddr + offset,
+      &info_,
+      width,
+      height);
+  if (image == nullptr) {
+    return nullptr;
+  }
+  if (static_cast<size_t>(image->bytes_per_line) * height > size_ - offset) {
+    DestroyImage(image);
+    return nullptr;
+  }
+  return image;
+}
+
+void ShmSegment::DestroyImage(XImage* image) {
+  // The pixel data belongs to the segment.
+  image->data = nullptr;
+  XDestroyImage(image);
+}
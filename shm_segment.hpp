@@ -0,0 +1,42 @@
+#ifndef SHM_SEGMENT_HPP
+#define SHM_SEGMENT_HPP
+
+extern "C" {
+#include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
+}
+#include <cstddef>
+#include <memory>
+
+// A MIT-SHM shared memory segment attached to the X server, for transferring
+// images without copying them through the X connection.
+class ShmSegment {
+ public:
+  // Creates and attaches a segment of the given size in bytes. Returns nullptr
+  // if MIT-SHM is unavailable, e.g. because the X server is remote.
+  static ::std::unique_ptr<ShmSegment> Create(Display* display, size_t size);
+
+  ~ShmSegment();
+
+  // Creates a ZPixmap XImage of the given size backed by the segment from the
+  // given byte offset, for use with XShmPutImage() and XShmGetImage(). Returns
+  // nullptr if the image doesn't fit. The image must be freed with
+  // DestroyImage().
+  XImage* CreateImage(
+      Visual* visual, int depth, int width, int height, size_t offset = 0);
+  // Frees an image created by CreateImage(), leaving the segment intact.
+  static void DestroyImage(XImage* image);
+
+ private:
+  // Invoked internally by Create().
+  ShmSegment(Display* display, const XShmSegmentInfo& info, size_t size);
+
+  // Handle to the underlying Xlib Display struct.
+  Display* const display_;
+  // The attached segment.
+  XShmSegmentInfo info_;
+  // Size of the segment in bytes.
+  const size_t size_;
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <utility>
+
+// An unbounded, lock-free queue for passing values from exactly one producer
+// thread to exactly one consumer thread.
+//
+// The queue is a singly linked list that always contains a dummy head node.
+// The producer only touches tail_ and the consumer only touches head_, and the
+// two threads synchronize solely through the atomic next pointers. T must be
+// default constructible and movable.
+template <typename T>
+class SpscQueue {
+ public:
+  SpscQueue();
+  ~SpscQueue();
+
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator = (const SpscQueue&) = delete;
+
+  // Appends a value to the queue. Must only be called by the producer thread.
+  void Push(T value);
+  // Removes the value at the front of the queue into value. Returns false if
+  // the queue is empty. Must only be called by the consumer thread.
+  bool Pop(T* value);
+
+ private:
+  struct Node {
+    ::std::atomic<Node*> next;
+    T value;
+
+    Node()
+        : next(nullptr) {
+    }
+  };
+
+  // Dummy node preceding the front of the queue. Owned by the consumer.
+  Node* head_;
+  // Last node in the queue. Owned by the producer.
+  Node* tail_;
+};
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                               IMPLEMENTATION                              *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+template <typename T>
+SpscQueue<T>::SpscQueue()
+    : head_(new Node()),
+      tail_(head_) {
+}
+
+template <typename T>
+SpscQueue<T>::~SpscQueue() {
+  while (head_ != nullptr) {
+    Node* next = head_->next.load(::std::memory_order_relaxed);
+    delete head_;
+    head_ = next;
+  }
+}
+
+template <typename T>
+void SpscQueue<T>::Push(T value) {
+  Node* node = new Node();
+  node->value = ::std::move(value);
+  // Publishing the node with release semantics makes its value visible to the
+  // consumer once it observes the new next pointer.
+  tail_->next.store(node, ::std::memory_order_release);
+  tail_ = node;
+}
+
+template <typename T>
+bool SpscQueue<T>::Pop(T* value) {
+  Node* next = head_->next.load(::std::memory_order_acquire);
+  if (next == nullptr) {
+    return false;
+  }
+  *value = ::std::move(next->value);
+  delete head_;
+  head_ = next;
+  return true;
+}
+
+#endif
@@ -0,0 +1,253 @@
+#include "stacking_order.hpp"
+extern "C" {
+#include <X11/Xatom.h>
+}
+#include <algorithm>
+#include <utility>
+#include <glog/logging.h>
+
+using ::std::pair;
+using ::std::vector;
+
+StackingOrder::StackingOrder(Display* display)
+    : display_(CHECK_NOTNULL(display)),
+      root_(DefaultRootWindow(display_)),
+      clients_changed_(true),
+      _NET_CLIENT_LIST_STACKING(
+          XInternAtom(display_, "_NET_CLIENT_LIST_STACKING", false)) {
+}
+
+void StackingOrder::Add(Window w, Window frame) {
+  positions_[w] = entries_.size();
+  entries_.push_back({w, frame, StackingLayer::NORMAL, None, false});
+  stacked_frames_.insert(stacked_frames_.begin(), frame);
+  MoveGroup(w, true);
+}
+
+void StackingOrder::Remove(Window w) {
+  const size_t i = Find(w);
+  stacked_frames_.erase(::std::find(
+      stacked_frames_.begin(), stacked_frames_.end(), entries_[i].frame));
+  entries_.erase(entries_.begin() + i);
+  positions_.erase(w);
+  UpdatePositions();
+  // Transients of the removed client become leaders of their own groups, and
+  // may belong to a different layer.
+  vector<size_t> leaders;
+  vector<int> depths;
+  GetGroups(&leaders, &depths);
+  vector<pair<StackingLayer, Entry>> sorted;
+  for (size_t j = 0; j < entries_.size(); ++j) {
+    sorted.emplace_back(entries_[leaders[j]].layer, entries_[j]);
+  }
+  ::std::stable_sort(
+      sorted.begin(), sorted.end(),
+      [] (const pair<StackingLayer, Entry>& a,
+          const pair<StackingLayer, Entry>& b) {
+        return a.first < b.first;
+      });
+  for (size_t j = 0; j < sorted.size(); ++j) {
+    entries_[j] = sorted[j].second;
+  }
+  UpdatePositions();
+  UpdateClients();
+}
+
+void StackingOrder::SetLayer(Window w, StackingLayer layer) {
+  Entry& entry = entries_[Find(w)];
+  if (entry.layer != layer) {
+    entry.layer = layer;
+    MoveGroup(w, true);
+  }
+}
+
+void StackingOrder::SetTransientFor(Window w, Window transient_for) {
+  Entry& entry = entries_[Find(w)];
+  if (entry.transient_for != transient_for) {
+    entry.transient_for = transient_for == w ? None : transient_for;
+    MoveGroup(w, true);
+  }
+}
+
+void StackingOrder::SetHidden(Window w, bool hidden) {
+  entries_[Find(w)].hidden = hidden;
+  UpdateClients();
+}
+
+void StackingOrder::Raise(Window w) {
+  MoveGroup(w, true);
+}
+
+void StackingOrder::Lower(Window w) {
+  MoveGroup(w, false);
+}
+
+void StackingOrder::Restack() {
+  // 1. Restack the range of frames whose position changed. XRestackWindows()
+  // leaves the first window in place and stacks the rest below it, so the
+  // range starts with the unchanged frame above it, or if the topmost frame
+  // changed, it is raised first.
+  vector<Window> frames;
+  for (auto i = entries_.rbegin(); i != entries_.rend(); ++i) {
+    frames.push_back(i->frame);
+  }
+  CHECK_EQ(frames.size(), stacked_frames_.size());
+  if (frames != stacked_frames_) {
+    size_t begin = 0, end = frames.size();
+    while (frames[begin] == stacked_frames_[begin]) {
+      ++begin;
+    }
+    while (frames[end - 1] == stacked_frames_[end - 1]) {
+      --end;
+    }
+    if (begin == 0) {
+      XRaiseWindow(display_, frames[0]);
+    } else {
+      --begin;
+    }
+    XRestackWindows(display_, frames.data() + begin, end - begin);
+    stacked_frames_ = ::std::move(frames);
+  }
+  // 2. Publish the client list.
+  if (clients_changed_) {
+    XChangeProperty(
+        display_,
+        root_,
+        _NET_CLIENT_LIST_STACKING,
+        XA_WINDOW,
+        32,
+        PropModeReplace,
+        reinterpret_cast<const unsigned char*>(clients_.data()),
+        clients_.size());
+    clients_changed_ = false;
+  }
+}
+
+Window StackingOrder::GetBottomWindow() const {
+  vector<size_t> leaders;
+  vector<int> depths;
+  GetGroups(&leaders, &depths);
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    const Entry& entry = entries_[i];
+    if (!entry.hidden && entry.layer != StackingLayer::DOCK &&
+        leaders[i] == i) {
+      return entry.window;
+    }
+  }
+  return None;
+}
+
+size_t StackingOrder::Find(Window w) const {
+  auto i = positions_.find(w);
+  LOG_IF(FATAL, i == positions_.end())
+      << "Window " << w << " is not in the stacking order";
+  return i->second;
+}
+
+void StackingOrder::GetGroups(
+    vector<size_t>* leaders, vector<int>* depths) const {
+  const size_t unresolved = entries_.size();
+  leaders->assign(entries_.size(), unresolved);
+  depths->assign(entries_.size(), 0);
+  // Entries on the transient_for chain being walked, and whether each entry is
+  // on it.
+  vector<size_t> chain;
+  vector<bool> on_chain(entries_.size(), false);
+  for (size_t start = 0; start < entries_.size(); ++start) {
+    // 1. Walk up from the entry until reaching a resolved entry, a client
+    // that isn't transient for a managed client, or a cycle.
+    size_t i = start;
+    while ((*leaders)[i] == unresolved) {
+      chain.push_back(i);
+      on_chain[i] = true;
+      auto parent = positions_.find(entries_[i].transient_for);
+      if (parent == positions_.end() || on_chain[parent->second]) {
+        // i is the leader of its group.
+        (*leaders)[i] = i;
+        break;
+      }
+      i = parent->second;
+    }
+    // 2. Resolve the walked entries from the top down.
+    for (auto j = chain.rbegin(); j != chain.rend(); ++j) {
+      on_chain[*j] = false;
+      if ((*leaders)[*j] != unresolved) {
+        continue;
+      }
+      const size_t parent = positions_.at(entries_[*j].transient_for);
+      (*leaders)[*j] = (*leaders)[parent];
+      (*depths)[*j] = (*depths)[parent] + 1;
+    }
+    chain.clear();
+  }
+}
+
+void StackingOrder::MoveGroup(Window w, bool to_top) {
+  // 1. Split entries into the group and the rest, noting the layer of each.
+  vector<size_t> leaders;
+  vector<int> depths;
+  GetGroups(&leaders, &depths);
+  const size_t leader = leaders[Find(w)];
+  const StackingLayer layer = entries_[leader].layer;
+  vector<pair<int, Entry>> group;
+  vector<pair<StackingLayer, Entry>> rest;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    if (leaders[i] == leader) {
+      group.emplace_back(depths[i], entries_[i]);
+    } else {
+      rest.emplace_back(entries_[leaders[i]].layer, entries_[i]);
+    }
+  }
+  // 2. When raising, put the client on top of its group, then restore the
+  // invariant that transients are above the clients they are transient for.
+  if (to_top) {
+    auto i = ::std::find_if(
+        group.begin(), group.end(),
+        [w] (const pair<int, Entry>& member) {
+          return member.second.window == w;
+        });
+    ::std::rotate(i, i + 1, group.end());
+  }
+  ::std::stable_sort(
+      group.begin(), group.end(),
+      [] (const pair<int, Entry>& a, const pair<int, Entry>& b) {
+        return a.first < b.first;
+      });
+  // 3. Insert the group at the top or bottom of its layer.
+  auto position = ::std::find_if(
+      rest.begin(), rest.end(),
+      [layer, to_top] (const pair<StackingLayer, Entry>& other) {
+        return to_top ? other.first > layer : other.first >= layer;
+      });
+  entries_.clear();
+  for (auto i = rest.begin(); i != position; ++i) {
+    entries_.push_back(i->second);
+  }
+  for (const auto& member : group) {
+    entries_.push_back(member.second);
+  }
+  for (auto i = position; i != rest.end(); ++i) {
+    entries_.push_back(i->second);
+  }
+  UpdatePositions();
+  UpdateClients();
+}
+
+void StackingOrder::UpdatePositions() {
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    positions_[entries_[i].window] = i;
+  }
+}
+
+void StackingOrder::UpdateClients() {
+  vector<Window> clients;
+  for (const Entry& entry : entries_) {
+    if (!entry.hidden) {
+      clients.push_back(entry.window);
+    }
+  }
+  if (clients != clients_) {
+    clients_ = ::std::move(clients);
+    clients_changed_ = true;
+  }
+}
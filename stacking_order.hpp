@@ -0,0 +1,111 @@
+#ifndef STACKING_ORDER_HPP
+#define STACKING_ORDER_HPP
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+#include <unordered_map>
+#include <vector>
+
+// Stacking layers, from bottom to top.
+enum class StackingLayer {
+  NORMAL,
+  // Windows with _NET_WM_STATE_ABOVE.
+  ABOVE,
+  // Windows of _NET_WM_WINDOW_TYPE_DOCK.
+  DOCK,
+};
+
+// The window manager's model of the stacking order of frames.
+//
+// Clients are kept sorted by layer. Transient windows (dialogs) form a group
+// with the client they are transient for, which takes the group's layer and is
+// always stacked below them; raising or lowering any member moves the whole
+// group. The model also tracks the order last applied to the X server, so that
+// Restack() only moves the frames whose position changed, with a single
+// XRestackWindows() call.
+//
+// Entries are indexed by client window, and transient groups are resolved for
+// all clients in a single pass, so that every operation takes linear time in
+// the number of clients.
+class StackingOrder {
+ public:
+  explicit StackingOrder(Display* display);
+
+  // Adds a client whose frame was just created, and is therefore at the top
+  // of the server's stacking order, at the top of its layer.
+  void Add(Window w, Window frame);
+  // Removes a client whose frame is being destroyed.
+  void Remove(Window w);
+  // Updates the layer of a client, raising its group within the new layer.
+  void SetLayer(Window w, StackingLayer layer);
+  // Updates the client a client is transient for, or None, raising its group.
+  void SetTransientFor(Window w, Window transient_for);
+  // Raises a client's group to the top of its layer, with the client on top of
+  // the members of the group at the same transient depth.
+  void Raise(Window w);
+  // Lowers a client's group to the bottom of its layer.
+  void Lower(Window w);
+  // Sets whether a client is hidden, i.e. its frame is unmapped while it is
+  // withdrawn. Hidden clients keep their place, but are left out of clients()
+  // and GetBottomWindow().
+  void SetHidden(Window w, bool hidden);
+  // Applies changes to the model to the X server, and updates
+  // _NET_CLIENT_LIST_STACKING. Does nothing if the model hasn't changed.
+  void Restack();
+
+  // Client windows that aren't hidden, from bottom to top.
+  const ::std::vector<Window>& clients() const { return clients_; }
+  // Number of clients, including hidden ones.
+  size_t size() const { return entries_.size(); }
+  // Returns the bottom-most client that is neither hidden, a dock nor
+  // transient for another client, or None.
+  Window GetBottomWindow() const;
+
+ private:
+  // A managed client.
+  struct Entry {
+    Window window;
+    Window frame;
+    StackingLayer layer;
+    Window transient_for;
+    bool hidden;
+  };
+
+  // Returns the index of a client's entry.
+  size_t Find(Window w) const;
+  // Computes, for each entry, the index of the entry of the client at the
+  // root of its transient group, and the number of transient_for links from
+  // the client to that leader. Cycles of transient_for links are broken at
+  // the first client of the cycle encountered.
+  void GetGroups(
+      ::std::vector<size_t>* leaders, ::std::vector<int>* depths) const;
+  // Moves a client's group to the top or bottom of its layer.
+  void MoveGroup(Window w, bool to_top);
+  // Recomputes positions_ after entries_ are reordered.
+  void UpdatePositions();
+  // Recomputes clients_ from entries_.
+  void UpdateClients();
+
+  // Handle to the underlying Xlib Display struct.
+  Display* const display_;
+  // Root window.
+  const Window root_;
+  // Managed clients from bottom to top.
+  ::std::vector<Entry> entries_;
+  // Index of each client's entry in entries_.
+  ::std::unordered_map<Window, size_t> positions_;
+  // Client windows that aren't hidden from bottom to top, as published in
+  // _NET_CLIENT_LIST_STACKING.
+  ::std::vector<Window> clients_;
+  // Whether clients_ changed since it was last published.
+  bool clients_changed_;
+  // Frame windows from top to bottom, in the order last applied to the X
+  // server.
+  ::std::vector<Window> stacked_frames_;
+
+  // Atom constants.
+  const Atom _NET_CLIENT_LIST_STACKING;
+};
+
+#endif
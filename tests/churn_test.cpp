@@ -0,0 +1,222 @@
+// Checks that windows churning through their lifecycle leak no window manager
+// state.
+//
+// Drives a basic_wm instance with rapid, randomly interleaved creation,
+// mapping, unmapping, reconfiguring and destruction of many windows, in
+// reparenting and non-reparenting modes and with deferred framing. Checks
+// that the surviving windows end up managed, and that once all windows are
+// destroyed, no frames are left on the root window and every per-window table
+// reported by the tables control command is back to its initial size.
+
+extern "C" {
+#include <X11/Xutil.h>
+}
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glog/logging.h>
+#include "tests/wm_test_env.hpp"
+
+using ::std::map;
+using ::std::pair;
+using ::std::set;
+using ::std::string;
+using ::std::to_string;
+using ::std::unique_ptr;
+using ::std::vector;
+
+namespace {
+
+// Number of windows that exist at any time at most.
+const int NUM_SLOTS = 32;
+// Number of random operations on windows per configuration.
+const int NUM_OPERATIONS = 4000;
+// Number of operations between syncs with the X server, so that requests
+// don't pile up faster than the window manager can follow.
+const int SYNC_INTERVAL = 64;
+// Seed of the random operations, so that failures are reproducible.
+const unsigned int SEED = 42;
+
+// A client window slot.
+struct Slot {
+  Window window;
+  bool mapped;
+};
+
+// Returns the size of each per-window table of the window manager.
+map<string, int> GetTables(WmTestEnv* env) {
+  map<string, int> tables;
+  for (const auto& words : env->CommandLines("tables", "table")) {
+    CHECK_EQ(words.size(), 3u) << "Malformed tables line";
+    tables[words[1]] = atoi(words[2].c_str());
+  }
+  return tables;
+}
+
+// Returns the clients listed by the window manager.
+set<Window> GetClients(WmTestEnv* env) {
+  set<Window> clients;
+  for (const auto& words : env->CommandLines("list", "client")) {
+    clients.insert(strtoul(words[1].c_str(), nullptr, 0));
+  }
+  return clients;
+}
+
+// Drives a window manager with the given environment through churning
+// windows. Returns false if any state leaked.
+bool RunChurn(const vector<pair<string, string>>& wm_env) {
+  unique_ptr<WmTestEnv> env = WmTestEnv::Create(wm_env);
+  CHECK(env) << "Failed to start window manager";
+  Display* const display = env->display();
+  string description;
+  for (const auto& i : wm_env) {
+    description += " " + i.first + "=" + i.second;
+  }
+
+  // 1. Note the initial state, which includes the window manager's own
+  // windows.
+  const map<string, int> initial_tables = GetTables(env.get());
+  const int initial_root_children = env->CountRootChildren();
+
+  // 2. Churn windows.
+  ::std::mt19937 random(SEED);
+  vector<Slot> slots(NUM_SLOTS, Slot{None, false});
+  for (int op = 0; op < NUM_OPERATIONS; ++op) {
+    Slot& slot = slots[random() % NUM_SLOTS];
+    const int x = random() % 800;
+    const int y = random() % 600;
+    if (slot.window == None) {
+      //   a. Create a window, usually mapping it right away.
+      slot.window = env->CreateWindow(Rect<int>(x, y, 200, 100));
+      slot.mapped = random() % 4 != 0;
+      if (slot.mapped) {
+        XMapWindow(display, slot.window);
+      }
+    } else {
+      switch (random() % 6) {
+        case 0:
+          //   b. Destroy a window, whether mapped or not.
+          XDestroyWindow(display, slot.window);
+          slot.window = None;
+          break;
+        case 1:
+          //   c. Map or unmap a window.
+          if (slot.mapped) {
+            XUnmapWindow(display, slot.window);
+          } else {
+            XMapWindow(display, slot.window);
+          }
+          slot.mapped = !slot.mapped;
+          break;
+        case 2:
+          //   d. Withdraw a window the ICCCM way.
+          XWithdrawWindow(display, slot.window, DefaultScreen(display));
+          slot.mapped = false;
+          break;
+        case 3:
+          //   e. Ask to be moved and resized.
+          XMoveResizeWindow(
+              display, slot.window, x, y,
+              100 + random() % 300, 50 + random() % 200);
+          break;
+        case 4:
+          //   f. Change the title.
+          XStoreName(display, slot.window, ("op " + to_string(op)).c_str());
+          break;
+        case 5:
+          //   g. Unmap and map again right away, as toolkits do with dialogs.
+          XUnmapWindow(display, slot.window);
+          XMapWindow(display, slot.window);
+          slot.mapped = true;
+          break;
+      }
+    }
+    if (op % SYNC_INTERVAL == 0) {
+      XSync(display, false);
+    } else {
+      XFlush(display);
+    }
+  }
+
+  // 3. Map the surviving windows, which must all end up managed.
+  set<Window> windows;
+  for (Slot& slot : slots) {
+    if (slot.window != None) {
+      XMapWindow(display, slot.window);
+      windows.insert(slot.window);
+    }
+  }
+  XSync(display, false);
+  bool ok = true;
+  if (!WmTestEnv::WaitFor([&env, &windows] () {
+        return GetClients(env.get()) == windows;
+      })) {
+    LOG(ERROR) << "With" << description << ": expected " << windows.size()
+               << " clients, got " << GetClients(env.get()).size();
+    ok = false;
+  }
+
+  // 4. Destroy all windows, after which no state may be left.
+  for (const Window w : windows) {
+    XDestroyWindow(display, w);
+  }
+  XSync(display, false);
+  if (!WmTestEnv::WaitFor([&env, &initial_tables] () {
+        return GetTables(env.get()) == initial_tables;
+      })) {
+    for (const auto& table : GetTables(env.get())) {
+      const auto initial = initial_tables.find(table.first);
+      const int initial_size =
+          initial == initial_tables.end() ? 0 : initial->second;
+      if (table.second != initial_size) {
+        LOG(ERROR) << "With" << description << ": table " << table.first
+                   << " has " << table.second << " entries, expected "
+                   << initial_size;
+      }
+    }
+    ok = false;
+  }
+  if (!WmTestEnv::WaitFor([&env, initial_root_children] () {
+        return env->CountRootChildren() == initial_root_children;
+      })) {
+    LOG(ERROR) << "With" << description << ": "
+               << env->CountRootChildren() - initial_root_children
+               << " windows left on the root window";
+    ok = false;
+  }
+  CHECK(env->IsRunning()) << "Window manager exited";
+  LOG(INFO) << "Churned " << NUM_OPERATIONS << " operations with"
+            << description << (ok ? ": ok" : ": leaked");
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = true;
+  // Withdrawn windows are unframed soon, so that the final check needn't wait
+  // for long.
+  const vector<vector<pair<string, string>>> configs = {
+      {{"BASIC_WM_REPARENT", "1"}, {"BASIC_WM_WITHDRAWN_TIMEOUT_MS", "100"}},
+      {{"BASIC_WM_REPARENT", "0"}, {"BASIC_WM_WITHDRAWN_TIMEOUT_MS", "100"}},
+      {{"BASIC_WM_REPARENT", "1"}, {"BASIC_WM_WITHDRAWN_TIMEOUT_MS", "100"},
+       {"BASIC_WM_FRAME_DELAY_MS", "50"}},
+  };
+  int num_failed = 0;
+  for (const auto& config : configs) {
+    if (!RunChurn(config)) {
+      ++num_failed;
+    }
+  }
+  if (num_failed > 0) {
+    LOG(ERROR) << "FAILED: " << num_failed << " configurations leaked state";
+    return EXIT_FAILURE;
+  }
+  LOG(INFO) << "PASSED";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,154 @@
+// Checks that event scheduling doesn't rate limit well-behaved clients, and
+// doesn't reorder input with earlier events about the same window.
+//
+// Drives a basic_wm instance with the default event rate limit through an
+// application mapping a burst of windows at startup, and fails if the events
+// control command reports the application as throttled, as it would if the
+// notify events caused by framing its windows were counted against it. Then
+// pushes events straight into an EventScheduler, and fails if input on a
+// window is handled before a structural event on it that was received first.
+
+extern "C" {
+#include <X11/Xutil.h>
+}
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glog/logging.h>
+#include "event_scheduler.hpp"
+#include "tests/wm_test_env.hpp"
+#include "timer_queue.hpp"
+
+using ::std::pair;
+using ::std::string;
+using ::std::unique_ptr;
+using ::std::vector;
+
+namespace {
+
+// Number of windows mapped at once, within the default burst of requests.
+const int NUM_WINDOWS = 200;
+
+// Returns the number of clients listed by the window manager.
+int CountClients(WmTestEnv* env) {
+  return env->CommandLines("list", "client").size();
+}
+
+// Maps a burst of windows. Returns the number of times clients were
+// throttled.
+int RunBurst(const string& reparent) {
+  unique_ptr<WmTestEnv> env = WmTestEnv::Create({
+      {"BASIC_WM_REPARENT", reparent},
+  });
+  CHECK(env) << "Failed to start window manager";
+  Display* const display = env->display();
+
+  // 1. Map windows all at once.
+  vector<Window> windows;
+  for (int i = 0; i < NUM_WINDOWS; ++i) {
+    windows.push_back(
+        env->CreateWindow(Rect<int>(i % 40 * 20, i % 30 * 20, 200, 100)));
+  }
+  for (const Window w : windows) {
+    XMapWindow(display, w);
+  }
+  XSync(display, false);
+  CHECK(WmTestEnv::WaitFor([&env] () {
+    return CountClients(env.get()) == NUM_WINDOWS;
+  })) << "Windows were not framed";
+
+  // 2. Check throttling. Lines are "client <id> handled <count> throttled
+  // <count> queued <count> max_queued <count>".
+  int num_throttled = 0;
+  for (const auto& words : env->CommandLines("events", "client")) {
+    CHECK_EQ(words.size(), 10u) << "Malformed events line";
+    const int throttled = atoi(words[5].c_str());
+    if (throttled > 0) {
+      LOG(ERROR) << "With reparenting " << reparent << ": client " << words[1]
+                 << " throttled " << throttled << " times after handling "
+                 << words[3] << " events";
+      num_throttled += throttled;
+    }
+  }
+  CHECK(env->IsRunning()) << "Window manager exited";
+  return num_throttled;
+}
+
+// Returns an event of a type about a window.
+XEvent MakeEvent(int type, Window w) {
+  XEvent e;
+  memset(&e, 0, sizeof(e));
+  e.type = type;
+  e.xany.window = w;
+  if (type == MapNotify) {
+    e.xmap.event = w;
+    e.xmap.window = w;
+  }
+  return e;
+}
+
+// Pushes interleaved structural and input events, and checks the order in
+// which they are handled. Returns false if it is wrong.
+bool CheckOrder() {
+  unique_ptr<WmTestEnv> env = WmTestEnv::Create({});
+  CHECK(env) << "Failed to start window manager";
+  Display* const display = env->display();
+  const Window a = env->CreateWindow(Rect<int>(0, 0, 200, 100));
+  const Window b = env->CreateWindow(Rect<int>(200, 0, 200, 100));
+  TimerQueue timers;
+  EventScheduler scheduler(display, &timers, 0);
+
+  // 1. Input on a jumps ahead of b's MapNotify, but not a's, and a later
+  // MapNotify of a doesn't jump ahead of the input.
+  const vector<XEvent> pushed = {
+      MakeEvent(MapNotify, b),
+      MakeEvent(MapNotify, a),
+      MakeEvent(EnterNotify, a),
+      MakeEvent(ButtonPress, a),
+      MakeEvent(MapNotify, a),
+  };
+  const vector<pair<int, Window>> expected = {
+      {MapNotify, a},
+      {EnterNotify, a},
+      {ButtonPress, a},
+      {MapNotify, b},
+      {MapNotify, a},
+  };
+  for (const XEvent& e : pushed) {
+    scheduler.Push(e);
+  }
+  // 2. Check the order.
+  vector<pair<int, Window>> handled;
+  XEvent e;
+  while (scheduler.Pop(&e)) {
+    handled.push_back({e.type, e.xany.window});
+  }
+  if (handled != expected) {
+    LOG(ERROR) << "Events handled out of order";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = true;
+  int num_throttled = 0;
+  for (const string& reparent : {string("1"), string("0")}) {
+    num_throttled += RunBurst(reparent);
+  }
+  if (num_throttled > 0) {
+    LOG(ERROR) << "FAILED: clients throttled " << num_throttled << " times";
+    return EXIT_FAILURE;
+  }
+  if (!CheckOrder()) {
+    LOG(ERROR) << "FAILED: input handled before earlier events";
+    return EXIT_FAILURE;
+  }
+  LOG(INFO) << "PASSED";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+// Checks that window manager operations stay within their budgets of X
+// requests and round trips.
+//
+// Drives a basic_wm instance with request accounting enabled through framing,
+// property changes, configure requests, iconifying, withdrawing, control
+// commands and unframing, in both reparenting and non-reparenting modes, then
+// fails if the stats control command reports any operation over its budget.
+
+extern "C" {
+#include <X11/Xutil.h>
+}
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <glog/logging.h>
+#include "tests/wm_test_env.hpp"
+
+using ::std::string;
+using ::std::to_string;
+using ::std::unique_ptr;
+using ::std::vector;
+
+namespace {
+
+// Number of client windows to drive through each operation.
+const int NUM_WINDOWS = 16;
+
+// Returns the number of clients listed by the window manager.
+int CountClients(WmTestEnv* env) {
+  return env->CommandLines("list", "client").size();
+}
+
+// Drives a window manager through common operations. Returns the number of
+// operations over budget.
+int RunOperations(const string& reparent) {
+  unique_ptr<WmTestEnv> env = WmTestEnv::Create({
+      {"BASIC_WM_REQUEST_STATS", "1"},
+      {"BASIC_WM_REPARENT", reparent},
+  });
+  CHECK(env) << "Failed to start window manager";
+  Display* const display = env->display();
+
+  // 1. Frame windows.
+  vector<Window> windows;
+  for (int i = 0; i < NUM_WINDOWS; ++i) {
+    const Window w = env->CreateWindow(Rect<int>(i * 10, i * 10, 200, 100));
+    XStoreName(display, w, ("window " + to_string(i)).c_str());
+    XMapWindow(display, w);
+    windows.push_back(w);
+  }
+  XSync(display, false);
+  CHECK(WmTestEnv::WaitFor([&env] () {
+    return CountClients(env.get()) == NUM_WINDOWS;
+  })) << "Windows were not framed";
+
+  // 2. Change titles, and ask to be moved and resized.
+  for (const Window w : windows) {
+    XStoreName(display, w, "renamed");
+    XMoveResizeWindow(display, w, 50, 50, 300, 200);
+  }
+  XSync(display, false);
+
+  // 3. Move, resize, raise and focus through the control socket.
+  for (const Window w : windows) {
+    const string id = to_string(w);
+    env->Command(
+        "move " + id + " 20 20; resize " + id + " 250 150; raise " + id +
+        "; focus " + id);
+  }
+
+  // 4. Iconify and restore, and withdraw and map again.
+  for (size_t i = 0; i < windows.size(); ++i) {
+    if (i % 2) {
+      XIconifyWindow(display, windows[i], DefaultScreen(display));
+    } else {
+      XWithdrawWindow(display, windows[i], DefaultScreen(display));
+    }
+  }
+  XSync(display, false);
+  CHECK(WmTestEnv::WaitFor([&env] () {
+    return CountClients(env.get()) == 0;
+  })) << "Windows were not hidden";
+  for (const Window w : windows) {
+    XMapWindow(display, w);
+  }
+  XSync(display, false);
+  CHECK(WmTestEnv::WaitFor([&env] () {
+    return CountClients(env.get()) == NUM_WINDOWS;
+  })) << "Windows were not shown again";
+
+  // 5. Unframe windows.
+  for (const Window w : windows) {
+    XDestroyWindow(display, w);
+  }
+  XSync(display, false);
+  CHECK(WmTestEnv::WaitFor([&env] () {
+    return CountClients(env.get()) == 0;
+  })) << "Windows were not unframed";
+  CHECK(env->IsRunning()) << "Window manager exited";
+
+  // 6. Check budgets. Lines are "<operation> <invocations> requests <total>
+  // <max> bytes <total> <max> round_trips <total> <max> over_budget <count>".
+  int num_over_budget = 0;
+  int num_frames = 0;
+  int num_unframes = 0;
+  for (const auto& words : env->CommandLines("stats", "")) {
+    CHECK_EQ(words.size(), 13u) << "Malformed stats line";
+    if (words[0] == "Frame") {
+      num_frames = atoi(words[1].c_str());
+    } else if (words[0] == "Unframe") {
+      num_unframes = atoi(words[1].c_str());
+    }
+    LOG(INFO) << "Reparenting " << reparent << ": " << words[0] << " max "
+              << words[4] << " requests " << words[10] << " round trips";
+    if (atoi(words[12].c_str()) > 0) {
+      LOG(ERROR) << "Over budget with reparenting " << reparent << ": "
+                 << words[0] << " " << words[12] << " times";
+      ++num_over_budget;
+    }
+  }
+  CHECK_GE(num_frames, NUM_WINDOWS) << "Frame was not accounted for";
+  CHECK_GE(num_unframes, NUM_WINDOWS) << "Unframe was not accounted for";
+  return num_over_budget;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = true;
+  int num_over_budget = 0;
+  for (const string& reparent : {string("1"), string("0")}) {
+    num_over_budget += RunOperations(reparent);
+  }
+  if (num_over_budget > 0) {
+    LOG(ERROR) << "FAILED: " << num_over_budget
+               << " operations over budget";
+    return EXIT_FAILURE;
+  }
+  LOG(INFO) << "PASSED";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,246 @@
+#include "tests/wm_test_env.hpp"
+extern "C" {
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+}
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <glog/logging.h>
+
+using ::std::chrono::milliseconds;
+using ::std::chrono::steady_clock;
+using ::std::function;
+using ::std::istringstream;
+using ::std::ostringstream;
+using ::std::pair;
+using ::std::string;
+using ::std::unique_ptr;
+using ::std::vector;
+
+namespace {
+
+// How long to wait for the window manager to start, and to answer a batch.
+const milliseconds START_TIMEOUT(10000);
+const milliseconds REPLY_TIMEOUT(10000);
+// Interval between retries of WaitFor() predicates.
+const milliseconds RETRY_INTERVAL(10);
+
+// Connects to a Unix domain socket. Returns -1 on failure.
+int Connect(const string& path) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+}  // namespace
+
+unique_ptr<WmTestEnv> WmTestEnv::Create(
+    const vector<pair<string, string>>& env) {
+  // 1. Open our own connection to the display.
+  Display* display = XOpenDisplay(nullptr);
+  if (display == nullptr) {
+    LOG(ERROR) << "Failed to open X display " << XDisplayName(nullptr)
+               << ", run under xvfb-run";
+    return nullptr;
+  }
+  // 2. Start the window manager with a control socket of its own.
+  static int num_started = 0;
+  ostringstream socket_path;
+  socket_path << "/tmp/basic_wm_test." << getpid() << "." << num_started++
+              << ".sock";
+  const char* binary = getenv("BASIC_WM_BINARY");
+  if (binary == nullptr) {
+    binary = "./basic_wm";
+  }
+  const pid_t pid = fork();
+  if (pid < 0) {
+    PLOG(ERROR) << "fork() failed";
+    XCloseDisplay(display);
+    return nullptr;
+  }
+  if (pid == 0) {
+    for (const auto& i : env) {
+      setenv(i.first.c_str(), i.second.c_str(), true);
+    }
+    setenv("BASIC_WM_CONTROL_SOCKET", socket_path.str().c_str(), true);
+    execl(binary, binary, static_cast<char*>(nullptr));
+    _exit(127);
+  }
+  // 3. Connect to the control socket once it is listening.
+  int control_fd = -1;
+  const steady_clock::time_point deadline = steady_clock::now() + START_TIMEOUT;
+  while (control_fd < 0 && steady_clock::now() < deadline) {
+    if (waitpid(pid, nullptr, WNOHANG) == pid) {
+      break;
+    }
+    control_fd = Connect(socket_path.str());
+    if (control_fd < 0) {
+      ::std::this_thread::sleep_for(RETRY_INTERVAL);
+    }
+  }
+  if (control_fd < 0) {
+    LOG(ERROR) << "Failed to start " << binary;
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    XCloseDisplay(display);
+    return nullptr;
+  }
+  unique_ptr<WmTestEnv> test_env(
+      new WmTestEnv(display, pid, socket_path.str(), control_fd));
+  // 4. The control socket is served from the main loop, so an answer means
+  // that the window manager has selected substructure redirection.
+  test_env->Command("list");
+  return test_env;
+}
+
+WmTestEnv::WmTestEnv(
+    Display* display,
+    pid_t pid,
+    const string& socket_path,
+    int control_fd)
+    : display_(CHECK_NOTNULL(display)),
+      pid_(pid),
+      socket_path_(socket_path),
+      control_fd_(control_fd),
+      exited_(false) {
+}
+
+WmTestEnv::~WmTestEnv() {
+  close(control_fd_);
+  if (!exited_) {
+    kill(pid_, SIGTERM);
+    waitpid(pid_, nullptr, 0);
+  }
+  unlink(socket_path_.c_str());
+  XCloseDisplay(display_);
+}
+
+bool WmTestEnv::IsRunning() {
+  if (!exited_ && waitpid(pid_, nullptr, WNOHANG) == pid_) {
+    exited_ = true;
+  }
+  return !exited_;
+}
+
+string WmTestEnv::Command(const string& batch) {
+  // 1. Send batch.
+  const string line = batch + "\n";
+  for (size_t sent = 0; sent < line.size(); ) {
+    const ssize_t n = send(
+        control_fd_, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+    PCHECK(n > 0 || errno == EINTR) << "Failed to send batch: " << batch;
+    sent += n > 0 ? n : 0;
+  }
+  // 2. Read output lines up to the status line.
+  string output;
+  const steady_clock::time_point deadline = steady_clock::now() + REPLY_TIMEOUT;
+  for (;;) {
+    const size_t end = buffer_.find('\n');
+    if (end != string::npos) {
+      const string reply_line = buffer_.substr(0, end);
+      buffer_.erase(0, end + 1);
+      if (reply_line == "ok") {
+        return output;
+      }
+      CHECK_NE(reply_line.compare(0, 6, "error "), 0)
+          << "Batch failed: " << batch << ": " << reply_line;
+      if (reply_line.compare(0, 6, "event ") != 0) {
+        output += reply_line + "\n";
+      }
+      continue;
+    }
+    const milliseconds timeout =
+        ::std::chrono::duration_cast<milliseconds>(
+            deadline - steady_clock::now());
+    CHECK_GT(timeout.count(), 0) << "No answer to batch: " << batch;
+    pollfd fd = {control_fd_, POLLIN, 0};
+    if (poll(&fd, 1, timeout.count()) <= 0) {
+      continue;
+    }
+    char data[4096];
+    const ssize_t n = read(control_fd_, data, sizeof(data));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(n, 0) << "Window manager closed the control connection";
+    buffer_.append(data, n);
+  }
+}
+
+vector<vector<string>> WmTestEnv::CommandLines(
+    const string& batch, const string& word) {
+  vector<vector<string>> lines;
+  istringstream output(Command(batch));
+  string line;
+  while (getline(output, line)) {
+    istringstream line_in(line);
+    vector<string> words;
+    string w;
+    while (line_in >> w) {
+      words.push_back(w);
+    }
+    if (!words.empty() && (word.empty() || words[0] == word)) {
+      lines.push_back(::std::move(words));
+    }
+  }
+  return lines;
+}
+
+Window WmTestEnv::CreateWindow(const Rect<int>& geometry) {
+  return XCreateSimpleWindow(
+      display_,
+      DefaultRootWindow(display_),
+      geometry.x,
+      geometry.y,
+      geometry.width,
+      geometry.height,
+      1,
+      BlackPixel(display_, DefaultScreen(display_)),
+      WhitePixel(display_, DefaultScreen(display_)));
+}
+
+int WmTestEnv::CountRootChildren() {
+  Window returned_root, returned_parent;
+  Window* children;
+  unsigned int num_children;
+  CHECK(XQueryTree(
+      display_,
+      DefaultRootWindow(display_),
+      &returned_root,
+      &returned_parent,
+      &children,
+      &num_children));
+  XFree(children);
+  return num_children;
+}
+
+bool WmTestEnv::WaitFor(
+    const function<bool()>& predicate, milliseconds timeout) {
+  const steady_clock::time_point deadline = steady_clock::now() + timeout;
+  for (;;) {
+    if (predicate()) {
+      return true;
+    }
+    if (steady_clock::now() >= deadline) {
+      return false;
+    }
+    ::std::this_thread::sleep_for(RETRY_INTERVAL);
+  }
+}
@@ -0,0 +1,82 @@
+#ifndef TESTS_WM_TEST_ENV_HPP
+#define TESTS_WM_TEST_ENV_HPP
+
+extern "C" {
+#include <X11/Xlib.h>
+#include <sys/types.h>
+}
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "util.hpp"
+
+// A basic_wm process managing the X display named by DISPLAY, typically an
+// Xvfb server started by xvfb-run, for tests and benchmarks that drive the
+// window manager as X clients do.
+//
+// Tests act on the display through an X connection of their own, and observe
+// the window manager through its control socket. As the window manager
+// handles events asynchronously, checks on its state are retried with
+// WaitFor() until they pass or time out.
+class WmTestEnv {
+ public:
+  // Starts the basic_wm binary named by BASIC_WM_BINARY, or ./basic_wm, with
+  // the given environment variables set in addition to ours, and waits until
+  // it manages the display. On failure, returns nullptr.
+  static ::std::unique_ptr<WmTestEnv> Create(
+      const ::std::vector<::std::pair<::std::string, ::std::string>>& env =
+          ::std::vector<::std::pair<::std::string, ::std::string>>());
+
+  // Terminates the window manager.
+  ~WmTestEnv();
+
+  // Our own connection to the display.
+  Display* display() const { return display_; }
+  // Returns whether the window manager is still running.
+  bool IsRunning();
+
+  // Executes a batch of control commands, and returns their output.
+  // CHECK-fails if the batch fails or the window manager doesn't answer.
+  ::std::string Command(const ::std::string& batch);
+  // Returns the lines of a control command's output that start with the
+  // given word, or all lines if word is empty, split into words.
+  ::std::vector<::std::vector<::std::string>> CommandLines(
+      const ::std::string& batch, const ::std::string& word);
+
+  // Creates an unmapped top-level window.
+  Window CreateWindow(const Rect<int>& geometry);
+  // Returns the number of children of the root window.
+  int CountRootChildren();
+
+  // Calls predicate until it returns true, for up to timeout. Returns false
+  // if it timed out.
+  static bool WaitFor(
+      const ::std::function<bool()>& predicate,
+      ::std::chrono::milliseconds timeout = ::std::chrono::seconds(10));
+
+ private:
+  // Invoked internally by Create().
+  WmTestEnv(
+      Display* display,
+      pid_t pid,
+      const ::std::string& socket_path,
+      int control_fd);
+
+  // Our own connection to the display.
+  Display* const display_;
+  // Process ID of the window manager.
+  const pid_t pid_;
+  // Path of the window manager's control socket.
+  const ::std::string socket_path_;
+  // Connection to the control socket.
+  const int control_fd_;
+  // Received control output not yet returned.
+  ::std::string buffer_;
+  // Whether the window manager has exited.
+  bool exited_;
+};
+
+#endif
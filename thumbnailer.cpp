@@ -0,0 +1,322 @@
+#include "thumbnailer.hpp"
+extern "C" {
+#include <X11/Xutil.h>
+#include <X11/extensions/Xcomposite.h>
+}
+#include <algorithm>
+#include <glog/logging.h>
+#include "icon_cache.hpp"
+
+using ::std::chrono::milliseconds;
+using ::std::fill;
+using ::std::max;
+using ::std::min;
+using ::std::unique_ptr;
+
+namespace {
+
+// Returns the smallest rectangle containing two rectangles, treating empty
+// rectangles as absent.
+Rect<int> Union(const Rect<int>& a, const Rect<int>& b) {
+  if (a.width <= 0 || a.height <= 0) {
+    return b;
+  }
+  if (b.width <= 0 || b.height <= 0) {
+    return a;
+  }
+  const int x = min(a.x, b.x), y = min(a.y, b.y);
+  return Rect<int>(
+      x, y,
+      max(a.x + a.width, b.x + b.width) - x,
+      max(a.y + a.height, b.y + b.height) - y);
+}
+
+// Returns the range of destination pixels [*dest_begin, *dest_end) affected by
+// source pixels [begin, end) when scaling src_length pixels to dest_length,
+// and the range of source pixels [*src_begin, *src_end) that they cover.
+void MapRange(
+    int begin, int end, int src_length, int dest_length,
+    int* dest_begin, int* dest_end, int* src_begin, int* src_end) {
+  *dest_begin = static_cast<long>(begin) * dest_length / src_length;
+  *dest_end = min(
+      dest_length,
+      static_cast<int>(
+          (static_cast<long>(end) * dest_length + src_length - 1) /
+          src_length));
+  *dest_end = max(*dest_end, *dest_begin + 1);
+  *src_begin = static_cast<long>(*dest_begin) * src_length / dest_length;
+  *src_end = max(
+      *src_begin + 1,
+      static_cast<int>(static_cast<long>(*dest_end) * src_length / dest_length));
+}
+
+}  // namespace
+
+unique_ptr<Thumbnailer> Thumbnailer::Create(
+    Display* display,
+    TimerQueue* timers,
+    int thumbnail_size,
+    milliseconds update_interval) {
+  // 1. Check for XComposite 0.2, which is needed for
+  // XCompositeNameWindowPixmap(), and XDamage.
+  int event_base, error_base, major = 0, minor = 2;
+  if (!XCompositeQueryExtension(display, &event_base, &error_base) ||
+      !XCompositeQueryVersion(display, &major, &minor) ||
+      (major == 0 && minor < 2)) {
+    LOG(ERROR) << "XComposite 0.2 is not available";
+    return nullptr;
+  }
+  int damage_event_base;
+  if (!XDamageQueryExtension(display, &damage_event_base, &error_base)) {
+    LOG(ERROR) << "XDamage is not available";
+    return nullptr;
+  }
+  // 2. Set up MIT-SHM for reading back frames as large as the screen.
+  const int screen = DefaultScreen(display);
+  unique_ptr<ShmSegment> shm = ShmSegment::Create(
+      display,
+      static_cast<size_t>(DisplayWidth(display, screen)) *
+          DisplayHeight(display, screen) * sizeof(uint32_t));
+  if (!shm) {
+    LOG(INFO) << "MIT-SHM unavailable, reading thumbnails with XGetImage";
+  }
+  return unique_ptr<Thumbnailer>(new Thumbnailer(
+      display,
+      timers,
+      thumbnail_size,
+      update_interval,
+      damage_event_base,
+      ::std::move(shm)));
+}
+
+Thumbnailer::Thumbnailer(
+    Display* display,
+    TimerQueue* timers,
+    int thumbnail_size,
+    milliseconds update_interval,
+    int damage_event_base,
+    unique_ptr<ShmSegment> shm)
+    : display_(CHECK_NOTNULL(display)),
+      visual_(DefaultVisual(display_, DefaultScreen(display_))),
+      depth_(DefaultDepth(display_, DefaultScreen(display_))),
+      timers_(CHECK_NOTNULL(timers)),
+      thumbnail_size_(thumbnail_size),
+      update_interval_(update_interval),
+      damage_event_(damage_event_base + XDamageNotify),
+      shm_(::std::move(shm)),
+      update_timer_(0) {
+  CHECK_GT(thumbnail_size_, 0);
+}
+
+Thumbnailer::~Thumbnailer() {
+  timers_->Cancel(update_timer_);
+  while (!thumbnails_.empty()) {
+    RemoveFrame(thumbnails_.begin()->first);
+  }
+}
+
+void Thumbnailer::AddFrame(
+    Window frame, const Size<int>& size, int border_width) {
+  CHECK(!thumbnails_.count(frame));
+  // 1. Allocate an atlas slot, growing the atlas if necessary.
+  const size_t slot_pixels =
+      static_cast<size_t>(thumbnail_size_) * thumbnail_size_;
+  if (free_slots_.empty()) {
+    free_slots_.push_back(atlas_.size() / slot_pixels);
+    atlas_.resize(atlas_.size() + slot_pixels);
+  }
+  Thumbnail& thumbnail = thumbnails_[frame];
+  thumbnail.slot = free_slots_.back();
+  free_slots_.pop_back();
+  fill(atlas_.begin() + thumbnail.slot * slot_pixels,
+       atlas_.begin() + (thumbnail.slot + 1) * slot_pixels,
+       0);
+  // 2. Keep the frame's contents offscreen, while still having the server
+  // draw it on screen as usual.
+  XCompositeRedirectWindow(display_, frame, CompositeRedirectAutomatic);
+  // 3. Track damage as a bounding box, so that the server sends one event per
+  // growth of the box rather than one per drawing operation.
+  thumbnail.damage =
+      XDamageCreate(display_, frame, XDamageReportBoundingBox);
+  thumbnail.size = size;
+  thumbnail.border_width = border_width;
+  thumbnail.mapped = true;
+  thumbnail.dirty = Rect<int>(0, 0, 0, 0);
+  AddDamage(&thumbnail, Rect<int>(Position<int>(0, 0), size));
+}
+
+void Thumbnailer::RemoveFrame(Window frame) {
+  auto i = thumbnails_.find(frame);
+  if (i == thumbnails_.end()) {
+    return;
+  }
+  XDamageDestroy(display_, i->second.damage);
+  XCompositeUnredirectWindow(display_, frame, CompositeRedirectAutomatic);
+  free_slots_.push_back(i->second.slot);
+  thumbnails_.erase(i);
+}
+
+void Thumbnailer::SetSize(
+    Window frame, const Size<int>& size, int border_width) {
+  auto i = thumbnails_.find(frame);
+  if (i == thumbnails_.end() ||
+      (i->second.size.width == size.width &&
+       i->second.size.height == size.height &&
+       i->second.border_width == border_width)) {
+    return;
+  }
+  i->second.size = size;
+  i->second.border_width = border_width;
+  const size_t slot_pixels =
+      static_cast<size_t>(thumbnail_size_) * thumbnail_size_;
+  fill(atlas_.begin() + i->second.slot * slot_pixels,
+       atlas_.begin() + (i->second.slot + 1) * slot_pixels,
+       0);
+  AddDamage(&i->second, Rect<int>(Position<int>(0, 0), size));
+}
+
+void Thumbnailer::SetMapped(Window frame, bool mapped) {
+  auto i = thumbnails_.find(frame);
+  if (i == thumbnails_.end() || i->second.mapped == mapped) {
+    return;
+  }
+  i->second.mapped = mapped;
+  if (mapped) {
+    // Damage while unmapped was dropped.
+    AddDamage(&i->second, Rect<int>(Position<int>(0, 0), i->second.size));
+  } else {
+    i->second.dirty = Rect<int>(0, 0, 0, 0);
+  }
+}
+
+bool Thumbnailer::HandleEvent(const XEvent& e) {
+  if (e.type != damage_event_) {
+    return false;
+  }
+  const XDamageNotifyEvent& damage_event =
+      reinterpret_cast<const XDamageNotifyEvent&>(e);
+  auto i = thumbnails_.find(damage_event.drawable);
+  if (i != thumbnails_.end() && i->second.mapped) {
+    AddDamage(&i->second, Rect<int>(
+        damage_event.area.x,
+        damage_event.area.y,
+        damage_event.area.width,
+        damage_event.area.height));
+  }
+  return true;
+}
+
+const uint32_t* Thumbnailer::Get(Window frame) const {
+  auto i = thumbnails_.find(frame);
+  if (i == thumbnails_.end()) {
+    return nullptr;
+  }
+  return atlas_.data() +
+         i->second.slot * static_cast<size_t>(thumbnail_size_) *
+             thumbnail_size_;
+}
+
+void Thumbnailer::AddDamage(Thumbnail* thumbnail, const Rect<int>& rect) {
+  thumbnail->dirty = Union(thumbnail->dirty, rect);
+  if (!update_timer_) {
+    update_timer_ = timers_->Add(update_interval_, [this] () { Update(); });
+  }
+}
+
+void Thumbnailer::Update() {
+  update_timer_ = 0;
+  // Naming the pixmap of an unmapped frame fails with BadMatch.
+  for (auto& i : thumbnails_) {
+    if (i.second.mapped) {
+      UpdateThumbnail(i.first, &i.second);
+    }
+  }
+}
+
+void Thumbnailer::UpdateThumbnail(Window frame, Thumbnail* thumbnail) {
+  // 1. Clip damage to the frame.
+  const Size<int>& size = thumbnail->size;
+  const int x0 = max(thumbnail->dirty.x, 0);
+  const int y0 = max(thumbnail->dirty.y, 0);
+  const int x1 = min(thumbnail->dirty.x + thumbnail->dirty.width, size.width);
+  const int y1 = min(thumbnail->dirty.y + thumbnail->dirty.height, size.height);
+  if (thumbnail->dirty.width <= 0 || thumbnail->dirty.height <= 0) {
+    return;
+  }
+  // Reset the damage object before reading, so that changes made while we
+  // read are reported again.
+  thumbnail->dirty = Rect<int>(0, 0, 0, 0);
+  XDamageSubtract(display_, thumbnail->damage, None, None);
+  if (x0 >= x1 || y0 >= y1) {
+    return;
+  }
+
+  // 2. Compute the part of the thumbnail affected by the damage, and the
+  // part of the frame it covers. The frame is scaled to fit the thumbnail
+  // and centered.
+  int width = thumbnail_size_, height = thumbnail_size_;
+  if (size.width > size.height) {
+    height = max(1, size.height * thumbnail_size_ / size.width);
+  } else if (size.height > size.width) {
+    width = max(1, size.width * thumbnail_size_ / size.height);
+  }
+  int dest_x0, dest_x1, src_x0, src_x1, dest_y0, dest_y1, src_y0, src_y1;
+  MapRange(x0, x1, size.width, width, &dest_x0, &dest_x1, &src_x0, &src_x1);
+  MapRange(y0, y1, size.height, height, &dest_y0, &dest_y1, &src_y0, &src_y1);
+  const int src_width = src_x1 - src_x0, src_height = src_y1 - src_y0;
+
+  // 3. Read the covered part of the frame's offscreen pixmap. The pixmap
+  // includes the frame's border, and is freed right after reading whether or
+  // not reading succeeded.
+  const Pixmap pixmap = XCompositeNameWindowPixmap(display_, frame);
+  XImage* image = shm_
+      ? shm_->CreateImage(visual_, depth_, src_width, src_height)
+      : nullptr;
+  const bool use_shm = image != nullptr;
+  if (use_shm) {
+    if (!XShmGetImage(
+            display_, pixmap, image,
+            src_x0 + thumbnail->border_width,
+            src_y0 + thumbnail->border_width,
+            AllPlanes)) {
+      ShmSegment::DestroyImage(image);
+      image = nullptr;
+    }
+  } else {
+    image = XGetImage(
+        display_, pixmap,
+        src_x0 + thumbnail->border_width, src_y0 + thumbnail->border_width,
+        src_width, src_height, AllPlanes, ZPixmap);
+  }
+  XFreePixmap(display_, pixmap);
+  if (image == nullptr) {
+    LOG(WARNING) << "Failed to read contents of frame " << frame;
+    return;
+  }
+  if (image->bits_per_pixel != 32 ||
+      image->bytes_per_line != src_width * static_cast<int>(sizeof(uint32_t))) {
+    LOG(WARNING) << "Unsupported image format for thumbnails";
+  } else {
+    // 4. Frames are opaque, but the unused byte of 24-bit pixels is
+    // undefined.
+    uint32_t* const pixels = reinterpret_cast<uint32_t*>(image->data);
+    for (long i = 0; i < static_cast<long>(src_width) * src_height; ++i) {
+      pixels[i] |= 0xff000000;
+    }
+    // 5. Scale into the atlas.
+    uint32_t* const dest = atlas_.data() +
+        thumbnail->slot * static_cast<size_t>(thumbnail_size_) *
+            thumbnail_size_;
+    const int offset_x = (thumbnail_size_ - width) / 2;
+    const int offset_y = (thumbnail_size_ - height) / 2;
+    ScalePixels(
+        pixels, src_width, src_height,
+        dest + (offset_y + dest_y0) * thumbnail_size_ + offset_x + dest_x0,
+        dest_x1 - dest_x0, dest_y1 - dest_y0, thumbnail_size_);
+  }
+  if (use_shm) {
+    ShmSegment::DestroyImage(image);
+  } else {
+    XDestroyImage(image);
+  }
+}
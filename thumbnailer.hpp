@@ -0,0 +1,123 @@
+#ifndef THUMBNAILER_HPP
+#define THUMBNAILER_HPP
+
+extern "C" {
+#include <X11/Xlib.h>
+#include <X11/extensions/Xdamage.h>
+}
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "shm_segment.hpp"
+#include "timer_queue.hpp"
+#include "util.hpp"
+
+// Maintains live thumbnails of frame windows for an overview of all clients,
+// without relying on a GPU.
+//
+// Frames are redirected with XComposite so that their contents are kept in
+// offscreen pixmaps, and XDamage reports which parts of each frame change.
+// Damaged regions are accumulated per frame and, at most once per update
+// interval, read back through MIT-SHM and box-filtered into fixed-size slots of
+// a thumbnail atlas. Only the thumbnail pixels covering damaged regions are
+// recomputed, and no work is done while nothing changes, so thumbnails are
+// always ready when an overview is opened. Unmapped frames have no contents to
+// read, so their damage is dropped and their thumbnails are kept as they were
+// until they are mapped again.
+class Thumbnailer {
+ public:
+  // Creates a Thumbnailer producing thumbnails of size thumbnail_size x
+  // thumbnail_size. Returns nullptr if XComposite or XDamage is unavailable.
+  static ::std::unique_ptr<Thumbnailer> Create(
+      Display* display,
+      TimerQueue* timers,
+      int thumbnail_size,
+      ::std::chrono::milliseconds update_interval);
+
+  ~Thumbnailer();
+
+  // Starts maintaining a thumbnail for a mapped frame window of the given
+  // size, excluding its border of the given width.
+  void AddFrame(Window frame, const Size<int>& size, int border_width);
+  // Stops maintaining a thumbnail for a frame window.
+  void RemoveFrame(Window frame);
+  // Updates the size and border width of a frame window, redrawing its whole
+  // thumbnail if either changed.
+  void SetSize(Window frame, const Size<int>& size, int border_width);
+  // Updates whether a frame window is mapped, redrawing its whole thumbnail
+  // once it is mapped again. Must be called before the frame is unmapped, or
+  // on its UnmapNotify if unmapped by its client.
+  void SetMapped(Window frame, bool mapped);
+  // Handles XDamage events. Returns false if the event is not an XDamage
+  // event.
+  bool HandleEvent(const XEvent& e);
+
+  // Returns the thumbnail of a frame window, as thumbnail_size() rows of
+  // thumbnail_size() 0xAARRGGBB pixels with the frame scaled to fit and
+  // centered. Returns nullptr if the frame has no thumbnail.
+  const uint32_t* Get(Window frame) const;
+  // Width and height of thumbnails.
+  int thumbnail_size() const { return thumbnail_size_; }
+  // Returns the number of frames with thumbnails.
+  size_t size() const { return thumbnails_.size(); }
+
+ private:
+  // A maintained thumbnail.
+  struct Thumbnail {
+    // Index of the atlas slot holding the thumbnail.
+    size_t slot;
+    // XDamage object tracking the frame window.
+    Damage damage;
+    // Size of the frame window, excluding its border.
+    Size<int> size;
+    int border_width;
+    // Whether the frame window is mapped, and so has contents to read.
+    bool mapped;
+    // Bounding box of damage not yet applied to the thumbnail, relative to
+    // the frame window, or empty if none.
+    Rect<int> dirty;
+  };
+
+  // Invoked internally by Create().
+  Thumbnailer(
+      Display* display,
+      TimerQueue* timers,
+      int thumbnail_size,
+      ::std::chrono::milliseconds update_interval,
+      int damage_event_base,
+      ::std::unique_ptr<ShmSegment> shm);
+  // Adds a damaged region to a thumbnail and schedules an update.
+  void AddDamage(Thumbnail* thumbnail, const Rect<int>& rect);
+  // Applies accumulated damage to all thumbnails.
+  void Update();
+  // Applies accumulated damage to a thumbnail.
+  void UpdateThumbnail(Window frame, Thumbnail* thumbnail);
+
+  // Handle to the underlying Xlib Display struct.
+  Display* const display_;
+  // Visual and depth of frame windows.
+  Visual* const visual_;
+  const int depth_;
+  // Timers for pacing updates.
+  TimerQueue* const timers_;
+  // Width and height of thumbnails.
+  const int thumbnail_size_;
+  // Minimum time between updates.
+  const ::std::chrono::milliseconds update_interval_;
+  // Event code of XDamageNotify events.
+  const int damage_event_;
+  // MIT-SHM segment for reading frame contents, or nullptr if unavailable.
+  ::std::unique_ptr<ShmSegment> shm_;
+  // Pixel storage for all thumbnails, in fixed-size slots.
+  ::std::vector<uint32_t> atlas_;
+  // Indices of unused atlas slots.
+  ::std::vector<size_t> free_slots_;
+  // Maintained thumbnails, keyed by frame window.
+  ::std::unordered_map<Window, Thumbnail> thumbnails_;
+  // Pending update, or 0 if none.
+  TimerQueue::TimerId update_timer_;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#include "timer_queue.hpp"
+
+using ::std::chrono::duration_cast;
+using ::std::chrono::milliseconds;
+using ::std::make_pair;
+
+TimerQueue::TimerQueue()
+    : next_id_(1) {
+}
+
+TimerQueue::TimerId TimerQueue::Add(Clock::duration delay, Callback callback) {
+  const TimerId id = next_id_++;
+  const Clock::time_point deadline = Clock::now() + delay;
+  timers_.emplace(make_pair(deadline, id), ::std::move(callback));
+  deadlines_[id] = deadline;
+  return id;
+}
+
+void TimerQueue::Cancel(TimerId id) {
+  auto i = deadlines_.find(id);
+  if (i == deadlines_.end()) {
+    return;
+  }
+  timers_.erase(make_pair(i->second, id));
+  deadlines_.erase(i);
+}
+
+int TimerQueue::GetPollTimeout() const {
+  if (timers_.empty()) {
+    return -1;
+  }
+  const Clock::duration remaining =
+      timers_.begin()->first.first - Clock::now();
+  if (remaining <= Clock::duration::zero()) {
+    return 0;
+  }
+  // Round up so that we don't wake up just before the deadline and spin.
+  return duration_cast<milliseconds>(remaining + milliseconds(1) -
+                                     Clock::duration(1)).count();
+}
+
+void TimerQueue::RunExpired() {
+  // Timers are removed one at a time before running their callbacks, as a
+  // callback may add timers or cancel other expired timers.
+  const Clock::time_point now = Clock::now();
+  while (!timers_.empty() && timers_.begin()->first.first <= now) {
+    auto i = timers_.begin();
+    const Callback callback = ::std::move(i->second);
+    deadlines_.erase(i->first.second);
+    timers_.erase(i);
+    callback();
+  }
+}
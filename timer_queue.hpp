@@ -0,0 +1,43 @@
+#ifndef TIMER_QUEUE_HPP
+#define TIMER_QUEUE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+// One-shot timers driven by the window manager's main loop. The main loop
+// passes GetPollTimeout() to poll() and calls RunExpired() after it returns,
+// so waiting for a timer never blocks event handling.
+class TimerQueue {
+ public:
+  typedef ::std::chrono::steady_clock Clock;
+  typedef uint64_t TimerId;
+  typedef ::std::function<void()> Callback;
+
+  TimerQueue();
+
+  // Schedules callback to run after delay. Returns an ID that can be passed to
+  // Cancel().
+  TimerId Add(Clock::duration delay, Callback callback);
+  // Cancels a pending timer. Does nothing if the timer has already run or been
+  // cancelled.
+  void Cancel(TimerId id);
+  // Returns the number of milliseconds until the next timer expires, rounded
+  // up, or -1 if there are no pending timers.
+  int GetPollTimeout() const;
+  // Runs the callbacks of all expired timers.
+  void RunExpired();
+
+ private:
+  // Pending timers, ordered by expiry time and then by ID.
+  ::std::map<::std::pair<Clock::time_point, TimerId>, Callback> timers_;
+  // Maps pending timer IDs to their expiry times.
+  ::std::unordered_map<TimerId, Clock::time_point> deadlines_;
+  // ID to assign to the next timer.
+  TimerId next_id_;
+};
+
+#endif
@@ -1,4 +1,9 @@
 #include "util.hpp"
+extern "C" {
+#include <unistd.h>
+}
+#include <cerrno>
+#include <cstdint>
 #include <sstream>
 #include <vector>
 
@@ -7,46 +12,55 @@ using ::std::vector;
 using ::std::pair;
 using ::std::ostringstream;
 
-string ToString(const XEvent& e) {
-  static const char* const X_EVENT_TYPE_NAMES[] = {
-      "",
-      "",
-      "KeyPress",
-      "KeyRelease",
-      "ButtonPress",
-      "ButtonRelease",
-      "MotionNotify",
-      "EnterNotify",
-      "LeaveNotify",
-      "FocusIn",
-      "FocusOut",
-      "KeymapNotify",
-      "Expose",
-      "GraphicsExpose",
-      "NoExpose",
-      "VisibilityNotify",
-      "CreateNotify",
-      "DestroyNotify",
-      "UnmapNotify",
-      "MapNotify",
-      "MapRequest",
-      "ReparentNotify",
-      "ConfigureNotify",
-      "ConfigureRequest",
-      "GravityNotify",
-      "ResizeRequest",
-      "CirculateNotify",
-      "CirculateRequest",
-      "PropertyNotify",
-      "SelectionClear",
-      "SelectionRequest",
-      "SelectionNotify",
-      "ColormapNotify",
-      "ClientMessage",
-      "MappingNotify",
-      "GeneralEvent",
-  };
+namespace {
+
+const char* const X_EVENT_TYPE_NAMES[] = {
+    "",
+    "",
+    "KeyPress",
+    "KeyRelease",
+    "ButtonPress",
+    "ButtonRelease",
+    "MotionNotify",
+    "EnterNotify",
+    "LeaveNotify",
+    "FocusIn",
+    "FocusOut",
+    "KeymapNotify",
+    "Expose",
+    "GraphicsExpose",
+    "NoExpose",
+    "VisibilityNotify",
+    "CreateNotify",
+    "DestroyNotify",
+    "UnmapNotify",
+    "MapNotify",
+    "MapRequest",
+    "ReparentNotify",
+    "ConfigureNotify",
+    "ConfigureRequest",
+    "GravityNotify",
+    "ResizeRequest",
+    "CirculateNotify",
+    "CirculateRequest",
+    "PropertyNotify",
+    "SelectionClear",
+    "SelectionRequest",
+    "SelectionNotify",
+    "ColormapNotify",
+    "ClientMessage",
+    "MappingNotify",
+    "GeneralEvent",
+};
+
+}  // namespace
 
+const char* XEventTypeName(int type) {
+  return (type >= 2 && type < LASTEvent) ? X_EVENT_TYPE_NAMES[type]
+                                          : "Unknown";
+}
+
+string ToString(const XEvent& e) {
   if (e.type < 2 || e.type >= LASTEvent) {
     ostringstream out;
     out << "Unknown (" << e.type << ")";
@@ -345,3 +359,13 @@ string XRequestCodeToString(unsigned char request_code) {
   };
   return X_REQUEST_CODE_NAMES[request_code];
 }
+
+void SignalEventFd(int fd) {
+  const uint64_t one = 1;
+  while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+}
+
+void DrainEventFd(int fd) {
+  uint64_t count;
+  while (read(fd, &count, sizeof(count)) < 0 && errno == EINTR) {}
+}
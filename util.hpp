@@ -55,6 +55,29 @@ struct Vector2D {
 template <typename T>
 ::std::ostream& operator << (::std::ostream& out, const Position<T>& pos);
 
+// Represents a 2D rectangle.
+template <typename T>
+struct Rect {
+  T x, y, width, height;
+
+  Rect() = default;
+  Rect(T _x, T _y, T w, T h)
+      : x(_x), y(_y), width(w), height(h) {
+  }
+  Rect(const Position<T>& pos, const Size<T>& size)
+      : x(pos.x), y(pos.y), width(size.width), height(size.height) {
+  }
+
+  Position<T> position() const { return Position<T>(x, y); }
+  Size<T> size() const { return Size<T>(width, height); }
+
+  ::std::string ToString() const;
+};
+
+// Outputs a Rect<T> as a string to a std::ostream.
+template <typename T>
+::std::ostream& operator << (::std::ostream& out, const Rect<T>& rect);
+
 // Position operators.
 template <typename T>
 Vector2D<T> operator - (const Position<T>& a, const Position<T>& b);
@@ -95,6 +118,9 @@ template <typename Container, typename Converter>
 template <typename T>
 ::std::string ToString(const T& x);
 
+// Returns the name of a core X event type, or "Unknown" for other types.
+extern const char* XEventTypeName(int type);
+
 // Returns a string describing an X event for debugging purposes.
 extern ::std::string ToString(const XEvent& e);
 
@@ -104,6 +130,13 @@ extern ::std::string XConfigureWindowValueMaskToString(unsigned long value_mask)
 // Returns the name of an X request code.
 extern ::std::string XRequestCodeToString(unsigned char request_code);
 
+// Increments an eventfd counter, waking up threads waiting for it.
+extern void SignalEventFd(int fd);
+
+// Resets an eventfd counter, blocking until it is non-zero if the eventfd is
+// blocking.
+extern void DrainEventFd(int fd);
+
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  *                               IMPLEMENTATION                              *
@@ -148,6 +181,18 @@ template <typename T>
   return out << size.ToString();
 }
 
+template <typename T>
+::std::string Rect<T>::ToString() const {
+  ::std::ostringstream out;
+  out << Size<T>(width, height) << '+' << x << '+' << y;
+  return out.str();
+}
+
+template <typename T>
+::std::ostream& operator << (::std::ostream& out, const Rect<T>& rect) {
+  return out << rect.ToString();
+}
+
 template <typename T>
 Vector2D<T> operator - (const Position<T>& a, const Position<T>& b) {
   return Vector2D<T>(a.x - b.x, a.y - b.y);
@@ -2,20 +2,46 @@
 extern "C" {
 #include <X11/Xutil.h>
 }
-#include <cstring>
+extern "C" {
+#include <poll.h>
+}
+#include <cerrno>
 #include <algorithm>
+#include <iomanip>
+#include <sstream>
 #include <glog/logging.h>
 #include "util.hpp"
 
 using ::std::max;
 using ::std::mutex;
+using ::std::ostream;
+using ::std::ostringstream;
+using ::std::pair;
 using ::std::string;
 using ::std::unique_ptr;
+using ::std::unordered_map;
+using ::std::vector;
+
+namespace {
+
+// X request budgets of common operations, checked when request accounting is
+// enabled. Framing waits for the client's attributes, and switching windows
+// may wait for a pending MIT-SHM upload of a title bar.
+const RequestStats::Budget FRAME_BUDGET = {20, 1};
+const RequestStats::Budget UNFRAME_BUDGET = {14, 0};
+const RequestStats::Budget ALT_TAB_BUDGET = {24, 1};
+
+// Number of recent drags whose measurements are kept for the drags control
+// command.
+const size_t MAX_DRAG_STATS = 32;
+
+}  // namespace
 
 bool WindowManager::wm_detected_;
 mutex WindowManager::wm_detected_mutex_;
 
-unique_ptr<WindowManager> WindowManager::Create(const string& display_str) {
+unique_ptr<WindowManager> WindowManager::Create(
+    const Config& config, const string& display_str) {
   // 1. Open X display.
   const char* display_c_str =
         display_str.empty() ? nullptr : display_str.c_str();
@@ -24,18 +50,100 @@ unique_ptr<WindowManager> WindowManager::Create(const string& display_str) {
     LOG(ERROR) << "Failed to open X display " << XDisplayName(display_c_str);
     return nullptr;
   }
-  // 2. Construct WindowManager instance.
-  return unique_ptr<WindowManager>(new WindowManager(display));
+  // 2. Start control interface if enabled.
+  unique_ptr<ControlServer> control_server;
+  if (!config.control_socket_path.empty()) {
+    control_server = ControlServer::Create(config.control_socket_path);
+    if (!control_server) {
+      XCloseDisplay(display);
+      return nullptr;
+    }
+  }
+  // 3. Start property fetcher on a separate connection to the same display.
+  unique_ptr<PropertyFetcher> property_fetcher =
+      PropertyFetcher::Create(XDisplayString(display));
+  if (!property_fetcher) {
+    XCloseDisplay(display);
+    return nullptr;
+  }
+  // 4. Start drag handler on another connection, so that drags don't wait for
+  // the main event loop.
+  unique_ptr<DragHandler> drag_handler = DragHandler::Create(
+      XDisplayString(display),
+      config,
+      config.reparent ? BORDER_WIDTH : 0,
+      config.reparent ? Decorator::TITLE_HEIGHT : 0);
+  if (!drag_handler) {
+    XCloseDisplay(display);
+    return nullptr;
+  }
+  // 5. Set up frame decorations.
+  unique_ptr<Decorator> decorator = Decorator::Create(display);
+  if (!decorator) {
+    XCloseDisplay(display);
+    return nullptr;
+  }
+  // 6. Construct WindowManager instance.
+  return unique_ptr<WindowManager>(new WindowManager(
+      display,
+      config,
+      ::std::move(control_server),
+      ::std::move(property_fetcher),
+      ::std::move(drag_handler),
+      ::std::move(decorator)));
 }
 
-WindowManager::WindowManager(Display* display)
-    : display_(CHECK_NOTNULL(display)),
+WindowManager::WindowManager(
+    Display* display,
+    const Config& config,
+    unique_ptr<ControlServer> control_server,
+    unique_ptr<PropertyFetcher> property_fetcher,
+    unique_ptr<DragHandler> drag_handler,
+    unique_ptr<Decorator> decorator)
+    : config_(config),
+      border_width_(config_.reparent ? BORDER_WIDTH : 0),
+      title_height_(config_.reparent ? Decorator::TITLE_HEIGHT : 0),
+      display_(CHECK_NOTNULL(display)),
       root_(DefaultRootWindow(display_)),
-      WM_PROTOCOLS(XInternAtom(display_, "WM_PROTOCOLS", false)),
-      WM_DELETE_WINDOW(XInternAtom(display_, "WM_DELETE_WINDOW", false)) {
+      output_layout_(display_),
+      stacking_(display_),
+      control_server_(::std::move(control_server)),
+      scheduler_(display_, &timers_, config_.client_event_rate),
+      liveness_(display_, &timers_, config_.close_timeout),
+      property_fetcher_(::std::move(property_fetcher)),
+      drag_handler_(::std::move(drag_handler)),
+      icon_cache_(config_.icon_size, config_.icon_cache_kb * 1024),
+      decorator_(::std::move(decorator)),
+      focused_(None),
+      focus_target_(None),
+      focus_timer_(0),
+      crossing_serial_(NextRequest(display_)),
+      WM_STATE(XInternAtom(display_, "WM_STATE", false)),
+      WM_CHANGE_STATE(XInternAtom(display_, "WM_CHANGE_STATE", false)) {
+  if (config_.request_stats) {
+    request_stats_.reset(new RequestStats(display_));
+  }
+  drag_handler_->SetOutputs(output_layout_.outputs());
+  if (!config_.rules_path.empty()) {
+    string error;
+    rules_ = WindowRules::Load(config_.rules_path, &error);
+    LOG_IF(ERROR, !rules_) << "Window rules disabled: " << error;
+  }
+  if (config_.thumbnail_size > 0) {
+    thumbnailer_ = Thumbnailer::Create(
+        display_,
+        &timers_,
+        config_.thumbnail_size,
+        config_.thumbnail_interval);
+    LOG_IF(WARNING, !thumbnailer_) << "Thumbnails disabled";
+  }
 }
 
 WindowManager::~WindowManager() {
+  // Release server-side resources while the display is still open.
+  thumbnailer_.reset();
+  decorator_.reset();
+  request_stats_.reset();
   XCloseDisplay(display_);
 }
 
@@ -86,139 +194,577 @@ void WindowManager::Run() {
   XUngrabServer(display_);
 
   // 2. Main event loop.
+  const ControlServer::BatchHandler control_handler =
+      [this] (const vector<ControlCommand>& batch, ostream* reply) {
+        return ExecuteControlBatch(batch, reply);
+      };
   for (;;) {
-    // 1. Get next event.
-    XEvent e;
-    XNextEvent(display_, &e);
-    LOG(INFO) << "Received event: " << ToString(e);
-
-    // 2. Dispatch event.
-    switch (e.type) {
-      case CreateNotify:
-        OnCreateNotify(e.xcreatewindow);
+    // 1. Handle queued events, fairly between X clients. Events are read from
+    // the X connection before each event is handled, so that input events
+    // arriving meanwhile are handled next.
+    for (;;) {
+      while (XPending(display_)) {
+        XEvent e;
+        XNextEvent(display_, &e);
+        scheduler_.Push(e);
+      }
+      XEvent e;
+      if (!scheduler_.Pop(&e)) {
         break;
-      case DestroyNotify:
-        OnDestroyNotify(e.xdestroywindow);
+      }
+      VLOG(2) << "Received event: " << ToString(e);
+      DispatchEvent(&e);
+    }
+    FinishTransitions();
+    // Re-query outputs once for all RandR notifications handled, and move
+    // frames off outputs that changed.
+    vector<Rect<int>> changed_outputs;
+    if (output_layout_.Update(&changed_outputs)) {
+      drag_handler_->SetOutputs(output_layout_.outputs());
+      RelocateFrames(changed_outputs);
+    }
+    if (config_.focus_follows_mouse) {
+      MarkOwnCrossings();
+    }
+    XFlush(display_);
+
+    // 2. Wait for more events from the X server, the property fetcher, the
+    // drag handler or the control socket, or for the next timer to expire.
+    vector<pollfd> fds;
+    fds.push_back({ConnectionNumber(display_), POLLIN, 0});
+    fds.push_back({property_fetcher_->result_fd(), POLLIN, 0});
+    fds.push_back({drag_handler_->result_fd(), POLLIN, 0});
+    if (control_server_) {
+      control_server_->AddPollFds(&fds);
+    }
+    if (poll(fds.data(), fds.size(), timers_.GetPollTimeout()) < 0) {
+      PCHECK(errno == EINTR) << "poll() failed";
+      continue;
+    }
+
+    // 3. Apply fetched client properties and drag results.
+    if (fds[1].revents & POLLIN) {
+      ApplyPropertyUpdates();
+    }
+    if (fds[2].revents & POLLIN) {
+      ApplyDragResults();
+    }
+
+    // 4. Service control connections.
+    if (control_server_) {
+      control_server_->HandlePollFds(
+          fds.data() + 3, fds.size() - 3, control_handler);
+    }
+
+    // 5. Run expired timers.
+    timers_.RunExpired();
+  }
+}
+
+void WindowManager::DispatchEvent(XEvent* e) {
+  // Account for requests per event type. Extension events are accounted for
+  // together under "Unknown".
+  const RequestStats::Scope scope(
+      request_stats_.get(), XEventTypeName(e->type));
+  switch (e->type) {
+    case CreateNotify:
+      OnCreateNotify(e->xcreatewindow);
+      break;
+    case DestroyNotify:
+      OnDestroyNotify(e->xdestroywindow);
+      break;
+    case ReparentNotify:
+      OnReparentNotify(e->xreparent);
+      break;
+    case MapNotify:
+      OnMapNotify(e->xmap);
+      break;
+    case UnmapNotify:
+      OnUnmapNotify(e->xunmap);
+      break;
+    case ConfigureNotify:
+      OnConfigureNotify(e->xconfigure);
+      break;
+    case MapRequest:
+      OnMapRequest(e->xmaprequest);
+      break;
+    case ConfigureRequest:
+      OnConfigureRequest(e->xconfigurerequest);
+      break;
+    case KeyPress:
+      OnKeyPress(e->xkey);
+      break;
+    case KeyRelease:
+      OnKeyRelease(e->xkey);
+      break;
+    case MotionNotify:
+      OnMotionNotify(e->xmotion);
+      break;
+    case PropertyNotify:
+      OnPropertyNotify(e->xproperty);
+      break;
+    case ClientMessage:
+      OnClientMessage(e->xclient);
+      break;
+    case Expose:
+      OnExpose(e->xexpose);
+      break;
+    case EnterNotify:
+      OnEnterNotify(e->xcrossing);
+      break;
+    case LeaveNotify:
+      OnLeaveNotify(e->xcrossing);
+      break;
+    default: {
+      if (output_layout_.HandleEvent(e)) {
         break;
-      case ReparentNotify:
-        OnReparentNotify(e.xreparent);
+      }
+      if (thumbnailer_ && thumbnailer_->HandleEvent(*e)) {
         break;
-      case MapNotify:
-        OnMapNotify(e.xmap);
+      }
+      LOG(WARNING) << "Ignored event";
+    }
+  }
+}
+
+void WindowManager::ApplyPropertyUpdates() {
+  PropertyUpdate update;
+  while (property_fetcher_->PopUpdate(&update)) {
+    // Frame windows waiting for window rules once their WM_CLASS arrives. It
+    // was requested after WM_WINDOW_ROLE, and the fetcher answers in order.
+    auto m = matching_properties_.find(update.window);
+    if (m != matching_properties_.end()) {
+      const bool done = update.property == ClientProperty::CLASS;
+      m->second.Apply(::std::move(update));
+      if (done) {
+        const Window w = m->first;
+        const ClientProperties properties = ::std::move(m->second);
+        matching_properties_.erase(m);
+        FinishMatching(w, properties);
+      }
+      continue;
+    }
+    // Learn the WM_CLASS of windows within their grace period, and frame them
+    // right away if their class is long-lived.
+    auto d = deferred_.find(update.window);
+    if (d != deferred_.end() && update.property == ClientProperty::CLASS &&
+        !d->second.has_class) {
+      d->second.has_class = true;
+      d->second.class_name = update.class_name;
+      auto s = client_states_.find(update.window);
+      if (s != client_states_.end() && s->second == ClientState::DEFERRED &&
+          framing_history_.IsLongLived(update.class_name)) {
+        FrameDeferred(update.window, FramingHistory::Reason::CLASS);
+      }
+    }
+    // Drop updates for windows unframed since the fetch was requested.
+    auto i = client_properties_.find(update.window);
+    if (i == client_properties_.end()) {
+      continue;
+    }
+    const ClientProperty property = update.property;
+    i->second.Apply(::std::move(update));
+    const Window frame = clients_[i->first];
+    if (property == ClientProperty::NAME ||
+        property == ClientProperty::NET_WM_NAME) {
+      decorator_->SetTitle(frame, i->second.title());
+    } else if (property == ClientProperty::NET_WM_ICON) {
+      // Scale new icons right away rather than when a window list is shown.
+      icon_cache_.Invalidate(i->first);
+      decorator_->SetIcon(
+          frame,
+          icon_cache_.Get(i->first, i->second),
+          icon_cache_.icon_size());
+    } else if (property == ClientProperty::TRANSIENT_FOR) {
+      stacking_.SetTransientFor(i->first, i->second.transient_for);
+    } else if (property == ClientProperty::PROTOCOLS) {
+      liveness_.SetProtocols(
+          i->first,
+          i->second.supports_delete_window,
+          i->second.supports_ping);
+    } else if (property == ClientProperty::NET_WM_WINDOW_TYPE ||
+               property == ClientProperty::NET_WM_STATE) {
+      stacking_.SetLayer(
+          i->first,
+          i->second.dock ? StackingLayer::DOCK
+                         : i->second.above ? StackingLayer::ABOVE
+                                           : StackingLayer::NORMAL);
+    }
+    VLOG(1) << "Updated properties of window " << i->first << ": \""
+            << i->second.title() << "\" (" << i->second.instance_name
+            << ", " << i->second.class_name << ")";
+  }
+  stacking_.Restack();
+}
+
+void WindowManager::ApplyDragResults() {
+  // Latest frame size of each client resized by drags, so that a client is
+  // resized once however many resizes of its frame were applied meanwhile.
+  unordered_map<Window, Size<int>> resized;
+  DragResult result;
+  while (drag_handler_->PopResult(&result)) {
+    // Drop results for windows unframed since the drag started.
+    auto i = client_states_.find(result.window);
+    if (i == client_states_.end() || i->second != ClientState::FRAMED) {
+      continue;
+    }
+    switch (result.type) {
+      case DragResult::Type::STARTED:
+        // Raise dragged window to top, along with its transients.
+        stacking_.Raise(result.window);
+        break;
+      case DragResult::Type::RESIZED:
+        resized[result.window] = result.geometry.size();
+        break;
+      case DragResult::Type::FINISHED:
+        frame_geometries_[clients_[result.window]] = result.geometry;
+        // Keep the measurements of recent drags.
+        VLOG(1) << "Dragged window " << result.window << ": "
+                << result.stats.num_events << " events, "
+                << result.stats.num_updates << " updates, max latency "
+                << result.stats.max_latency << " ms";
+        drag_stats_.emplace_back(result.window, result.stats);
+        if (drag_stats_.size() > MAX_DRAG_STATS) {
+          drag_stats_.pop_front();
+        }
+        break;
+    }
+  }
+  // Resize clients to fit below the title bars of their frames, which the drag
+  // handler resizes.
+  for (const auto& i : resized) {
+    XResizeWindow(
+        display_, i.first, i.second.width, i.second.height - title_height_);
+  }
+  stacking_.Restack();
+}
+
+string WindowManager::ExecuteControlBatch(
+    const vector<ControlCommand>& batch, ostream* reply) {
+  string error;
+  for (const ControlCommand& command : batch) {
+    // 1. Look up target client.
+    Window frame = None;
+    if (command.type != ControlCommand::Type::LIST &&
+        command.type != ControlCommand::Type::STATS &&
+        command.type != ControlCommand::Type::EVENTS &&
+        command.type != ControlCommand::Type::RELOAD &&
+        command.type != ControlCommand::Type::FRAMING &&
+        command.type != ControlCommand::Type::DRAGS &&
+        command.type != ControlCommand::Type::TABLES &&
+        command.type != ControlCommand::Type::VERBOSITY) {
+      auto i = clients_.find(command.window);
+      if (i == clients_.end() ||
+          (client_states_[command.window] != ClientState::FRAMED &&
+           client_states_[command.window] != ClientState::ICONIC)) {
+        if (error.empty()) {
+          ostringstream out;
+          out << "unknown window " << command.window;
+          error = out.str();
+        }
+        continue;
+      }
+      frame = i->second;
+    }
+
+    // 2. Execute command.
+    switch (command.type) {
+      case ControlCommand::Type::MOVE: {
+        XMoveWindow(display_, frame, command.args[0], command.args[1]);
+        Rect<int>& geometry = frame_geometries_[frame];
+        geometry.x = command.args[0];
+        geometry.y = command.args[1];
+        break;
+      }
+      case ControlCommand::Type::RESIZE:
+        ResizeFrame(
+            command.window,
+            frame,
+            Size<int>(command.args[0], command.args[1]));
         break;
-      case UnmapNotify:
-        OnUnmapNotify(e.xunmap);
+      case ControlCommand::Type::RAISE:
+        stacking_.Raise(command.window);
         break;
-      case ConfigureNotify:
-        OnConfigureNotify(e.xconfigure);
+      case ControlCommand::Type::FOCUS:
+        Focus(command.window);
         break;
-      case MapRequest:
-        OnMapRequest(e.xmaprequest);
+      case ControlCommand::Type::CLOSE:
+        if (!Close(command.window, CurrentTime) && error.empty()) {
+          ostringstream out;
+          out << "cannot close window " << command.window;
+          error = out.str();
+        }
         break;
-      case ConfigureRequest:
-        OnConfigureRequest(e.xconfigurerequest);
+      case ControlCommand::Type::THUMBNAIL: {
+        const uint32_t* pixels =
+            thumbnailer_ ? thumbnailer_->Get(frame) : nullptr;
+        if (pixels == nullptr) {
+          if (error.empty()) {
+            ostringstream out;
+            out << "no thumbnail for window " << command.window;
+            error = out.str();
+          }
+          break;
+        }
+        // One line of hexadecimal 0xAARRGGBB pixels per row.
+        const int size = thumbnailer_->thumbnail_size();
+        *reply << "thumbnail " << size << " " << size << "\n"
+               << ::std::hex << ::std::setfill('0');
+        for (int y = 0; y < size; ++y) {
+          for (int x = 0; x < size; ++x) {
+            *reply << ::std::setw(8) << pixels[y * size + x];
+          }
+          *reply << "\n";
+        }
+        *reply << ::std::dec << ::std::setfill(' ');
         break;
-      case ButtonPress:
-        OnButtonPress(e.xbutton);
+      }
+      case ControlCommand::Type::STATS:
+        if (request_stats_) {
+          *reply << request_stats_->ToString();
+        }
         break;
-      case ButtonRelease:
-        OnButtonRelease(e.xbutton);
+      case ControlCommand::Type::RELOAD: {
+        if (config_.rules_path.empty()) {
+          if (error.empty()) {
+            error = "no rules file configured";
+          }
+          break;
+        }
+        string load_error;
+        unique_ptr<WindowRules> rules =
+            WindowRules::Load(config_.rules_path, &load_error);
+        if (!rules) {
+          // Keep the current rules.
+          if (error.empty()) {
+            error = load_error;
+          }
+          break;
+        }
+        rules_ = ::std::move(rules);
+        LOG(INFO) << "Reloaded " << rules_->size() << " window rules";
         break;
-      case MotionNotify:
-        // Skip any already pending motion events.
-        while (XCheckTypedWindowEvent(
-            display_, e.xmotion.window, MotionNotify, &e)) {}
-        OnMotionNotify(e.xmotion);
+      }
+      case ControlCommand::Type::EVENTS:
+        *reply << scheduler_.ToString();
         break;
-      case KeyPress:
-        OnKeyPress(e.xkey);
+      case ControlCommand::Type::FRAMING:
+        *reply << framing_history_.ToString();
         break;
-      case KeyRelease:
-        OnKeyRelease(e.xkey);
+      case ControlCommand::Type::DRAGS:
+        for (const auto& i : drag_stats_) {
+          const DragStats& stats = i.second;
+          ostringstream latency;
+          latency << ::std::fixed << ::std::setprecision(2)
+                  << (stats.num_samples > 0 ?
+                          stats.total_latency / stats.num_samples : 0)
+                  << " " << stats.max_latency;
+          *reply << "drag " << i.first << " "
+                 << (stats.move ? "move" : "resize")
+                 << " events " << stats.num_events
+                 << " updates " << stats.num_updates
+                 << " unmatched " << stats.num_unmatched
+                 << " latency_ms " << latency.str() << "\n";
+        }
+        break;
+      case ControlCommand::Type::TABLES: {
+        const pair<const char*, size_t> tables[] = {
+            {"clients", clients_.size()},
+            {"frames", frames_.size()},
+            {"client_states", client_states_.size()},
+            {"pending_transitions", pending_transitions_.size()},
+            {"unframe_timers", unframe_timers_.size()},
+            {"frame_geometries", frame_geometries_.size()},
+            {"stacking", stacking_.size()},
+            {"client_properties", client_properties_.size()},
+            {"matching_properties", matching_properties_.size()},
+            {"deferred", deferred_.size()},
+            {"liveness", liveness_.size()},
+            {"decorations", decorator_->size()},
+            {"thumbnails", thumbnailer_ ? thumbnailer_->size() : 0},
+        };
+        for (const auto& table : tables) {
+          *reply << "table " << table.first << " " << table.second << "\n";
+        }
+        break;
+      }
+      case ControlCommand::Type::VERBOSITY:
+        ::google::SetVLOGLevel(command.module.c_str(), command.args[0]);
+        break;
+      case ControlCommand::Type::LIST:
+        for (const Window w : stacking_.clients()) {
+          const Window client_frame = clients_[w];
+          const Rect<int>& geometry = frame_geometries_[client_frame];
+          *reply << "client " << w << " " << client_frame << " "
+                 << geometry.x << " " << geometry.y << " "
+                 << geometry.width << " " << geometry.height << "\n";
+        }
         break;
-      default:
-        LOG(WARNING) << "Ignored event";
     }
   }
+  // 3. Send all resulting requests at once.
+  stacking_.Restack();
+  XFlush(display_);
+  return error;
 }
 
-void WindowManager::Frame(Window w, bool was_created_before_window_manager) {
-  // Visual properties of the frame to create.
-  const unsigned int BORDER_WIDTH = 3;
-  const unsigned long BORDER_COLOR = 0xff0000;
-  const unsigned long BG_COLOR = 0x0000ff;
-
+void WindowManager::Frame(
+    Window w,
+    bool already_mapped,
+    const WindowRuleDecision& decision) {
   // We shouldn't be framing windows we've already framed.
   CHECK(!clients_.count(w));
+  const RequestStats::Scope scope(
+      request_stats_.get(), "Frame", &FRAME_BUDGET);
 
-  // 1. Retrieve attributes of window to frame.
+  // 1. Retrieve attributes of window to frame. The window may already have
+  // been destroyed by the time we ask.
   XWindowAttributes x_window_attrs;
-  CHECK(XGetWindowAttributes(display_, w, &x_window_attrs));
+  if (!XGetWindowAttributes(display_, w, &x_window_attrs)) {
+    LOG(WARNING) << "Not framing window " << w << " that no longer exists";
+    client_states_.erase(w);
+    return;
+  }
 
-  // 2. If window was created before window manager started, we should frame
-  // it only if it is visible and doesn't set override_redirect.
-  if (was_created_before_window_manager) {
+  // 2. If window is already mapped, because it was created before the window
+  // manager started or its framing was deferred, we should frame it only if it
+  // is still visible and doesn't set override_redirect.
+  if (already_mapped) {
     if (x_window_attrs.override_redirect ||
         x_window_attrs.map_state != IsViewable) {
       return;
     }
   }
 
-  // 3. Create frame.
-  const Window frame = XCreateSimpleWindow(
-      display_,
-      root_,
+  // 3. Place frame, with room for a title bar above the client. New windows
+  // are kept from straddling outputs or landing off-screen; windows that are
+  // already mapped stay where they are.
+  Rect<int> frame_geometry(
       x_window_attrs.x,
       x_window_attrs.y,
       x_window_attrs.width,
-      x_window_attrs.height,
-      BORDER_WIDTH,
-      BORDER_COLOR,
-      BG_COLOR);
-  // 4. Select events on frame.
+      x_window_attrs.height + title_height_);
+  if (!already_mapped) {
+    //   a. Apply placement decided by window rules. Positions are relative to
+    //   the chosen output, if it exists.
+    if (decision.has_size) {
+      frame_geometry.width = decision.size.width;
+      frame_geometry.height = decision.size.height + title_height_;
+    }
+    const vector<Rect<int>>& outputs = output_layout_.outputs();
+    Position<int> origin(0, 0);
+    if (decision.output >= 0 &&
+        decision.output < static_cast<int>(outputs.size())) {
+      origin = outputs[decision.output].position();
+      frame_geometry.x = origin.x;
+      frame_geometry.y = origin.y;
+    }
+    if (decision.has_position) {
+      frame_geometry.x = origin.x + decision.position.x;
+      frame_geometry.y = origin.y + decision.position.y;
+    }
+    //   b. Keep the frame within an output. Without a separate frame, the
+    //   client window moves as well.
+    frame_geometry = FitToOutput(frame_geometry);
+    const bool resized =
+        frame_geometry.width != x_window_attrs.width ||
+        frame_geometry.height != x_window_attrs.height + title_height_;
+    if (!config_.reparent &&
+        (resized ||
+         frame_geometry.x != x_window_attrs.x ||
+         frame_geometry.y != x_window_attrs.y)) {
+      XMoveResizeWindow(
+          display_, w,
+          frame_geometry.x, frame_geometry.y,
+          frame_geometry.width, frame_geometry.height);
+    } else if (resized) {
+      XResizeWindow(
+          display_, w,
+          frame_geometry.width,
+          frame_geometry.height - title_height_);
+    }
+  }
+
+  // 4. Create frame, and select events on it. The frame has no background, as
+  // the title bar is painted from a cached pixmap and the rest is covered by
+  // the client. It is override-redirect, so that the drag handler's
+  // connection can move and resize it without the requests being redirected
+  // to us. Without reparenting, the client window is its own frame, and is
+  // raised to where a new frame would be.
+  Window frame = w;
+  if (config_.reparent) {
+    XSetWindowAttributes frame_attrs;
+    frame_attrs.background_pixmap = None;
+    frame_attrs.border_pixel = Decorator::BorderColor(false);
+    frame_attrs.override_redirect = true;
+    frame_attrs.event_mask =
+        SubstructureRedirectMask | SubstructureNotifyMask | ExposureMask;
+    if (config_.focus_follows_mouse) {
+      frame_attrs.event_mask |= EnterWindowMask | LeaveWindowMask;
+    }
+    frame = XCreateWindow(
+        display_,
+        root_,
+        frame_geometry.x,
+        frame_geometry.y,
+        frame_geometry.width,
+        frame_geometry.height,
+        BORDER_WIDTH,
+        CopyFromParent,
+        InputOutput,
+        CopyFromParent,
+        CWBackPixmap | CWBorderPixel | CWOverrideRedirect | CWEventMask,
+        &frame_attrs);
+    decorator_->AddFrame(frame, frame_geometry.width);
+  } else {
+    XRaiseWindow(display_, w);
+  }
+  stacking_.Add(w, frame);
+  if (config_.reparent) {
+    // 5. Add client to save set, so that it will be restored and kept alive if
+    // we crash.
+    XAddToSaveSet(display_, w);
+    // 6. Reparent client window.
+    XReparentWindow(
+        display_,
+        w,
+        frame,
+        0, title_height_);  // Offset of client window within frame.
+    // 7. Map frame.
+    XMapWindow(display_, frame);
+  }
+  // 8. Start maintaining frame's thumbnail. Clients that are their own frames
+  // keep their own border.
+  if (thumbnailer_) {
+    thumbnailer_->AddFrame(
+        frame,
+        frame_geometry.size(),
+        config_.reparent ? border_width_ : x_window_attrs.border_width);
+  }
+  // 9. Mark client window as in the Normal state, select property changes,
+  // and crossings if it is its own frame, on it, start tracking its liveness,
+  // and fetch its properties in the background.
+  SetWMState(w, NormalState);
   XSelectInput(
-      display_,
-      frame,
-      SubstructureRedirectMask | SubstructureNotifyMask);
-  // 5. Add client to save set, so that it will be restored and kept alive if we
-  // crash.
-  XAddToSaveSet(display_, w);
-  // 6. Reparent client window.
-  XReparentWindow(
       display_,
       w,
-      frame,
-      0, 0);  // Offset of client window within frame.
-  // 7. Map frame.
-  XMapWindow(display_, frame);
-  // 8. Save frame handle.
+      PropertyChangeMask |
+          (!config_.reparent && config_.focus_follows_mouse
+               ? EnterWindowMask | LeaveWindowMask
+               : NoEventMask));
+  liveness_.AddClient(w);
+  client_properties_[w] = ClientProperties();
+  property_fetcher_->FetchAll(w);
+  // 10. Save frame handle, state and geometry.
   clients_[w] = frame;
-  // 9. Grab universal window management actions on client window.
-  //   a. Move windows with alt + left button.
-  XGrabButton(
-      display_,
-      Button1,
-      Mod1Mask,
-      w,
-      false,
-      ButtonPressMask | ButtonReleaseMask | ButtonMotionMask,
-      GrabModeAsync,
-      GrabModeAsync,
-      None,
-      None);
-  //   b. Resize windows with alt + right button.
-  XGrabButton(
-      display_,
-      Button3,
-      Mod1Mask,
-      w,
-      false,
-      ButtonPressMask | ButtonReleaseMask | ButtonMotionMask,
-      GrabModeAsync,
-      GrabModeAsync,
-      None,
-      None);
-  //   c. Kill windows with alt + f4.
+  frames_[frame] = w;
+  client_states_[w] = ClientState::FRAMED;
+  frame_geometries_[frame] = frame_geometry;
+  // 11. Grab universal window management actions on client window.
+  //   a. Move and resize windows with alt + drag, on the drag handler's
+  //   connection.
+  drag_handler_->AddClient(w, frame, frame_geometry);
+  //   b. Kill windows with alt + f4.
   XGrabKey(
       display_,
       XKeysymToKeycode(display_, XK_F4),
@@ -227,7 +773,7 @@ void WindowManager::Frame(Window w, bool was_created_before_window_manager) {
       false,
       GrabModeAsync,
       GrabModeAsync);
-  //   d. Switch windows with alt + tab.
+  //   c. Switch windows with alt + tab.
   XGrabKey(
       display_,
       XKeysymToKeycode(display_, XK_Tab),
@@ -237,46 +783,411 @@ void WindowManager::Frame(Window w, bool was_created_before_window_manager) {
       GrabModeAsync,
       GrabModeAsync);
 
-  LOG(INFO) << "Framed window " << w << " [" << frame << "]";
+  // 12. Move the frame below any windows in higher layers.
+  stacking_.Restack();
+
+  VLOG(1) << "Framed window " << w << " [" << frame << "]";
+  if (control_server_) {
+    control_server_->Publish(
+        CONTROL_EVENT_FRAME, ToString(w) + " " + ToString(frame));
+  }
 }
 
 void WindowManager::Unframe(Window w) {
   CHECK(clients_.count(w));
+  const RequestStats::Scope scope(
+      request_stats_.get(), "Unframe", &UNFRAME_BUDGET);
 
-  // We reverse the steps taken in Frame().
+  // We reverse the steps taken in Frame(). Requests on the client window are
+  // only issued if it still exists and is still inside the frame, i.e. it was
+  // withdrawn, in which case the frame is already unmapped.
   const Window frame = clients_[w];
-  // 1. Unmap frame.
-  XUnmapWindow(display_, frame);
-  // 2. Reparent client window.
-  XReparentWindow(
+  const bool withdrawn = client_states_[w] == ClientState::WITHDRAWN;
+  if (withdrawn) {
+    // 1. Reparent client window, and remove it from the save set, as it is now
+    // unrelated to us.
+    if (config_.reparent) {
+      XReparentWindow(
+          display_,
+          w,
+          root_,
+          0, 0);  // Offset of client window within root.
+      XRemoveFromSaveSet(display_, w);
+    }
+    // 2. Release our grabs and event selection on client window.
+    XUngrabKey(display_, AnyKey, AnyModifier, w);
+    XSelectInput(display_, w, NoEventMask);
+  }
+  // 3. Destroy frame.
+  stacking_.Remove(w);
+  stacking_.Restack();
+  if (thumbnailer_) {
+    thumbnailer_->RemoveFrame(frame);
+  }
+  if (config_.reparent) {
+    XDestroyWindow(display_, frame);
+  }
+  // 4. Drop reference to frame handle and per-client state. The drag handler
+  // releases its own grabs on the client window.
+  drag_handler_->RemoveClient(w, withdrawn);
+  clients_.erase(w);
+  frames_.erase(frame);
+  client_states_.erase(w);
+  liveness_.RemoveClient(w);
+  client_properties_.erase(w);
+  icon_cache_.Invalidate(w);
+  decorator_->RemoveFrame(frame);
+  if (focused_ == w) {
+    focused_ = None;
+  }
+  frame_geometries_.erase(frame);
+
+  VLOG(1) << "Unframed window " << w << " [" << frame << "]";
+  if (control_server_) {
+    control_server_->Publish(CONTROL_EVENT_UNFRAME, ToString(w));
+  }
+}
+
+void WindowManager::FinishMatching(
+    Window w, const ClientProperties& properties) {
+  // 1. Check that the window still wants to be mapped, as it may have been
+  // destroyed or reparented in the meantime.
+  auto i = client_states_.find(w);
+  if (i == client_states_.end() || i->second != ClientState::MATCHING) {
+    return;
+  }
+  // 2. Frame window as decided by rules. Framing of windows that rules don't
+  // place may be deferred.
+  const WindowRuleDecision decision = rules_->Match(
+      properties.class_name, properties.instance_name, properties.role);
+  if (decision.manage && config_.frame_delay.count() > 0 &&
+      decision.output < 0 && !decision.has_position && !decision.has_size) {
+    Defer(w, &properties.class_name);
+    return;
+  }
+  if (decision.manage) {
+    i->second = ClientState::PENDING;
+    Frame(w, false, decision);
+  } else {
+    VLOG(1) << "Not managing window " << w << " per window rules";
+    client_states_.erase(i);
+  }
+  // 3. Actually map window.
+  XMapWindow(display_, w);
+}
+
+void WindowManager::Defer(Window w, const string* class_name) {
+  // 1. Watch the window's lifetime for the grace period.
+  DeferredClient& client = deferred_[w];
+  client.has_class = class_name != nullptr;
+  client.class_name = client.has_class ? *class_name : string();
+  client.framed = false;
+  client.timer = timers_.Add(config_.frame_delay, [this, w] {
+    EndDeferral(w, false);
+  });
+  // 2. Frame window right away if windows of its class are long-lived.
+  // Otherwise, map it without a frame, watching for input, and learn its
+  // class in the background.
+  if (client.has_class && framing_history_.IsLongLived(client.class_name)) {
+    client_states_[w] = ClientState::PENDING;
+    Frame(w, false);
+    client.framed = true;
+  } else {
+    client_states_[w] = ClientState::DEFERRED;
+    XSelectInput(display_, w, PointerMotionMask | KeyPressMask);
+    if (!client.has_class) {
+      property_fetcher_->Fetch(w, ClientProperty::CLASS);
+    }
+    framing_history_.AddDeferred();
+    VLOG(1) << "Deferred framing window " << w;
+  }
+  // 3. Actually map window.
+  XMapWindow(display_, w);
+}
+
+bool WindowManager::FrameDeferred(
+    Window w, FramingHistory::Reason reason) {
+  // 1. Frame window where it is, unless it was unmapped meanwhile, in which
+  // case it turned out short-lived after all.
+  client_states_[w] = ClientState::PENDING;
+  Frame(w, true);
+  auto i = client_states_.find(w);
+  if (i == client_states_.end() || i->second != ClientState::FRAMED) {
+    // Stop watching the window for input if it still exists.
+    if (i != client_states_.end()) {
+      XSelectInput(display_, w, NoEventMask);
+    }
+    EndDeferral(w, true);
+    return false;
+  }
+  // 2. Remember that the window was framed within its grace period.
+  framing_history_.AddFramed(reason);
+  auto d = deferred_.find(w);
+  if (d != deferred_.end()) {
+    d->second.framed = true;
+  }
+  return true;
+}
+
+void WindowManager::EndDeferral(Window w, bool unmapped) {
+  auto d = deferred_.find(w);
+  if (d == deferred_.end()) {
+    return;
+  }
+  timers_.Cancel(d->second.timer);
+  const DeferredClient client = ::std::move(d->second);
+  deferred_.erase(d);
+  // 1. Frame window if it outlived its grace period without a frame.
+  bool short_lived = unmapped;
+  auto i = client_states_.find(w);
+  if (!unmapped && i != client_states_.end() &&
+      i->second == ClientState::DEFERRED) {
+    short_lived = !FrameDeferred(w, FramingHistory::Reason::DELAY);
+  }
+  // 2. Learn from its lifetime.
+  framing_history_.AddLifetime(
+      client.has_class ? client.class_name : string(),
+      short_lived,
+      client.framed);
+}
+
+void WindowManager::FinishTransitions() {
+  for (const Window w : pending_transitions_) {
+    auto i = client_states_.find(w);
+    if (i == client_states_.end()) {
+      continue;
+    }
+    if (i->second == ClientState::WITHDRAWING) {
+      Withdraw(w);
+    } else if (i->second == ClientState::DESTROYED) {
+      Unframe(w);
+    }
+  }
+  pending_transitions_.clear();
+  // Every frame must be released along with its client.
+  DCHECK_EQ(clients_.size(), frames_.size());
+  DCHECK_EQ(clients_.size(), frame_geometries_.size());
+  DCHECK_EQ(clients_.size(), stacking_.size());
+}
+
+void WindowManager::Iconify(Window w) {
+  CHECK(clients_.count(w));
+  const Window frame = clients_[w];
+  // 1. Unmap frame, then client window, whose UnmapNotify is then ignored as
+  // it is iconic.
+  client_states_[w] = ClientState::ICONIC;
+  if (thumbnailer_) {
+    thumbnailer_->SetMapped(frame, false);
+  }
+  if (config_.reparent) {
+    XUnmapWindow(display_, frame);
+  }
+  XUnmapWindow(display_, w);
+  SetWMState(w, IconicState);
+  // 2. Drop focus, which the X server reverts to the pointer root.
+  if (focused_ == w) {
+    decorator_->SetFocused(frame, false);
+    focused_ = None;
+  }
+  VLOG(1) << "Iconified window " << w << " [" << frame << "]";
+}
+
+void WindowManager::Withdraw(Window w) {
+  CHECK(clients_.count(w));
+  const Window frame = clients_[w];
+  // 1. Hide frame, keeping it and all per-client state. The client window is
+  // already unmapped.
+  client_states_[w] = ClientState::WITHDRAWN;
+  if (thumbnailer_) {
+    thumbnailer_->SetMapped(frame, false);
+  }
+  if (config_.reparent) {
+    XUnmapWindow(display_, frame);
+  }
+  SetWMState(w, WithdrawnState);
+  stacking_.SetHidden(w, true);
+  if (focused_ == w) {
+    decorator_->SetFocused(frame, false);
+    focused_ = None;
+  }
+  // A client that hides its window when asked to close, e.g. a tray
+  // application, has complied, so it must not be killed.
+  liveness_.CancelClose(w);
+  // 2. Unframe client unless it is mapped again in time, e.g. a dialog that
+  // its toolkit hides and shows again.
+  CancelUnframe(w);
+  unframe_timers_[w] = timers_.Add(config_.withdrawn_timeout, [this, w] {
+    unframe_timers_.erase(w);
+    Unframe(w);
+  });
+  VLOG(1) << "Withdrew window " << w << " [" << frame << "]";
+}
+
+void WindowManager::Restore(Window w) {
+  CHECK(clients_.count(w));
+  const Window frame = clients_[w];
+  // 1. Raise frame as if it were new.
+  if (client_states_[w] == ClientState::WITHDRAWN) {
+    CancelUnframe(w);
+    stacking_.SetHidden(w, false);
+  }
+  stacking_.Raise(w);
+  stacking_.Restack();
+  // 2. Map client window, then frame, so that both appear at once.
+  client_states_[w] = ClientState::FRAMED;
+  XMapWindow(display_, w);
+  if (config_.reparent) {
+    XMapWindow(display_, frame);
+  }
+  if (thumbnailer_) {
+    thumbnailer_->SetMapped(frame, true);
+  }
+  SetWMState(w, NormalState);
+  VLOG(1) << "Restored window " << w << " [" << frame << "]";
+}
+
+void WindowManager::CancelUnframe(Window w) {
+  auto i = unframe_timers_.find(w);
+  if (i != unframe_timers_.end()) {
+    timers_.Cancel(i->second);
+    unframe_timers_.erase(i);
+  }
+}
+
+void WindowManager::SetWMState(Window w, int state) {
+  // WM_STATE holds the state and the icon window, which we don't use.
+  const long data[] = {state, None};
+  XChangeProperty(
       display_,
       w,
-      root_,
-      0, 0);  // Offset of client window within root.
-  // 3. Remove client window from save set, as it is now unrelated to us.
-  XRemoveFromSaveSet(display_, w);
-  // 4. Destroy frame.
-  XDestroyWindow(display_, frame);
-  // 5. Drop reference to frame handle.
-  clients_.erase(w);
+      WM_STATE,
+      WM_STATE,
+      32,
+      PropModeReplace,
+      reinterpret_cast<const unsigned char*>(data),
+      2);
+}
 
-  LOG(INFO) << "Unframed window " << w << " [" << frame << "]";
+void WindowManager::MarkOwnCrossings() {
+  const unsigned long next_serial = NextRequest(display_);
+  if (next_serial == crossing_serial_) {
+    return;
+  }
+  own_crossings_.emplace_back(crossing_serial_, next_serial);
+  XNoOp(display_);
+  crossing_serial_ = NextRequest(display_);
 }
 
-void WindowManager::OnCreateNotify(const XCreateWindowEvent& e) {}
+bool WindowManager::IsOwnCrossing(unsigned long serial) {
+  // Events arrive in serial order, so ranges that end before this event can't
+  // match any later event either.
+  while (!own_crossings_.empty() && own_crossings_.front().second <= serial) {
+    own_crossings_.pop_front();
+  }
+  return !own_crossings_.empty() && own_crossings_.front().first <= serial;
+}
 
-void WindowManager::OnDestroyNotify(const XDestroyWindowEvent& e) {}
+void WindowManager::OnCreateNotify(const XCreateWindowEvent& e) {
+  // Track new top-level windows that may later ask to be mapped. Our own
+  // frames are known by the time their CreateNotify arrives.
+  if (e.parent != root_ || e.override_redirect ||
+      frame_geometries_.count(e.window) || client_states_.count(e.window)) {
+    return;
+  }
+  client_states_[e.window] = ClientState::PENDING;
+}
 
-void WindowManager::OnReparentNotify(const XReparentEvent& e) {}
+void WindowManager::OnDestroyNotify(const XDestroyWindowEvent& e) {
+  auto i = client_states_.find(e.window);
+  if (i == client_states_.end()) {
+    return;
+  }
+  EndDeferral(e.window, true);
+  switch (i->second) {
+    case ClientState::PENDING:
+    case ClientState::MATCHING:
+    case ClientState::DEFERRED:
+      // Never mapped, so nothing to release.
+      client_states_.erase(i);
+      break;
+    case ClientState::WITHDRAWN:
+      CancelUnframe(e.window);
+      // Fall through.
+    case ClientState::FRAMED:
+    case ClientState::ICONIC:
+      pending_transitions_.push_back(e.window);
+      i->second = ClientState::DESTROYED;
+      break;
+    case ClientState::WITHDRAWING:
+      // Already pending, but the client window can no longer be touched.
+      i->second = ClientState::DESTROYED;
+      break;
+    case ClientState::DESTROYED:
+      break;
+  }
+}
 
-void WindowManager::OnMapNotify(const XMapEvent& e) {}
+void WindowManager::OnReparentNotify(const XReparentEvent& e) {
+  auto i = client_states_.find(e.window);
+  if (i == client_states_.end()) {
+    return;
+  }
+  if (i->second == ClientState::PENDING ||
+      i->second == ClientState::MATCHING ||
+      i->second == ClientState::DEFERRED) {
+    // A top-level window that is no longer top-level is not ours to manage.
+    if (e.parent != root_) {
+      if (i->second == ClientState::DEFERRED) {
+        XSelectInput(display_, e.window, NoEventMask);
+      }
+      client_states_.erase(i);
+      EndDeferral(e.window, true);
+    }
+  } else if (e.parent != clients_[e.window] &&
+             i->second != ClientState::DESTROYED) {
+    // Another client took the window out of its frame, e.g. to embed a
+    // withdrawn window in a system tray.
+    if (i->second != ClientState::WITHDRAWING) {
+      CancelUnframe(e.window);
+      pending_transitions_.push_back(e.window);
+    }
+    i->second = ClientState::DESTROYED;
+  }
+}
+
+void WindowManager::OnMapNotify(const XMapEvent& e) {
+  // A pending window mapped without a MapRequest, e.g. after setting
+  // override_redirect, is not ours to manage.
+  auto i = client_states_.find(e.window);
+  if (i != client_states_.end() &&
+      (i->second == ClientState::PENDING ||
+       i->second == ClientState::MATCHING)) {
+    client_states_.erase(i);
+  }
+}
 
 void WindowManager::OnUnmapNotify(const XUnmapEvent& e) {
-  // If the window is a client window we manage, unframe it upon UnmapNotify. We
-  // need the check because we will receive an UnmapNotify event for a frame
+  // A client that is its own frame may unmap it at any time. Frames are only
+  // unmapped by us otherwise.
+  if (thumbnailer_ && !config_.reparent && !e.send_event) {
+    thumbnailer_->SetMapped(e.window, false);
+  }
+  // A window unmapped within its grace period is spared framing altogether.
+  auto i = client_states_.find(e.window);
+  if (i != client_states_.end() && i->second == ClientState::DEFERRED) {
+    i->second = ClientState::PENDING;
+    // Stop watching it for input, so it doesn't flood us with motion events
+    // when it is mapped again.
+    XSelectInput(display_, e.window, NoEventMask);
+    EndDeferral(e.window, true);
+    return;
+  }
+
+  // If the window is a client window we manage, withdraw it upon UnmapNotify.
+  // We need the check because we will receive an UnmapNotify event for a frame
   // window we just destroyed ourselves.
   if (!clients_.count(e.window)) {
-    LOG(INFO) << "Ignore UnmapNotify for non-client window " << e.window;
+    VLOG(2) << "Ignore UnmapNotify for non-client window " << e.window;
     return;
   }
 
@@ -288,21 +1199,73 @@ void WindowManager::OnUnmapNotify(const XUnmapEvent& e) {
   // unmapped. This means that an UnmapNotify event from a normal client window
   // should have this attribute set to a frame window we maintain. Only an
   // UnmapNotify event triggered by reparenting a pre-existing window will have
-  // this attribute set to the root window.
-  if (e.event == root_) {
-    LOG(INFO) << "Ignore UnmapNotify for reparented pre-existing window "
-              << e.window;
+  // this attribute set to the root window. Clients following the ICCCM also
+  // send a synthetic UnmapNotify to the root window when withdrawing a window.
+  if (config_.reparent && e.event == root_ && !e.send_event) {
+    VLOG(1) << "Ignore UnmapNotify for reparented pre-existing window "
+            << e.window;
     return;
   }
 
-  Unframe(e.window);
+  // Withdraw the window at the end of the current batch of events. If the
+  // window is being destroyed, its DestroyNotify usually arrives in the same
+  // batch, which saves the requests on the client window. The real
+  // UnmapNotify of an iconic window is from our own unmapping in Iconify(),
+  // but an iconic window can only be withdrawn with a synthetic UnmapNotify,
+  // as it is already unmapped.
+  ClientState& state = client_states_[e.window];
+  if (state == ClientState::FRAMED ||
+      (state == ClientState::ICONIC && e.send_event)) {
+    state = ClientState::WITHDRAWING;
+    pending_transitions_.push_back(e.window);
+    EndDeferral(e.window, true);
+  }
 }
 
-void WindowManager::OnConfigureNotify(const XConfigureEvent& e) {}
+void WindowManager::OnConfigureNotify(const XConfigureEvent& e) {
+  // Track geometry of frame windows.
+  auto i = frame_geometries_.find(e.window);
+  if (i != frame_geometries_.end()) {
+    i->second = Rect<int>(e.x, e.y, e.width, e.height);
+    drag_handler_->SetGeometry(e.window, i->second);
+    decorator_->SetWidth(e.window, e.width);
+    if (thumbnailer_) {
+      thumbnailer_->SetSize(
+          e.window, Size<int>(e.width, e.height), e.border_width);
+    }
+  }
+}
 
 void WindowManager::OnMapRequest(const XMapRequestEvent& e) {
-  // 1. Frame or re-frame window.
-  Frame(e.window, false);
+  // 1. Frame window, unless it is still framed because it is iconic or was
+  // withdrawn recently. With window rules, framing and mapping wait for the
+  // properties rules match on, which are fetched on the property fetcher's
+  // connection rather than with round trips here.
+  auto i = client_states_.find(e.window);
+  if (i == client_states_.end() || i->second == ClientState::PENDING) {
+    if (rules_) {
+      client_states_[e.window] = ClientState::MATCHING;
+      matching_properties_[e.window] = ClientProperties();
+      property_fetcher_->Fetch(e.window, ClientProperty::ROLE);
+      property_fetcher_->Fetch(e.window, ClientProperty::CLASS);
+      return;
+    }
+    if (config_.frame_delay.count() > 0) {
+      Defer(e.window, nullptr);
+      return;
+    }
+    Frame(e.window, false);
+  } else if (i->second == ClientState::WITHDRAWING) {
+    i->second = ClientState::FRAMED;
+  } else if (i->second == ClientState::ICONIC ||
+             i->second == ClientState::WITHDRAWN) {
+    Restore(e.window);
+    return;
+  } else if (i->second == ClientState::MATCHING ||
+             i->second == ClientState::DEFERRED ||
+             i->second == ClientState::DESTROYED) {
+    return;
+  }
   // 2. Actually map window.
   XMapWindow(display_, e.window);
 }
@@ -316,128 +1279,260 @@ void WindowManager::OnConfigureRequest(const XConfigureRequestEvent& e) {
   changes.border_width = e.border_width;
   changes.sibling = e.above;
   changes.stack_mode = e.detail;
+  unsigned long client_value_mask = e.value_mask;
   if (clients_.count(e.window)) {
+    // The frame takes the requested position, and is taller than the client
+    // by the height of the title bar. The client stays in place below the
+    // title bar. Stacking requests go through the stacking order, which only
+    // supports raising and lowering.
     const Window frame = clients_[e.window];
-    XConfigureWindow(display_, frame, e.value_mask, &changes);
-    LOG(INFO) << "Resize [" << frame << "] to " << Size<int>(e.width, e.height);
-  }
-  XConfigureWindow(display_, e.window, e.value_mask, &changes);
-  LOG(INFO) << "Resize " << e.window << " to " << Size<int>(e.width, e.height);
-}
-
-void WindowManager::OnButtonPress(const XButtonEvent& e) {
-  CHECK(clients_.count(e.window));
-  const Window frame = clients_[e.window];
-
-  // 1. Save initial cursor position.
-  drag_start_pos_ = Position<int>(e.x_root, e.y_root);
-
-  // 2. Save initial window info.
-  Window returned_root;
-  int x, y;
-  unsigned width, height, border_width, depth;
-  CHECK(XGetGeometry(
-      display_,
-      frame,
-      &returned_root,
-      &x, &y,
-      &width, &height,
-      &border_width,
-      &depth));
-  drag_start_frame_pos_ = Position<int>(x, y);
-  drag_start_frame_size_ = Size<int>(width, height);
-
-  // 3. Raise clicked window to top.
-  XRaiseWindow(display_, frame);
-}
-
-void WindowManager::OnButtonRelease(const XButtonEvent& e) {}
-
-void WindowManager::OnMotionNotify(const XMotionEvent& e) {
-  CHECK(clients_.count(e.window));
-  const Window frame = clients_[e.window];
-  const Position<int> drag_pos(e.x_root, e.y_root);
-  const Vector2D<int> delta = drag_pos - drag_start_pos_;
-
-  if (e.state & Button1Mask ) {
-    // alt + left button: Move window.
-    const Position<int> dest_frame_pos = drag_start_frame_pos_ + delta;
-    XMoveWindow(
+    XWindowChanges frame_changes = changes;
+    frame_changes.height = e.height + title_height_;
+    XConfigureWindow(
         display_,
         frame,
-        dest_frame_pos.x, dest_frame_pos.y);
-  } else if (e.state & Button3Mask) {
-    // alt + right button: Resize window.
-    // Window dimensions cannot be negative.
-    const Vector2D<int> size_delta(
-        max(delta.x, -drag_start_frame_size_.width),
-        max(delta.y, -drag_start_frame_size_.height));
-    const Size<int> dest_frame_size = drag_start_frame_size_ + size_delta;
-    // 1. Resize frame.
-    XResizeWindow(
-        display_,
-        frame,
-        dest_frame_size.width, dest_frame_size.height);
-    // 2. Resize client window.
-    XResizeWindow(
-        display_,
-        e.window,
-        dest_frame_size.width, dest_frame_size.height);
+        e.value_mask & ~(CWSibling | CWStackMode),
+        &frame_changes);
+    VLOG(1) << "Resize [" << frame << "] to "
+            << Size<int>(frame_changes.width, frame_changes.height);
+    if (e.value_mask & CWStackMode) {
+      if (e.detail == Above) {
+        stacking_.Raise(e.window);
+      } else if (e.detail == Below) {
+        stacking_.Lower(e.window);
+      }
+      stacking_.Restack();
+    }
+    // A client window that is its own frame has been configured already.
+    client_value_mask = config_.reparent
+        ? client_value_mask & ~(CWX | CWY | CWSibling | CWStackMode)
+        : 0;
+  }
+  if (client_value_mask != 0) {
+    XConfigureWindow(display_, e.window, client_value_mask, &changes);
+    VLOG(1) << "Resize " << e.window << " to "
+            << Size<int>(e.width, e.height);
   }
 }
 
 void WindowManager::OnKeyPress(const XKeyEvent& e) {
+  // Key presses are only selected on deferred windows, which are framed once
+  // they receive input, and grabbed on framed ones.
+  auto i = client_states_.find(e.window);
+  if (i == client_states_.end()) {
+    return;
+  }
+  if (i->second == ClientState::DEFERRED) {
+    FrameDeferred(e.window, FramingHistory::Reason::INPUT);
+    return;
+  }
+  // Key presses queued before a window started or after it stopped being
+  // managed, e.g. while it is being withdrawn, are stale.
+  if ((i->second != ClientState::FRAMED &&
+       i->second != ClientState::ICONIC) ||
+      !clients_.count(e.window)) {
+    return;
+  }
   if ((e.state & Mod1Mask) &&
       (e.keycode == XKeysymToKeycode(display_, XK_F4))) {
     // alt + f4: Close window.
-    //
-    // There are two ways to tell an X window to close. The first is to send it
-    // a message of type WM_PROTOCOLS and value WM_DELETE_WINDOW. If the client
-    // has not explicitly marked itself as supporting this more civilized
-    // behavior (using XSetWMProtocols()), we kill it with XKillClient().
-    Atom* supported_protocols;
-    int num_supported_protocols;
-    if (XGetWMProtocols(display_,
-                        e.window,
-                        &supported_protocols,
-                        &num_supported_protocols) &&
-        (::std::find(supported_protocols,
-                     supported_protocols + num_supported_protocols,
-                     WM_DELETE_WINDOW) !=
-         supported_protocols + num_supported_protocols)) {
-      LOG(INFO) << "Gracefully deleting window " << e.window;
-      // 1. Construct message.
-      XEvent msg;
-      memset(&msg, 0, sizeof(msg));
-      msg.xclient.type = ClientMessage;
-      msg.xclient.message_type = WM_PROTOCOLS;
-      msg.xclient.window = e.window;
-      msg.xclient.format = 32;
-      msg.xclient.data.l[0] = WM_DELETE_WINDOW;
-      // 2. Send message to window to be closed.
-      CHECK(XSendEvent(display_, e.window, false, 0, &msg));
-    } else {
-      LOG(INFO) << "Killing window " << e.window;
-      XKillClient(display_, e.window);
-    }
+    Close(e.window, e.time);
   } else if ((e.state & Mod1Mask) &&
              (e.keycode == XKeysymToKeycode(display_, XK_Tab))) {
     // alt + tab: Switch window.
-    // 1. Find next window.
-    auto i = clients_.find(e.window);
-    CHECK(i != clients_.end());
-    ++i;
-    if (i == clients_.end()) {
-      i = clients_.begin();
-    }
+    const RequestStats::Scope scope(
+        request_stats_.get(), "AltTab", &ALT_TAB_BUDGET);
+    // 1. Find next window. Raising the bottom-most window each time cycles
+    // through all windows in stacking order.
+    const Window next = stacking_.GetBottomWindow();
     // 2. Raise and set focus.
-    XRaiseWindow(display_, i->second);
-    XSetInputFocus(display_, i->first, RevertToPointerRoot, CurrentTime);
+    if (next != None) {
+      Activate(next);
+    }
   }
 }
 
 void WindowManager::OnKeyRelease(const XKeyEvent& e) {}
 
+void WindowManager::OnPropertyNotify(const XPropertyEvent& e) {
+  if (!clients_.count(e.window)) {
+    return;
+  }
+  property_fetcher_->OnPropertyNotify(e);
+}
+
+void WindowManager::OnClientMessage(const XClientMessageEvent& e) {
+  // Clients ask to be iconified with WM_CHANGE_STATE, per the ICCCM.
+  if (e.message_type == WM_CHANGE_STATE) {
+    auto i = client_states_.find(e.window);
+    if (e.format == 32 && e.data.l[0] == IconicState &&
+        i != client_states_.end() && i->second == ClientState::FRAMED) {
+      Iconify(e.window);
+    }
+    return;
+  }
+  liveness_.OnClientMessage(e);
+}
+
+void WindowManager::OnExpose(const XExposeEvent& e) {
+  decorator_->OnExpose(e);
+}
+
+void WindowManager::OnMotionNotify(const XMotionEvent& e) {
+  // Pointer motion is only selected on deferred windows, which are framed once
+  // they receive input.
+  auto i = client_states_.find(e.window);
+  if (i != client_states_.end() && i->second == ClientState::DEFERRED) {
+    FrameDeferred(e.window, FramingHistory::Reason::INPUT);
+  }
+}
+
+void WindowManager::OnEnterNotify(const XCrossingEvent& e) {
+  // 1. Only consider the pointer entering a frame from outside, moved there by
+  // the user rather than by a grab or by our own requests.
+  auto i = frames_.find(e.window);
+  if (i == frames_.end() || e.mode != NotifyNormal ||
+      e.detail == NotifyInferior) {
+    return;
+  }
+  if (IsOwnCrossing(e.serial)) {
+    VLOG(2) << "Ignore EnterNotify from own requests for " << e.window;
+    return;
+  }
+  // 2. Focus the client once the pointer has rested on it, so that sweeping
+  // the pointer across windows only focuses the last one.
+  const Window w = i->second;
+  if (focus_timer_ != 0) {
+    timers_.Cancel(focus_timer_);
+    focus_timer_ = 0;
+  }
+  focus_target_ = None;
+  if (w == focused_) {
+    return;
+  }
+  focus_target_ = w;
+  focus_timer_ = timers_.Add(config_.focus_delay, [this] {
+    focus_timer_ = 0;
+    auto j = client_states_.find(focus_target_);
+    if (j != client_states_.end() && j->second == ClientState::FRAMED) {
+      Focus(focus_target_);
+    }
+    focus_target_ = None;
+  });
+}
+
+void WindowManager::OnLeaveNotify(const XCrossingEvent& e) {
+  // Don't focus a client the pointer left before its focus delay expired.
+  auto i = frames_.find(e.window);
+  if (i == frames_.end() || e.mode != NotifyNormal ||
+      e.detail == NotifyInferior || i->second != focus_target_ ||
+      IsOwnCrossing(e.serial)) {
+    return;
+  }
+  timers_.Cancel(focus_timer_);
+  focus_timer_ = 0;
+  focus_target_ = None;
+}
+
+bool WindowManager::Close(Window w, Time time) {
+  return liveness_.Close(w, time);
+}
+
+void WindowManager::Focus(Window w) {
+  CHECK(clients_.count(w));
+  // Only viewable windows can take input focus.
+  if (client_states_[w] == ClientState::ICONIC) {
+    Restore(w);
+  }
+  XSetInputFocus(display_, w, RevertToPointerRoot, CurrentTime);
+  if (focused_ != None) {
+    decorator_->SetFocused(clients_[focused_], false);
+  }
+  focused_ = w;
+  decorator_->SetFocused(clients_[w], true);
+  if (control_server_) {
+    control_server_->Publish(CONTROL_EVENT_FOCUS, ToString(w));
+  }
+}
+
+void WindowManager::Activate(Window w) {
+  CHECK(clients_.count(w));
+  stacking_.Raise(w);
+  stacking_.Restack();
+  Focus(w);
+}
+
+void WindowManager::ResizeFrame(
+    Window w, Window frame, const Size<int>& frame_size) {
+  const Size<int> size = ClampFrameSize(frame_size, title_height_);
+  // 1. Resize frame.
+  XResizeWindow(display_, frame, size.width, size.height);
+  // 2. Resize client window, unless it is its own frame.
+  if (config_.reparent) {
+    XResizeWindow(display_, w, size.width, size.height - title_height_);
+  }
+  // 3. Update cached geometry.
+  Rect<int>& geometry = frame_geometries_[frame];
+  geometry.width = size.width;
+  geometry.height = size.height;
+}
+
+Rect<int> WindowManager::FitToOutput(const Rect<int>& frame_geometry) const {
+  // Outputs contain the frame's border as well.
+  const Rect<int> outer(
+      frame_geometry.x,
+      frame_geometry.y,
+      frame_geometry.width + 2 * border_width_,
+      frame_geometry.height + 2 * border_width_);
+  const int output_index = output_layout_.FindOutput(outer);
+  const Rect<int> fitted = ClampRect(
+      outer, output_layout_.outputs()[max(output_index, 0)]);
+  // Frame dimensions must leave room for the title bar and one row of the
+  // client.
+  return Rect<int>(
+      fitted.x,
+      fitted.y,
+      max(fitted.width - 2 * border_width_, 1),
+      max(fitted.height - 2 * border_width_, title_height_ + 1));
+}
+
+void WindowManager::RelocateFrames(const vector<Rect<int>>& changed_outputs) {
+  if (changed_outputs.empty()) {
+    return;
+  }
+  // 1. Move frames on the affected outputs, using cached geometry only. Frames
+  // already within a current output are left alone.
+  int num_relocated = 0;
+  for (const auto& client : clients_) {
+    const Rect<int> geometry = frame_geometries_[client.second];
+    const Rect<int> outer(
+        geometry.x,
+        geometry.y,
+        geometry.width + 2 * border_width_,
+        geometry.height + 2 * border_width_);
+    if (!::std::any_of(changed_outputs.begin(), changed_outputs.end(),
+                       [&outer] (const Rect<int>& output) {
+                         return IntersectionArea(outer, output) > 0;
+                       })) {
+      continue;
+    }
+    const Rect<int> fitted = FitToOutput(geometry);
+    if (fitted.width != geometry.width || fitted.height != geometry.height) {
+      ResizeFrame(client.first, client.second, fitted.size());
+    }
+    if (fitted.x != geometry.x || fitted.y != geometry.y) {
+      XMoveWindow(display_, client.second, fitted.x, fitted.y);
+      Rect<int>& cached_geometry = frame_geometries_[client.second];
+      cached_geometry.x = fitted.x;
+      cached_geometry.y = fitted.y;
+    }
+    ++num_relocated;
+  }
+  // 2. Send all resulting requests at once.
+  XFlush(display_);
+  LOG(INFO) << "Outputs changed, relocated " << num_relocated << " frames";
+}
+
 int WindowManager::OnXError(Display* display, XErrorEvent* e) {
   const int MAX_ERROR_TEXT_LENGTH = 1024;
   char error_text[MAX_ERROR_TEXT_LENGTH];
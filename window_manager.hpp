@@ -4,11 +4,28 @@
 extern "C" {
 #include <X11/Xlib.h>
 }
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
+#include "client_liveness.hpp"
+#include "config.hpp"
+#include "control_server.hpp"
+#include "decorator.hpp"
+#include "drag_handler.hpp"
+#include "event_scheduler.hpp"
+#include "framing_history.hpp"
+#include "icon_cache.hpp"
+#include "output_layout.hpp"
+#include "property_fetcher.hpp"
+#include "request_stats.hpp"
+#include "stacking_order.hpp"
+#include "thumbnailer.hpp"
+#include "timer_queue.hpp"
 #include "util.hpp"
+#include "window_rules.hpp"
 
 // Implementation of a window manager for an X screen.
 class WindowManager {
@@ -17,6 +34,7 @@ class WindowManager {
   // argument string, or if unspecified, the DISPLAY environment variable. On
   // failure, returns nullptr.
    static ::std::unique_ptr<WindowManager> Create(
+      const Config& config,
       const std::string& display_str = std::string());
 
   ~WindowManager();
@@ -25,12 +43,117 @@ class WindowManager {
   void Run();
 
  private:
+  // Lifecycle states of top-level windows.
+  enum class ClientState {
+    // Created as a child of the root window, but not yet mapped.
+    PENDING,
+    // Asked to be mapped, and waiting for the properties matched by window
+    // rules to be fetched before it is framed.
+    MATCHING,
+    // Mapped without a frame, until it has stayed mapped for
+    // Config::frame_delay or receives input.
+    DEFERRED,
+    // Framed and shown, in the ICCCM Normal state.
+    FRAMED,
+    // Iconified at the client's request, in the ICCCM Iconic state. The frame
+    // and client window are unmapped until the client maps its window again
+    // or is activated.
+    ICONIC,
+    // Unmapped by the client. Withdrawn at the end of the current batch of
+    // events, unless it is mapped again or destroyed first.
+    WITHDRAWING,
+    // Unmapped by the client, in the ICCCM Withdrawn state. The frame is
+    // unmapped but kept, so that mapping the window again only maps the
+    // frame. Unframed once it has stayed withdrawn for
+    // Config::withdrawn_timeout, unless destroyed first.
+    WITHDRAWN,
+    // Destroyed, or reparented out of its frame by another client. Only the
+    // frame and other resources of our own are left to release, at the end of
+    // the current batch of events.
+    DESTROYED,
+  };
+
   // Invoked internally by Create().
-  WindowManager(Display* display);
-  // Frames a top-level window.
-  void Frame(Window w, bool was_created_before_window_manager);
-  // Unframes a client window.
+  WindowManager(
+      Display* display,
+      const Config& config,
+      ::std::unique_ptr<ControlServer> control_server,
+      ::std::unique_ptr<PropertyFetcher> property_fetcher,
+      ::std::unique_ptr<DragHandler> drag_handler,
+      ::std::unique_ptr<Decorator> decorator);
+  // Frames a top-level window, placing it as decided by window rules unless it
+  // is already mapped.
+  void Frame(
+      Window w,
+      bool already_mapped,
+      const WindowRuleDecision& decision = WindowRuleDecision());
+  // Frames and maps a window once the properties matched by window rules are
+  // fetched, or only maps it if rules say not to manage it.
+  void FinishMatching(Window w, const ClientProperties& properties);
+  // Maps a window without a frame for Config::frame_delay, unless its WM_CLASS
+  // class, or nullptr if not known yet, is known to be long-lived.
+  void Defer(Window w, const ::std::string* class_name);
+  // Frames a deferred window where it is. Returns false if it was unmapped
+  // meanwhile.
+  bool FrameDeferred(Window w, FramingHistory::Reason reason);
+  // Ends the grace period of a window mapped by Defer(), when it expires or
+  // when the window is unmapped first, framing the window if still deferred
+  // and learning from its lifetime.
+  void EndDeferral(Window w, bool unmapped);
+  // Unframes a client window, issuing only the requests still valid for its
+  // state.
   void Unframe(Window w);
+  // Withdraws or unframes the clients that were unmapped or destroyed during
+  // the last batch of events.
+  void FinishTransitions();
+  // Iconifies a framed client by unmapping its frame and client window.
+  void Iconify(Window w);
+  // Hides the frame of a client that unmapped its window, and schedules the
+  // client to be unframed unless it is mapped again.
+  void Withdraw(Window w);
+  // Maps and raises the frame and client window of an iconic or withdrawn
+  // client.
+  void Restore(Window w);
+  // Cancels the scheduled unframing of a withdrawn client.
+  void CancelUnframe(Window w);
+  // Sets the ICCCM WM_STATE property of a client window.
+  void SetWMState(Window w, int state);
+  // Records the range of requests issued since the last call, so that
+  // crossing events they generate, e.g. by restacking frames under the
+  // pointer, are ignored. A NoOp request ends the range, so that crossing
+  // events generated afterwards by pointer motion carry a later serial.
+  void MarkOwnCrossings();
+  // Returns whether a crossing event was generated by our own requests.
+  bool IsOwnCrossing(unsigned long serial);
+  // Asks a client window to close, killing it if it doesn't support
+  // WM_DELETE_WINDOW or doesn't answer pings. time is the timestamp of the
+  // triggering event, or CurrentTime. Returns false if the window isn't
+  // managed.
+  bool Close(Window w, Time time);
+  // Gives a client window input focus, restoring it first if it is iconic.
+  void Focus(Window w);
+  // Raises a client window and gives it input focus.
+  void Activate(Window w);
+  // Resizes a frame window and its client window to fit.
+  void ResizeFrame(Window w, Window frame, const Size<int>& frame_size);
+  // Returns the geometry of a frame moved, and if necessary shrunk, to lie
+  // entirely within the output it overlaps the most, or the primary output if
+  // it overlaps none.
+  Rect<int> FitToOutput(const Rect<int>& frame_geometry) const;
+  // Moves frames overlapping outputs that changed or vanished back onto the
+  // current outputs.
+  void RelocateFrames(const ::std::vector<Rect<int>>& changed_outputs);
+
+  // Dispatches an X event to its handler.
+  void DispatchEvent(XEvent* e);
+  // Applies client property updates delivered by the property fetcher.
+  void ApplyPropertyUpdates();
+  // Applies the results of drags delivered by the drag handler.
+  void ApplyDragResults();
+  // Executes a batch of commands received over the control socket. All
+  // resulting X requests are flushed together at the end of the batch.
+  ::std::string ExecuteControlBatch(
+      const ::std::vector<ControlCommand>& batch, ::std::ostream* reply);
 
   // Event handlers.
   void OnCreateNotify(const XCreateWindowEvent& e);
@@ -41,11 +164,17 @@ class WindowManager {
   void OnConfigureNotify(const XConfigureEvent& e);
   void OnMapRequest(const XMapRequestEvent& e);
   void OnConfigureRequest(const XConfigureRequestEvent& e);
-  void OnButtonPress(const XButtonEvent& e);
-  void OnButtonRelease(const XButtonEvent& e);
-  void OnMotionNotify(const XMotionEvent& e);
   void OnKeyPress(const XKeyEvent& e);
   void OnKeyRelease(const XKeyEvent& e);
+  void OnPropertyNotify(const XPropertyEvent& e);
+  void OnClientMessage(const XClientMessageEvent& e);
+  void OnExpose(const XExposeEvent& e);
+  void OnMotionNotify(const XMotionEvent& e);
+  void OnEnterNotify(const XCrossingEvent& e);
+  void OnLeaveNotify(const XCrossingEvent& e);
+
+  // Width of frame borders.
+  static const int BORDER_WIDTH = 3;
 
   // Xlib error handler. It must be static as its address is passed to Xlib.
   static int OnXError(Display* display, XErrorEvent* e);
@@ -62,24 +191,93 @@ class WindowManager {
   // this program is single threaded, but better safe than sorry.
   static ::std::mutex wm_detected_mutex_;
 
+  // Runtime configuration.
+  const Config config_;
+  // Width of frame borders and height of title bars, which are 0 if clients
+  // aren't reparented.
+  const int border_width_;
+  const int title_height_;
   // Handle to the underlying Xlib Display struct.
   Display* display_;
   // Handle to root window.
   const Window root_;
-  // Maps top-level windows to their frame windows.
+  // Cached layout of the screen's outputs.
+  OutputLayout output_layout_;
+  // Maps top-level windows to their frame windows. Top-level windows are their
+  // own frames if clients aren't reparented.
   ::std::unordered_map<Window, Window> clients_;
-
-  // The cursor position at the start of a window move/resize.
-  Position<int> drag_start_pos_;
-  // The position of the affected window at the start of a window
-  // move/resize.
-  Position<int> drag_start_frame_pos_;
-  // The size of the affected window at the start of a window move/resize.
-  Size<int> drag_start_frame_size_;
+  // Maps frame windows to their top-level windows.
+  ::std::unordered_map<Window, Window> frames_;
+  // Lifecycle state of each known top-level window. Windows in any state but
+  // PENDING, MATCHING and DEFERRED are in clients_.
+  ::std::unordered_map<Window, ClientState> client_states_;
+  // Clients to withdraw or unframe at the end of the current batch of events.
+  ::std::vector<Window> pending_transitions_;
+  // Timers that unframe withdrawn clients.
+  ::std::unordered_map<Window, TimerQueue::TimerId> unframe_timers_;
+  // Last known geometry of each frame window, keyed by frame. Kept up to date
+  // from ConfigureNotify events so that geometry can be reported without a
+  // round trip to the X server.
+  ::std::unordered_map<Window, Rect<int>> frame_geometries_;
+  // Stacking order of frames.
+  StackingOrder stacking_;
+  // Control interface, or nullptr if disabled.
+  ::std::unique_ptr<ControlServer> control_server_;
+  // Timers run from the main event loop.
+  TimerQueue timers_;
+  // Orders X events fairly between X clients.
+  EventScheduler scheduler_;
+  // Closes clients and kills hung ones.
+  ClientLiveness liveness_;
+  // Fetches client properties in the background.
+  ::std::unique_ptr<PropertyFetcher> property_fetcher_;
+  // Moves and resizes windows with alt + drag in the background.
+  ::std::unique_ptr<DragHandler> drag_handler_;
+  // Measurements of recent drags and their client windows, oldest first.
+  ::std::deque<::std::pair<Window, DragStats>> drag_stats_;
+  // Decoded properties of each client window, as fetched so far.
+  ::std::unordered_map<Window, ClientProperties> client_properties_;
+  // Window rules, or nullptr if none are configured.
+  ::std::unique_ptr<WindowRules> rules_;
+  // Properties fetched so far of windows in the MATCHING state.
+  ::std::unordered_map<Window, ClientProperties> matching_properties_;
+  // A window within the grace period of deferred framing.
+  struct DeferredClient {
+    // WM_CLASS class, once fetched.
+    bool has_class;
+    ::std::string class_name;
+    // Whether the window has been framed early.
+    bool framed;
+    // Timer ending the grace period.
+    TimerQueue::TimerId timer;
+  };
+  // Windows within their grace period.
+  ::std::unordered_map<Window, DeferredClient> deferred_;
+  // Lifetimes of deferred windows per WM_CLASS, and counters.
+  FramingHistory framing_history_;
+  // Scaled client icons for window lists.
+  IconCache icon_cache_;
+  // Draws title bars on frames.
+  ::std::unique_ptr<Decorator> decorator_;
+  // The client window that the window manager last gave input focus, or None.
+  Window focused_;
+  // With focus follows mouse, the client window under the pointer that is
+  // about to be focused, or None, and the timer that focuses it.
+  Window focus_target_;
+  TimerQueue::TimerId focus_timer_;
+  // First request serial since the last call to MarkOwnCrossings(), and
+  // ranges [begin, end) of the serials of our own requests whose crossing
+  // events may not have been handled yet.
+  unsigned long crossing_serial_;
+  ::std::deque<::std::pair<unsigned long, unsigned long>> own_crossings_;
+  // Live frame thumbnails, or nullptr if disabled.
+  ::std::unique_ptr<Thumbnailer> thumbnailer_;
+  // X request accounting, or nullptr if disabled.
+  ::std::unique_ptr<RequestStats> request_stats_;
 
   // Atom constants.
-  const Atom WM_PROTOCOLS;
-  const Atom WM_DELETE_WINDOW;
+  const Atom WM_STATE;
+  const Atom WM_CHANGE_STATE;
 };
 
 #endif
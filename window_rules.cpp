@@ -0,0 +1,256 @@
+#include "window_rules.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+using ::std::ifstream;
+using ::std::istream;
+using ::std::istringstream;
+using ::std::ostringstream;
+using ::std::string;
+using ::std::unique_ptr;
+using ::std::vector;
+
+namespace {
+
+// Parses a non-negative integer at the start of a string. On success, returns
+// a pointer past the number.
+const char* ParseNumber(const char* s, int* value) {
+  char* end;
+  errno = 0;
+  const long result = strtol(s, &end, 10);
+  if (end == s || *s == '-' || *s == '+' || errno == ERANGE ||
+      result > 0xffff) {
+    return nullptr;
+  }
+  *value = static_cast<int>(result);
+  return end;
+}
+
+// Parses a non-negative integer.
+bool ParseIndex(const string& s, int* value) {
+  const char* p = ParseNumber(s.c_str(), value);
+  return p != nullptr && *p == '\0';
+}
+
+// Parses a pair of non-negative integers separated by a character.
+bool ParsePair(const string& s, char separator, int* first, int* second) {
+  const char* p = ParseNumber(s.c_str(), first);
+  if (p == nullptr || *p != separator) {
+    return false;
+  }
+  p = ParseNumber(p + 1, second);
+  return p != nullptr && *p == '\0';
+}
+
+}  // namespace
+
+WindowRuleDecision::WindowRuleDecision()
+    : manage(true),
+      output(-1),
+      has_position(false),
+      position(0, 0),
+      has_size(false),
+      size(0, 0) {
+}
+
+unique_ptr<WindowRules> WindowRules::Load(const string& path, string* error) {
+  ifstream in(path);
+  if (!in) {
+    *error = "failed to open " + path;
+    return nullptr;
+  }
+  unique_ptr<WindowRules> rules = Parse(&in, error);
+  if (!rules) {
+    *error = path + ": " + *error;
+  }
+  return rules;
+}
+
+unique_ptr<WindowRules> WindowRules::Parse(istream* in, string* error) {
+  unique_ptr<WindowRules> rules(new WindowRules());
+  int line_number = 0;
+  for (string line; getline(*in, line);) {
+    ++line_number;
+    const size_t start = line.find_first_not_of(" \t");
+    if (start == string::npos || line[start] == '#') {
+      continue;
+    }
+    const string line_error = rules->AddRule(line);
+    if (!line_error.empty()) {
+      ostringstream out;
+      out << "line " << line_number << ": " << line_error;
+      *error = out.str();
+      return nullptr;
+    }
+  }
+  return rules;
+}
+
+WindowRules::WindowRules() {
+}
+
+WindowRuleDecision WindowRules::Match(
+    const string& class_name,
+    const string& instance_name,
+    const string& role) const {
+  // 1. Collect the rules with a matching pattern, once per matching field, so
+  // that the rules whose patterns all match appear once per pattern.
+  vector<int> candidates(unconditional_);
+  AddMatches(CLASS, class_name, &candidates);
+  AddMatches(INSTANCE, instance_name, &candidates);
+  AddMatches(ROLE, role, &candidates);
+  ::std::sort(candidates.begin(), candidates.end());
+  // 2. Apply the actions of rules whose patterns all match, in order.
+  WindowRuleDecision decision;
+  for (size_t i = 0; i < candidates.size();) {
+    const Rule& rule = rules_[candidates[i]];
+    size_t end = i + 1;
+    while (end < candidates.size() && candidates[end] == candidates[i]) {
+      ++end;
+    }
+    const int num_matches = rule.num_patterns == 0 ? 0 : end - i;
+    i = end;
+    if (num_matches != rule.num_patterns) {
+      continue;
+    }
+    if (rule.has_manage) {
+      decision.manage = rule.actions.manage;
+    }
+    if (rule.has_output) {
+      decision.output = rule.actions.output;
+    }
+    if (rule.actions.has_position) {
+      decision.has_position = true;
+      decision.position = rule.actions.position;
+    }
+    if (rule.actions.has_size) {
+      decision.has_size = true;
+      decision.size = rule.actions.size;
+    }
+  }
+  return decision;
+}
+
+string WindowRules::AddRule(const string& line) {
+  // 1. Split patterns from actions.
+  const size_t arrow = line.find("->");
+  if (arrow == string::npos) {
+    return "expected '->'";
+  }
+  const int index = rules_.size();
+  Rule rule;
+  rule.num_patterns = 0;
+  rule.has_manage = false;
+  rule.has_output = false;
+
+  // 2. Parse patterns.
+  vector<::std::pair<Field, string>> patterns;
+  istringstream pattern_in(line.substr(0, arrow));
+  for (string token; pattern_in >> token;) {
+    const size_t equals = token.find('=');
+    const string key = token.substr(0, equals);
+    const string value =
+        equals == string::npos ? "" : token.substr(equals + 1);
+    Field field;
+    if (key == "class") {
+      field = CLASS;
+    } else if (key == "instance") {
+      field = INSTANCE;
+    } else if (key == "role") {
+      field = ROLE;
+    } else {
+      return "unknown pattern " + token;
+    }
+    if (equals == string::npos || value.empty()) {
+      return "empty pattern " + token;
+    }
+    for (const auto& pattern : patterns) {
+      if (pattern.first == field) {
+        return "repeated pattern " + token;
+      }
+    }
+    patterns.emplace_back(field, value);
+  }
+
+  // 3. Parse actions.
+  istringstream action_in(line.substr(arrow + 2));
+  int num_actions = 0;
+  for (string token; action_in >> token; ++num_actions) {
+    const size_t equals = token.find('=');
+    const string key = token.substr(0, equals);
+    const string value =
+        equals == string::npos ? "" : token.substr(equals + 1);
+    if (key == "manage" && (value == "yes" || value == "no")) {
+      rule.has_manage = true;
+      rule.actions.manage = value == "yes";
+    } else if (key == "output" && ParseIndex(value, &rule.actions.output)) {
+      rule.has_output = true;
+    } else if (key == "position" &&
+               ParsePair(value, ',', &rule.actions.position.x,
+                         &rule.actions.position.y)) {
+      rule.actions.has_position = true;
+    } else if (key == "size" &&
+               ParsePair(value, 'x', &rule.actions.size.width,
+                         &rule.actions.size.height) &&
+               rule.actions.size.width > 0 && rule.actions.size.height > 0) {
+      rule.actions.has_size = true;
+    } else {
+      return "invalid action " + token;
+    }
+  }
+  if (num_actions == 0) {
+    return "expected actions";
+  }
+
+  // 4. Index patterns.
+  for (const auto& pattern : patterns) {
+    FieldIndex& field_index = fields_[pattern.first];
+    const string& value = pattern.second;
+    if (value.back() == '*') {
+      TrieNode* node = &field_index.prefixes;
+      for (size_t i = 0; i + 1 < value.size(); ++i) {
+        unique_ptr<TrieNode>& child = node->children[value[i]];
+        if (!child) {
+          child.reset(new TrieNode());
+        }
+        node = child.get();
+      }
+      node->rules.push_back(index);
+    } else {
+      field_index.exact[value].push_back(index);
+    }
+    ++rule.num_patterns;
+  }
+  if (rule.num_patterns == 0) {
+    unconditional_.push_back(index);
+  }
+  rules_.push_back(::std::move(rule));
+  return "";
+}
+
+void WindowRules::AddMatches(
+    Field field, const string& value, vector<int>* rules) const {
+  const FieldIndex& field_index = fields_[field];
+  // 1. Exact patterns.
+  auto i = field_index.exact.find(value);
+  if (i != field_index.exact.end()) {
+    rules->insert(rules->end(), i->second.begin(), i->second.end());
+  }
+  // 2. Prefix patterns, i.e. those ending at each node on the path spelling
+  // out the value.
+  const TrieNode* node = &field_index.prefixes;
+  for (size_t j = 0;; ++j) {
+    rules->insert(rules->end(), node->rules.begin(), node->rules.end());
+    if (j == value.size()) {
+      break;
+    }
+    auto child = node->children.find(value[j]);
+    if (child == node->children.end()) {
+      break;
+    }
+    node = child->second.get();
+  }
+}
@@ -0,0 +1,118 @@
+#ifndef WINDOW_RULES_HPP
+#define WINDOW_RULES_HPP
+
+#include <istream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "util.hpp"
+
+// How a client window is to be managed, as decided by window rules.
+struct WindowRuleDecision {
+  // Whether to frame and manage the window. Unmanaged windows, such as
+  // panels, are mapped as they are.
+  bool manage;
+  // Index of the output to place the window on, or -1 to leave it where it
+  // asked to be.
+  int output;
+  // Position of the frame, relative to the output if one is set.
+  bool has_position;
+  Position<int> position;
+  // Size of the client window.
+  bool has_size;
+  Size<int> size;
+
+  WindowRuleDecision();
+};
+
+// A set of per-application window rules, compiled for matching when windows
+// are mapped.
+//
+// Rules are read from a file with one rule per line, in the form
+//
+//   [class=<pattern>] [instance=<pattern>] [role=<pattern>] -> <action>...
+//
+// where a pattern is either an exact WM_CLASS class, WM_CLASS instance or
+// WM_WINDOW_ROLE value, or a prefix followed by '*'. Actions are
+// "manage=yes|no", "output=<index>", "position=<x>,<y>" and
+// "size=<width>x<height>". Blank lines and lines starting with '#' are
+// ignored. Every rule whose patterns all match applies, with later rules
+// overriding the actions of earlier ones.
+//
+// Exact patterns are indexed in a hash table per field, and prefix patterns in
+// a trie per field, so that matching a window costs a few lookups per field
+// however many rules there are.
+class WindowRules {
+ public:
+  // Compiles the rules in a file. On failure, returns nullptr and sets error.
+  static ::std::unique_ptr<WindowRules> Load(
+      const ::std::string& path, ::std::string* error);
+  // Compiles rules read from a stream. On failure, returns nullptr and sets
+  // error.
+  static ::std::unique_ptr<WindowRules> Parse(
+      ::std::istream* in, ::std::string* error);
+
+  // Returns the decision for a window with the given WM_CLASS and
+  // WM_WINDOW_ROLE.
+  WindowRuleDecision Match(
+      const ::std::string& class_name,
+      const ::std::string& instance_name,
+      const ::std::string& role) const;
+
+  // Number of rules.
+  size_t size() const { return rules_.size(); }
+
+ private:
+  // Window properties matched by rules.
+  enum Field {
+    CLASS,
+    INSTANCE,
+    ROLE,
+    NUM_FIELDS,
+  };
+
+  // A compiled rule.
+  struct Rule {
+    // Number of fields with a pattern.
+    int num_patterns;
+    // Actions, with only those set by the rule marked in has_*.
+    bool has_manage;
+    bool has_output;
+    WindowRuleDecision actions;
+  };
+
+  // A node of a trie of prefix patterns.
+  struct TrieNode {
+    // Children by next character.
+    ::std::unordered_map<char, ::std::unique_ptr<TrieNode>> children;
+    // Rules with the prefix ending at this node.
+    ::std::vector<int> rules;
+  };
+
+  // Index of the patterns of one field.
+  struct FieldIndex {
+    // Rules by exact value.
+    ::std::unordered_map<::std::string, ::std::vector<int>> exact;
+    // Rules by prefix.
+    TrieNode prefixes;
+  };
+
+  WindowRules();
+  // Parses a single rule line into rules_ and the indices. Returns an empty
+  // string on success, or an error message.
+  ::std::string AddRule(const ::std::string& line);
+  // Appends the rules with a pattern of a field matching value.
+  void AddMatches(
+      Field field, const ::std::string& value, ::std::vector<int>* rules)
+      const;
+
+  // Rules in file order.
+  ::std::vector<Rule> rules_;
+  // Pattern indices per field.
+  FieldIndex fields_[NUM_FIELDS];
+  // Rules without patterns, which match every window.
+  ::std::vector<int> unconditional_;
+};
+
+#endif